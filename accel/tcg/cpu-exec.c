@@ -37,6 +37,9 @@
 #endif
 #include "sysemu/cpus.h"
 #include "sysemu/replay.h"
+#if defined(TARGET_CHERI) && defined(CONFIG_SOFTMMU)
+#include "cheri_tagmem.h"
+#endif
 
 /* -icount align implementation. */
 
@@ -215,6 +218,11 @@ static void cpu_exec_nocache(CPUState *cpu, int max_cycles,
 
     mmap_lock();
     tb = tb_gen_code(cpu, orig_tb->pc, orig_tb->cs_base,
+#ifdef TARGET_CHERI
+                     orig_tb->cs_top, orig_tb->cheri_flags,
+#else
+                     0, 0,
+#endif
                      orig_tb->flags, cflags);
     tb->orig_tb = orig_tb;
     mmap_unlock();
@@ -234,16 +242,18 @@ void cpu_exec_step_atomic(CPUState *cpu)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
     TranslationBlock *tb;
-    target_ulong cs_base, pc;
-    uint32_t flags;
+    target_ulong cs_base, cs_top, pc;
+    uint32_t cheri_flags, flags;
     uint32_t cflags = 1;
     uint32_t cf_mask = cflags & CF_HASH_MASK;
 
     if (sigsetjmp(cpu->jmp_env, 0) == 0) {
-        tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
+        tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &cs_top, &cheri_flags,
+                                  &flags, cf_mask);
         if (tb == NULL) {
             mmap_lock();
-            tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
+            tb = tb_gen_code(cpu, pc, cs_base, cs_top, cheri_flags, flags,
+                             cflags);
             mmap_unlock();
         }
 
@@ -284,6 +294,8 @@ void cpu_exec_step_atomic(CPUState *cpu)
 struct tb_desc {
     target_ulong pc;
     target_ulong cs_base;
+    target_ulong cs_top;
+    uint32_t cheri_flags;
     CPUArchState *env;
     tb_page_addr_t phys_page1;
     uint32_t flags;
@@ -299,6 +311,7 @@ static bool tb_lookup_cmp(const void *p, const void *d)
     if (tb->pc == desc->pc &&
         tb->page_addr[0] == desc->phys_page1 &&
         tb->cs_base == desc->cs_base &&
+        tb_cheri_state_matches(tb, desc->cs_top, desc->cheri_flags) &&
         tb->flags == desc->flags &&
         tb->trace_vcpu_dstate == desc->trace_vcpu_dstate &&
         (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == desc->cf_mask) {
@@ -320,7 +333,8 @@ static bool tb_lookup_cmp(const void *p, const void *d)
 }
 
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
-                                   target_ulong cs_base, uint32_t flags,
+                                   target_ulong cs_base, target_ulong cs_top,
+                                   uint32_t cheri_flags, uint32_t flags,
                                    uint32_t cf_mask)
 {
     tb_page_addr_t phys_pc;
@@ -329,6 +343,8 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
 
     desc.env = (CPUArchState *)cpu->env_ptr;
     desc.cs_base = cs_base;
+    desc.cs_top = cs_top;
+    desc.cheri_flags = cheri_flags;
     desc.flags = flags;
     desc.cf_mask = cf_mask;
     desc.trace_vcpu_dstate = *cpu->trace_dstate;
@@ -397,13 +413,15 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
                                         int tb_exit, uint32_t cf_mask)
 {
     TranslationBlock *tb;
-    target_ulong cs_base, pc;
-    uint32_t flags;
+    target_ulong cs_base, cs_top, pc;
+    uint32_t cheri_flags, flags;
 
-    tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
+    tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &cs_top, &cheri_flags,
+                              &flags, cf_mask);
     if (tb == NULL) {
         mmap_lock();
-        tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
+        tb = tb_gen_code(cpu, pc, cs_base, cs_top, cheri_flags, flags,
+                         cf_mask);
         mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
         atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
@@ -703,6 +721,10 @@ int cpu_exec(CPUState *cpu)
             qemu_mutex_unlock_iothread();
         }
         qemu_plugin_disable_mem_helpers(cpu);
+#if defined(TARGET_CHERI) && defined(CONFIG_SOFTMMU)
+        /* An integer store may have faulted after cheri_tag_store_begin(). */
+        cheri_tag_store_end(cpu->env_ptr);
+#endif
 
         assert_no_pages_locked();
     }
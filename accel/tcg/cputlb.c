@@ -39,6 +39,9 @@
 #ifdef CONFIG_PLUGIN
 #include "qemu/plugin-memory.h"
 #endif
+#ifdef TARGET_CHERI
+#include "cheri_tagmem.h"
+#endif
 
 /* DEBUG defines, enable DEBUG_TLB_LOG to log to the CPU_LOG_MMU target */
 /* #define DEBUG_TLB */
@@ -264,6 +267,9 @@ void tlb_init(CPUState *cpu)
 
     /* All tlbs are initialized flushed. */
     env_tlb(env)->c.dirty = 0;
+#ifdef TARGET_CHERI
+    env_tlb(env)->c.cheri_tag_hazard = UINTPTR_MAX;
+#endif
 
     for (i = 0; i < NB_MMU_MODES; i++) {
         tlb_mmu_init(&env_tlb(env)->d[i], &env_tlb(env)->f[i], now);
@@ -746,8 +752,9 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
 static inline void tlb_set_dirty1_locked(CPUTLBEntry *tlb_entry,
                                          target_ulong vaddr)
 {
-    if (tlb_entry->addr_write == (vaddr | TLB_NOTDIRTY)) {
-        tlb_entry->addr_write = vaddr;
+    if ((tlb_entry->addr_write & ~TLB_CHERI_TAGGED) ==
+        (vaddr | TLB_NOTDIRTY)) {
+        tlb_entry->addr_write &= ~TLB_NOTDIRTY;
     }
 }
 
@@ -775,6 +782,54 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
+#ifdef TARGET_CHERI
+/* Called with tlb_c.lock held */
+static void tlb_set_cheri_tagged_locked(CPUTLBEntry *tlb_entry,
+                                        const CPUIOTLBEntry *iotlbentry,
+                                        ram_addr_t ram_addr)
+{
+    target_ulong addr = tlb_entry->addr_write;
+
+    if ((addr & (TLB_INVALID_MASK | TLB_MMIO | TLB_DISCARD_WRITE)) == 0 &&
+        iotlbentry->tag_ram_addr == ram_addr) {
+#if TCG_OVERSIZED_GUEST
+        tlb_entry->addr_write |= TLB_CHERI_TAGGED;
+#else
+        atomic_set(&tlb_entry->addr_write, addr | TLB_CHERI_TAGGED);
+#endif
+    }
+}
+
+/*
+ * Send the stores of @cpu to the RAM page at @ram_addr through the slow path,
+ * since it may now hold CHERI tags (see cheri_tag_mark_page()). Like
+ * tlb_reset_dirty() this is a cross vCPU call.
+ */
+void tlb_set_cheri_tagged(CPUState *cpu, ram_addr_t ram_addr)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    qemu_spin_lock(&env_tlb(env)->c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+        unsigned int i;
+        unsigned int n = tlb_n_entries(&env_tlb(env)->f[mmu_idx]);
+
+        for (i = 0; i < n; i++) {
+            tlb_set_cheri_tagged_locked(&env_tlb(env)->f[mmu_idx].table[i],
+                                        &desc->iotlb[i], ram_addr);
+        }
+
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            tlb_set_cheri_tagged_locked(&desc->vtable[i], &desc->viotlb[i],
+                                        ram_addr);
+        }
+    }
+    qemu_spin_unlock(&env_tlb(env)->c.lock);
+}
+#endif
+
 /* Our TLB does not support large pages, so remember the area covered by
    large pages and trigger a full TLB flush if these are invalidated.  */
 static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
@@ -877,6 +932,11 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
             } else if (cpu_physical_memory_is_clean(iotlb)) {
                 write_address |= TLB_NOTDIRTY;
             }
+#ifdef TARGET_CHERI
+            if (cheri_tag_page_maybe_tagged(iotlb)) {
+                write_address |= TLB_CHERI_TAGGED;
+            }
+#endif
         }
     } else {
         /* I/O or ROMD */
@@ -942,6 +1002,25 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      */
     desc->iotlb[index].addr = iotlb - vaddr_page;
     desc->iotlb[index].attrs = attrs;
+#ifdef TARGET_CHERI
+    desc->iotlb[index].cheri_prot =
+        prot & (PAGE_LC_CLEAR | PAGE_LC_TRAP | PAGE_SC_TRAP);
+    desc->iotlb[index].paddr_page = paddr_page;
+    if (is_ram || is_romd) {
+        ram_addr_t tag_ram_addr =
+            memory_region_get_ram_addr(section->mr) + xlat;
+        desc->iotlb[index].tag_ram_addr = tag_ram_addr;
+        desc->iotlb[index].tagmem = cheri_tagmem_for_addr(tag_ram_addr);
+        desc->iotlb[index].tagseq = cheri_tag_seq_for_addr(tag_ram_addr);
+        desc->iotlb[index].tagmem_readonly =
+            is_romd || memory_region_is_rom(section->mr);
+    } else {
+        desc->iotlb[index].tag_ram_addr = RAM_ADDR_INVALID;
+        desc->iotlb[index].tagmem = NULL;
+        desc->iotlb[index].tagseq = NULL;
+        desc->iotlb[index].tagmem_readonly = true;
+    }
+#endif
 
     /* Now calculate the new entry */
     tn.addend = addend - vaddr_page;
@@ -1232,35 +1311,32 @@ static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
 }
 
 /*
- * Probe for whether the specified guest access is permitted. If it is not
- * permitted then an exception will be taken in the same way as if this
- * were a real access (and we will not return).
- * If the size is 0 or the page requires I/O access, returns NULL; otherwise,
- * returns the address of the host page similar to tlb_vaddr_to_host().
+ * Make sure the TLB holds a valid entry for a guest access of @size bytes
+ * at @addr, filling it (and raising the guest exception if the access is
+ * not permitted) if required. Returns the TLB index of the entry and stores
+ * the TLB address for @access_type in @ptlb_addr.
  */
-void *probe_access(CPUArchState *env, target_ulong addr, int size,
-                   MMUAccessType access_type, int mmu_idx, uintptr_t retaddr)
+static uintptr_t probe_access_internal(CPUArchState *env, target_ulong addr,
+                                       int size, MMUAccessType access_type,
+                                       int mmu_idx, uintptr_t retaddr,
+                                       target_ulong *ptlb_addr)
 {
     uintptr_t index = tlb_index(env, mmu_idx, addr);
     CPUTLBEntry *entry = tlb_entry(env, mmu_idx, addr);
     target_ulong tlb_addr;
     size_t elt_ofs;
-    int wp_access;
 
     g_assert(-(addr | TARGET_PAGE_MASK) >= size);
 
     switch (access_type) {
     case MMU_DATA_LOAD:
         elt_ofs = offsetof(CPUTLBEntry, addr_read);
-        wp_access = BP_MEM_READ;
         break;
     case MMU_DATA_STORE:
         elt_ofs = offsetof(CPUTLBEntry, addr_write);
-        wp_access = BP_MEM_WRITE;
         break;
     case MMU_INST_FETCH:
         elt_ofs = offsetof(CPUTLBEntry, addr_code);
-        wp_access = BP_MEM_READ;
         break;
     default:
         g_assert_not_reached();
@@ -1277,6 +1353,24 @@ void *probe_access(CPUArchState *env, target_ulong addr, int size,
         }
         tlb_addr = tlb_read_ofs(entry, elt_ofs);
     }
+    *ptlb_addr = tlb_addr;
+    return index;
+}
+
+/*
+ * Probe for whether the specified guest access is permitted. If it is not
+ * permitted then an exception will be taken in the same way as if this
+ * were a real access (and we will not return).
+ * If the size is 0 or the page requires I/O access, returns NULL; otherwise,
+ * returns the address of the host page similar to tlb_vaddr_to_host().
+ */
+void *probe_access(CPUArchState *env, target_ulong addr, int size,
+                   MMUAccessType access_type, int mmu_idx, uintptr_t retaddr)
+{
+    target_ulong tlb_addr;
+    uintptr_t index = probe_access_internal(env, addr, size, access_type,
+                                            mmu_idx, retaddr, &tlb_addr);
+    int wp_access = access_type == MMU_DATA_STORE ? BP_MEM_WRITE : BP_MEM_READ;
 
     if (!size) {
         return NULL;
@@ -1302,8 +1396,45 @@ void *probe_access(CPUArchState *env, target_ulong addr, int size,
         }
     }
 
-    return (void *)((uintptr_t)addr + entry->addend);
+    return (void *)((uintptr_t)addr + tlb_entry(env, mmu_idx, addr)->addend);
+}
+
+#ifdef TARGET_CHERI
+/*
+ * Like probe_access(), but return the CPUIOTLBEntry of the page instead of
+ * a host pointer. This allows the CHERI tag memory for @addr to be found
+ * with the same TLB lookup as the data access (see cheri_tagmem.c).
+ * The returned entry is only valid until the next TLB fill or flush.
+ *
+ * If @phost is not NULL it is set to the host address of @addr, or to NULL
+ * if the page must be accessed through the slow path (I/O, watchpoints...).
+ * As with probe_access(), clean RAM pages are marked dirty for stores.
+ */
+CPUIOTLBEntry *probe_access_iotlb(CPUArchState *env, target_ulong addr,
+                                  int size, MMUAccessType access_type,
+                                  int mmu_idx, uintptr_t retaddr,
+                                  void **phost)
+{
+    target_ulong tlb_addr;
+    uintptr_t index = probe_access_internal(env, addr, size, access_type,
+                                            mmu_idx, retaddr, &tlb_addr);
+    CPUIOTLBEntry *iotlbentry = &env_tlb(env)->d[mmu_idx].iotlb[index];
+
+    if (phost) {
+        *phost = NULL;
+        if (unlikely(tlb_addr &
+                     (TLB_FLAGS_MASK & ~(TLB_NOTDIRTY | TLB_CHERI_TAGGED)))) {
+            return iotlbentry;
+        }
+        if (unlikely(tlb_addr & TLB_NOTDIRTY)) {
+            notdirty_write(env_cpu(env), addr, size, iotlbentry, retaddr);
+        }
+        *phost = (void *)((uintptr_t)addr +
+                          tlb_entry(env, mmu_idx, addr)->addend);
+    }
+    return iotlbentry;
 }
+#endif
 
 void *tlb_vaddr_to_host(CPUArchState *env, abi_ptr addr,
                         MMUAccessType access_type, int mmu_idx)
@@ -1446,7 +1577,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
     }
 
     /* Let the guest notice RMW on a write-only page.  */
-    if (unlikely(tlbe->addr_read != (tlb_addr & ~TLB_NOTDIRTY))) {
+    if (unlikely(tlbe->addr_read !=
+                 (tlb_addr & ~(TLB_NOTDIRTY | TLB_CHERI_TAGGED)))) {
         tlb_fill(env_cpu(env), addr, 1 << s_bits, MMU_DATA_LOAD,
                  mmu_idx, retaddr);
         /* Since we don't support reads and writes to different addresses,
@@ -1468,6 +1600,23 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
     cpu_loop_exit_atomic(env_cpu(env), retaddr);
 }
 
+#ifdef TARGET_CHERI
+/*
+ * Atomic operations overwrite capabilities like any other store, so their
+ * tags are cleared (and kept clear) before the host atomic operation, see
+ * cheri_tag_store_begin(). This also applies to the 16-byte atomic load,
+ * which the CHERI targets don't use.
+ */
+static void *cheri_atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
+                                     TCGMemOpIdx oi, uintptr_t retaddr)
+{
+    void *hostaddr = atomic_mmu_lookup(env, addr, oi, retaddr);
+
+    cheri_tag_store_begin(env, addr, memop_size(get_memop(oi)), retaddr);
+    return hostaddr;
+}
+#endif
+
 /*
  * Load Helpers
  *
@@ -1935,6 +2084,9 @@ store_helper(CPUArchState *env, target_ulong addr, uint64_t val,
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
         CPUIOTLBEntry *iotlbentry;
         bool need_swap;
+#ifdef TARGET_CHERI
+        bool cheri_tags;
+#endif
 
         /* For anything that is unaligned, recurse through byte stores.  */
         if ((addr & (size - 1)) != 0) {
@@ -1971,6 +2123,17 @@ store_helper(CPUArchState *env, target_ulong addr, uint64_t val,
 
         haddr = (void *)((uintptr_t)addr + entry->addend);
 
+#ifdef TARGET_CHERI
+        /*
+         * With MTTCG, inline stores to pages that may hold tags come here to
+         * clear them, see tcg_gen_qemu_st_i32_with_checked_addr().
+         */
+        cheri_tags = (tlb_addr & TLB_CHERI_TAGGED) && parallel_cpus;
+        if (cheri_tags) {
+            cheri_tag_store_begin(env, addr, size, retaddr);
+        }
+#endif
+
         /*
          * Keep these two store_memop separate to ensure that the compiler
          * is able to fold the entire function to a single instruction.
@@ -1981,6 +2144,11 @@ store_helper(CPUArchState *env, target_ulong addr, uint64_t val,
         } else {
             store_memop(haddr, val, op);
         }
+#ifdef TARGET_CHERI
+        if (cheri_tags) {
+            cheri_tag_store_end(env);
+        }
+#endif
         return;
     }
 
@@ -2192,8 +2360,13 @@ void cpu_stq_data(CPUArchState *env, target_ulong ptr, uint64_t val)
 #define ATOMIC_NAME(X) \
     HELPER(glue(glue(glue(atomic_ ## X, SUFFIX), END), _mmu))
 #define ATOMIC_MMU_DECLS
+#ifdef TARGET_CHERI
+#define ATOMIC_MMU_LOOKUP cheri_atomic_mmu_lookup(env, addr, oi, retaddr)
+#define ATOMIC_MMU_CLEANUP cheri_tag_store_end(env)
+#else
 #define ATOMIC_MMU_LOOKUP atomic_mmu_lookup(env, addr, oi, retaddr)
 #define ATOMIC_MMU_CLEANUP
+#endif
 #define ATOMIC_MMU_IDX   get_mmuidx(oi)
 
 #include "atomic_common.inc.c"
@@ -2224,7 +2397,11 @@ void cpu_stq_data(CPUArchState *env, target_ulong ptr, uint64_t val)
 #undef ATOMIC_MMU_LOOKUP
 #define EXTRA_ARGS         , TCGMemOpIdx oi
 #define ATOMIC_NAME(X)     HELPER(glue(glue(atomic_ ## X, SUFFIX), END))
+#ifdef TARGET_CHERI
+#define ATOMIC_MMU_LOOKUP  cheri_atomic_mmu_lookup(env, addr, oi, GETPC())
+#else
 #define ATOMIC_MMU_LOOKUP  atomic_mmu_lookup(env, addr, oi, GETPC())
+#endif
 
 #define DATA_SIZE 1
 #include "atomic_template.h"
@@ -149,10 +149,11 @@ void *HELPER(lookup_tb_ptr)(CPUArchState *env)
 {
     CPUState *cpu = env_cpu(env);
     TranslationBlock *tb;
-    target_ulong cs_base, pc;
-    uint32_t flags;
+    target_ulong cs_base, cs_top, pc;
+    uint32_t cheri_flags, flags;
 
-    tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, curr_cflags());
+    tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &cs_top, &cheri_flags, &flags,
+                              curr_cflags());
     if (tb == NULL) {
         return tcg_ctx->code_gen_epilogue;
     }
@@ -368,6 +368,12 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
            and shift if to the number of actually executed instructions */
         cpu_neg(cpu)->icount_decr.u16.low += num_insns - i;
     }
+#ifdef TARGET_CHERI
+    if (reset_icount) {
+        /* Like icount, the statcounters were charged for the whole TB. */
+        cpu_statcounters_uncount(env, tb->flags, num_insns - i);
+    }
+#endif
     restore_state_to_opc(env, tb, data);
 
 #ifdef CONFIG_PROFILER
@@ -1125,6 +1131,10 @@ static bool tb_cmp(const void *ap, const void *bp)
 
     return a->pc == b->pc &&
         a->cs_base == b->cs_base &&
+#ifdef TARGET_CHERI
+        a->cs_top == b->cs_top &&
+        a->cheri_flags == b->cheri_flags &&
+#endif
         a->flags == b->flags &&
         (tb_cflags(a) & CF_HASH_MASK) == (tb_cflags(b) & CF_HASH_MASK) &&
         a->trace_vcpu_dstate == b->trace_vcpu_dstate &&
@@ -1663,6 +1673,7 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
+                              target_ulong cs_top, uint32_t cheri_flags,
                               uint32_t flags, int cflags)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -1715,6 +1726,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->tc.ptr = gen_code_buf;
     tb->pc = pc;
     tb->cs_base = cs_base;
+#ifdef TARGET_CHERI
+    tb->cs_top = cs_top;
+    tb->cheri_flags = cheri_flags;
+#endif
     tb->flags = flags;
     tb->cflags = cflags;
     tb->orig_tb = NULL;
@@ -538,6 +538,24 @@ STEXI
 Show CPU statistics.
 ETEXI
 
+#if defined(TARGET_MIPS) && defined(TARGET_CHERI)
+    {
+        .name       = "cheri-stats",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show CHERI statcounters and capability statistics",
+        .cmd        = hmp_info_cheri_stats,
+    },
+#endif
+
+STEXI
+@item info cheri-stats
+@findex info cheri-stats
+Show the CHERI statcounters, capability load/store counts, out-of-bounds
+capability statistics and magic library call counts of each vCPU without
+stopping the guest (CHERI-MIPS only).
+ETEXI
+
 #if defined(CONFIG_SLIRP)
     {
         .name       = "usernet",
@@ -1694,6 +1694,28 @@ STEXI
 @item mce @var{cpu} @var{bank} @var{status} @var{mcgstatus} @var{addr} @var{misc}
 @findex mce (x86)
 Inject an MCE on the given CPU (x86 only).
+ETEXI
+
+#if defined(TARGET_MIPS) && defined(CONFIG_MIPS_LOG_INSTR)
+
+    {
+        .name       = "cheri-trace-filter",
+        .args_type  = "filter:s?",
+        .params     = "[asid=N[-M],range=START-END,...|none]",
+        .help       = "restrict instruction tracing to the given ASIDs and "
+                      "address ranges (show the current filter without "
+                      "arguments)",
+        .cmd        = hmp_cheri_trace_filter,
+    },
+
+#endif
+STEXI
+@item cheri-trace-filter [@var{filter}]
+@findex cheri-trace-filter (MIPS)
+Only trace instructions whose ASID and PC match @var{filter}, a comma
+separated list of asid=N[-M] and range=START-END items. Code is retranslated
+without any logging calls when it does not match. Use @code{none} to remove
+the filter; without an argument the current filter is printed.
 ETEXI
 
     {
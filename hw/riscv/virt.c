@@ -42,6 +42,9 @@
 #include "exec/address-spaces.h"
 #include "hw/pci/pci.h"
 #include "hw/pci-host/gpex.h"
+#ifdef TARGET_CHERI
+#include "cheri_tagmem.h"
+#endif
 
 #include <libfdt.h>
 
@@ -466,6 +469,12 @@ static void riscv_virt_board_init(MachineState *machine)
     memory_region_add_subregion(system_memory, memmap[VIRT_DRAM].base,
         main_mem);
 
+#ifdef TARGET_CHERI
+    /* Tags are indexed by ram_addr_t, so cover main memory's RAM block. */
+    cheri_tag_init(memory_region_get_ram_addr(main_mem) +
+                   memory_region_size(main_mem));
+#endif /* TARGET_CHERI */
+
     /* create device tree */
     create_fdt(s, memmap, machine->ram_size, machine->kernel_cmdline);
 
@@ -357,13 +357,19 @@ CPUArchState *cpu_copy(CPUArchState *env);
 #define TLB_BSWAP           (1 << (TARGET_PAGE_BITS_MIN - 5))
 /* Set if TLB entry writes ignored.  */
 #define TLB_DISCARD_WRITE   (1 << (TARGET_PAGE_BITS_MIN - 6))
+#ifdef TARGET_CHERI
+/* Set if stores to the page may have to clear CHERI tags (MTTCG only).  */
+#define TLB_CHERI_TAGGED    (1 << (TARGET_PAGE_BITS_MIN - 7))
+#else
+#define TLB_CHERI_TAGGED    0
+#endif
 
 /* Use this mask to check interception with an alignment mask
  * in a TCG backend.
  */
 #define TLB_FLAGS_MASK \
     (TLB_INVALID_MASK | TLB_NOTDIRTY | TLB_MMIO \
-    | TLB_WATCHPOINT | TLB_BSWAP | TLB_DISCARD_WRITE)
+    | TLB_WATCHPOINT | TLB_BSWAP | TLB_DISCARD_WRITE | TLB_CHERI_TAGGED)
 
 /**
  * tlb_hit_page: return true if page aligned @addr is a hit against the
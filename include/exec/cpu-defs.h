@@ -146,6 +146,30 @@ typedef struct CPUIOTLBEntry {
      */
     hwaddr addr;
     MemTxAttrs attrs;
+#ifdef TARGET_CHERI
+    /*
+     * CHERI tag memory for this page, so that capability loads and stores
+     * find their tag with the same TLB lookup as the data:
+     *  - @tag_ram_addr is the ram_addr_t of the page, or RAM_ADDR_INVALID
+     *    if the page is not backed by RAM (and therefore has no tags)
+     *  - @tagmem caches the host pointer to the tag bitmap word holding the
+     *    tag of the first capability in the page (NULL if untagged)
+     *  - @tagmem_readonly is set for ROM pages, whose tags cannot change
+     *  - @tagseq points to the sequence count of the tag stripe of the
+     *    page, which inline capability loads check (NULL if they can't)
+     *  - @cheri_prot holds the PAGE_LC_* and PAGE_SC_TRAP bits returned by
+     *    the target MMU when the entry was filled
+     *  - @paddr_page is the guest physical address of the page, so that
+     *    the tag code can translate addresses without walking the page
+     *    tables again
+     */
+    uint64_t tag_ram_addr;
+    void *tagmem;
+    unsigned *tagseq;
+    bool tagmem_readonly;
+    int cheri_prot;
+    hwaddr paddr_page;
+#endif
 } CPUIOTLBEntry;
 
 /*
@@ -206,6 +230,15 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+#ifdef TARGET_CHERI
+    /*
+     * With MTTCG, the ram_addr_t of the capability granule that this vCPU
+     * is currently overwriting with an integer store (UINTPTR_MAX if none),
+     * so that other vCPUs don't set its tag in the meantime. Read by other
+     * vCPUs, see cheri_tag_store_begin().
+     */
+    uintptr_t cheri_tag_hazard;
+#endif
 } CPUTLBCommon;
 
 /*
@@ -68,6 +68,7 @@ void QEMU_NORETURN cpu_loop_exit_noexc(CPUState *cpu);
 void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
+                              target_ulong cs_top, uint32_t cheri_flags,
                               uint32_t flags,
                               int cflags);
 
@@ -333,6 +334,14 @@ static inline void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu,
 void *probe_access(CPUArchState *env, target_ulong addr, int size,
                    MMUAccessType access_type, int mmu_idx, uintptr_t retaddr);
 
+#if defined(TARGET_CHERI) && !defined(CONFIG_USER_ONLY)
+CPUIOTLBEntry *probe_access_iotlb(CPUArchState *env, target_ulong addr,
+                                  int size, MMUAccessType access_type,
+                                  int mmu_idx, uintptr_t retaddr,
+                                  void **phost);
+void tlb_set_cheri_tagged(CPUState *cpu, ram_addr_t ram_addr);
+#endif
+
 static inline void *probe_write(CPUArchState *env, target_ulong addr, int size,
                                 int mmu_idx, uintptr_t retaddr)
 {
@@ -373,6 +382,10 @@ struct TranslationBlock {
     target_ulong pc;   /* simulated PC corresponding to this block (EIP + CS base) */
     target_ulong cs_base; /* CS base for this block */
     uint32_t flags; /* flags defining in which context the code was generated */
+#ifdef TARGET_CHERI
+    target_ulong cs_top; /* PCC top for this block (cs_base holds the base) */
+    uint32_t cheri_flags; /* Further PCC state the code depends on */
+#endif
     uint16_t size;      /* size of target code for this block (1 <=
                            size <= TARGET_PAGE_SIZE) */
     uint16_t icount;
@@ -453,6 +466,36 @@ static inline uint32_t curr_cflags(void)
          | (use_icount ? CF_USE_ICOUNT : 0);
 }
 
+/*
+ * CHERI targets also key translation blocks on the bounds and flags of PCC
+ * so that the PCC checks can be performed at translation time. They provide
+ * cpu_get_tb_cpu_state_cheri(), which returns the PCC base in @cs_base.
+ */
+#ifndef TARGET_CHERI
+static inline void cpu_get_tb_cpu_state_cheri(CPUArchState *env,
+                                              target_ulong *pc,
+                                              target_ulong *cs_base,
+                                              target_ulong *cs_top,
+                                              uint32_t *cheri_flags,
+                                              uint32_t *flags)
+{
+    cpu_get_tb_cpu_state(env, pc, cs_base, flags);
+    *cs_top = 0;
+    *cheri_flags = 0;
+}
+#endif
+
+static inline bool tb_cheri_state_matches(const TranslationBlock *tb,
+                                          target_ulong cs_top,
+                                          uint32_t cheri_flags)
+{
+#ifdef TARGET_CHERI
+    return tb->cs_top == cs_top && tb->cheri_flags == cheri_flags;
+#else
+    return true;
+#endif
+}
+
 /* TranslationBlock invalidate API */
 #if defined(CONFIG_USER_ONLY)
 void tb_invalidate_phys_addr(target_ulong addr);
@@ -463,7 +506,8 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr, MemTxAttrs attrs);
 void tb_flush(CPUState *cpu);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
-                                   target_ulong cs_base, uint32_t flags,
+                                   target_ulong cs_base, target_ulong cs_top,
+                                   uint32_t cheri_flags, uint32_t flags,
                                    uint32_t cf_mask);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
 
@@ -19,13 +19,14 @@
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *
 tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
+                     target_ulong *cs_top, uint32_t *cheri_flags,
                      uint32_t *flags, uint32_t cf_mask)
 {
     CPUArchState *env = (CPUArchState *)cpu->env_ptr;
     TranslationBlock *tb;
     uint32_t hash;
 
-    cpu_get_tb_cpu_state(env, pc, cs_base, flags);
+    cpu_get_tb_cpu_state_cheri(env, pc, cs_base, cs_top, cheri_flags, flags);
     hash = tb_jmp_cache_hash_func(*pc);
     tb = atomic_rcu_read(&cpu->tb_jmp_cache[hash]);
 
@@ -35,12 +36,14 @@ tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
     if (likely(tb &&
                tb->pc == *pc &&
                tb->cs_base == *cs_base &&
+               tb_cheri_state_matches(tb, *cs_top, *cheri_flags) &&
                tb->flags == *flags &&
                tb->trace_vcpu_dstate == *cpu->trace_dstate &&
                (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask)) {
         return tb;
     }
-    tb = tb_htable_lookup(cpu, *pc, *cs_base, *flags, cf_mask);
+    tb = tb_htable_lookup(cpu, *pc, *cs_base, *cs_top, *cheri_flags, *flags,
+                          cf_mask);
     if (tb == NULL) {
         return NULL;
     }
@@ -48,5 +48,7 @@ void hmp_info_tlb(Monitor *mon, const QDict *qdict);
 void hmp_mce(Monitor *mon, const QDict *qdict);
 void hmp_info_local_apic(Monitor *mon, const QDict *qdict);
 void hmp_info_io_apic(Monitor *mon, const QDict *qdict);
+void hmp_cheri_trace_filter(Monitor *mon, const QDict *qdict);
+void hmp_info_cheri_stats(Monitor *mon, const QDict *qdict);
 
 #endif /* MONITOR_HMP_TARGET_H */
@@ -69,6 +69,8 @@ static inline bool qemu_log_separate(void)
  * instruction tracing does not cause QEMU to close and reopen the logfile.
  */
 #define CPU_LOG_USER_ONLY  (1 << 21)
+/* Any of these makes CHERI targets translate instruction logging code */
+#define CPU_LOG_INSTR_ANY  (CPU_LOG_INSTR | CPU_LOG_CVTRACE | CPU_LOG_USER_ONLY)
 #define CPU_LOG_CHERI_BOUNDS (1 << 22)
 #define CPU_LOG_GUEST_DEBUG_MSG (1 << 23)
 
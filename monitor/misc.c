@@ -610,6 +610,15 @@ static void hmp_log(Monitor *mon, const QDict *qdict)
             return;
         }
     }
+#ifdef TARGET_CHERI
+    /*
+     * Whether instructions are logged is part of the TB key, but chained TBs
+     * are never looked up again. Drop the code translated for the old mask.
+     */
+    if (first_cpu && ((qemu_loglevel ^ mask) & CPU_LOG_INSTR_ANY)) {
+        tb_flush(first_cpu);
+    }
+#endif
     qemu_set_log(mask);
 }
 
@@ -4037,10 +4037,24 @@ Set GDB breakpoint in <count> instructions after start.
 ETEXI
 
 DEF("cheri-trace-format", HAS_ARG, QEMU_OPTION_cheri_trace_format, \
-"-cheri-trace-format [text|cvtrace]     Select CHERI trace mode.\n", QEMU_ARCH_ALL)
+"-cheri-trace-format [text|cvtrace|cvtrace-compressed]     Select CHERI trace mode.\n", QEMU_ARCH_ALL)
 STEXI
 @item -cheri-trace-format @var{type}
-Set CHERI trace format to <type> (text or cvtrace)
+Set CHERI trace format to <type> (text, cvtrace or cvtrace-compressed).
+cvtrace-compressed writes the cvtrace records delta encoded in independently
+decodable frames and appends a frame index when tracing stops; use
+scripts/cheri-cvtrace-dump.py to read it.
+ETEXI
+
+DEF("cheri-trace-filter", HAS_ARG, QEMU_OPTION_cheri_trace_filter, \
+"-cheri-trace-filter asid=N[-M],range=START-END,...     Only trace matching ASIDs and address ranges.\n", QEMU_ARCH_MIPS)
+STEXI
+@item -cheri-trace-filter @var{filter}
+@findex -cheri-trace-filter
+Only trace instructions executed with a matching ASID and at a PC inside one
+of the given address ranges (up to 8). Both are checked when code is
+translated, so code that is not traced runs without logging overhead. The
+filter can be changed at run time with the cheri-trace-filter monitor command.
 ETEXI
 
 DEF("cheri-c2e-on-unrepresentable", 0, QEMU_OPTION_cheri_c2e_on_unrepresentable, \
@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+# Print a binary CheriVis trace written by QEMU with "-d cvtrace" as text.
+# Both the raw and the cvtrace-compressed formats are supported.
+# QEMU only records the encoded instructions, disassembly happens here.
+import argparse
+import os
+import shutil
+import struct
+import subprocess
+import sys
+
+CVT_QEMU_VERSION = 0x80 + 3
+CVT_QEMU_MAGIC = b"CheriTraceV03"
+CVT_QEMU_MAGIC_COMPRESSED = b"CheriTraceZ03"
+
+# Chunks of the compressed format, see target/mips/cvtrace_compress.c
+CHUNK_HEADER = struct.Struct("<III")
+FRAME_MAGIC = 0x46545643
+INDEX_MAGIC = 0x49545643
+INDEX_FOOTER = b"CVTIDX01"
+INDEX_ENTRY = struct.Struct("<QQ")
+
+# struct cvtrace in target/mips/cpu.h (packed). pc and val1-val5 are stored
+# in target (big) endian, the instruction word in host endian.
+RECORD = struct.Struct("=BBHI6QBB")
+
+CVT_GPR = 1
+CVT_LD_GPR = 2
+CVT_ST_GPR = 3
+CVT_NO_REG = 4
+CVT_CAP = 11
+CVT_LD_CAP = 12
+CVT_ST_CAP = 13
+
+
+def bswap64(value: int) -> int:
+    return int.from_bytes(value.to_bytes(8, "little"), "big")
+
+
+class Disassembler:
+    def __init__(self, llvm_mc: str, triple: str):
+        self.llvm_mc = llvm_mc
+        self.triple = triple
+        self.cache = {}
+
+    def disassemble(self, inst: int) -> str:
+        if not self.llvm_mc:
+            return ""
+        if inst not in self.cache:
+            encoded = " ".join("0x%02x" % b for b in inst.to_bytes(4, "big"))
+            result = subprocess.run([self.llvm_mc, "--disassemble", "-triple=" + self.triple],
+                                    input=encoded.encode("utf-8"), stdout=subprocess.PIPE,
+                                    stderr=subprocess.DEVNULL)
+            lines = [l.strip() for l in result.stdout.decode("utf-8").splitlines()
+                     if l.strip() and not l.strip().startswith(".text")]
+            self.cache[inst] = lines[0].replace("\t", " ") if lines else "<unknown>"
+        return self.cache[inst]
+
+
+def read_raw_records(f, host_byteorder: str, start_record: int):
+    f.seek(RECORD.size * (start_record + 1))
+    while True:
+        data = f.read(RECORD.size)
+        if len(data) < RECORD.size:
+            break
+        version, exception, _cycles, inst, pc, val1, val2, val3, val4, val5, thread, asid = RECORD.unpack(data)
+        if host_byteorder != sys.byteorder:
+            inst = int.from_bytes(inst.to_bytes(4, sys.byteorder), host_byteorder)
+        pc, val1, val2, val3, val4, val5 = (bswap64(v) if sys.byteorder == "little" else v
+                                            for v in (pc, val1, val2, val3, val4, val5))
+        yield version, exception, inst, pc, (val1, val2, val3, val4, val5), thread, asid
+
+
+def read_varint(data: bytes, pos: int):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if byte < 0x80:
+            return value, pos
+
+
+def unzigzag(value: int) -> int:
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode_frame(data: bytes, count: int):
+    pos = 0
+    pc = 0
+    vals = [0] * 5
+    thread = asid = 0
+    for _ in range(count):
+        flags, version, exception = data[pos], data[pos + 1], data[pos + 2]
+        _cycles, pos = read_varint(data, pos + 3)
+        delta, pos = read_varint(data, pos)
+        pc = (pc + 4 + unzigzag(delta)) & 0xffffffffffffffff
+        inst = int.from_bytes(data[pos:pos + 4], "little")
+        pos += 4
+        record_vals = [0] * 5
+        for n in range(5):
+            if flags & (1 << n):
+                delta, pos = read_varint(data, pos)
+                vals[n] = (vals[n] + unzigzag(delta)) & 0xffffffffffffffff
+                record_vals[n] = vals[n]
+        if flags & (1 << 5):
+            thread, asid = data[pos], data[pos + 1]
+            pos += 2
+        yield version, exception, inst, pc, tuple(record_vals), thread, asid
+
+
+def find_frame(f, start_record: int):
+    """Return the file offset of the frame containing start_record and the
+    number of the first record in that frame."""
+    f.seek(0, os.SEEK_END)
+    end = f.tell()
+    if start_record and end >= RECORD.size + 8 + len(INDEX_FOOTER):
+        f.seek(end - 8 - len(INDEX_FOOTER))
+        footer = f.read(8 + len(INDEX_FOOTER))
+        if footer[8:] == INDEX_FOOTER:
+            f.seek(struct.unpack("<Q", footer[:8])[0])
+            magic, count, _size = CHUNK_HEADER.unpack(f.read(CHUNK_HEADER.size))
+            if magic == INDEX_MAGIC:
+                best = (RECORD.size, 0)
+                for _ in range(count):
+                    offset, first = INDEX_ENTRY.unpack(f.read(INDEX_ENTRY.size))
+                    if first > start_record:
+                        break
+                    best = (offset, first)
+                return best
+    # No (or no usable) index, walk the chunk headers instead
+    return RECORD.size, 0
+
+
+def read_compressed_records(f, start_record: int):
+    offset, record = find_frame(f, start_record)
+    f.seek(offset)
+    while True:
+        header = f.read(CHUNK_HEADER.size)
+        if len(header) < CHUNK_HEADER.size:
+            break
+        magic, count, size = CHUNK_HEADER.unpack(header)
+        if magic == INDEX_MAGIC:
+            f.seek(size, os.SEEK_CUR)
+            continue
+        if magic != FRAME_MAGIC:
+            sys.exit("Corrupt trace: bad chunk magic 0x%x at offset %d" % (magic, f.tell() - CHUNK_HEADER.size))
+        if record + count <= start_record:
+            f.seek(size, os.SEEK_CUR)
+            record += count
+            continue
+        for entry in decode_frame(f.read(size), count):
+            if record >= start_record:
+                yield entry
+            record += 1
+
+
+def dump(f, out, disassembler: Disassembler, host_byteorder: str, start_record: int):
+    header = f.read(RECORD.size)
+    if len(header) < RECORD.size or header[0] != CVT_QEMU_VERSION:
+        sys.exit("Not a cvtrace file")
+    if header[1:1 + len(CVT_QEMU_MAGIC_COMPRESSED)] == CVT_QEMU_MAGIC_COMPRESSED:
+        records = read_compressed_records(f, start_record)
+    elif header[1:1 + len(CVT_QEMU_MAGIC)] == CVT_QEMU_MAGIC:
+        records = read_raw_records(f, host_byteorder, start_record)
+    else:
+        sys.exit("Unknown cvtrace version")
+    for version, exception, inst, pc, (val1, val2, val3, val4, val5), thread, asid in records:
+        out.write("[%d:%d] 0x%016x: %08x  %s\n" % (thread, asid, pc, inst, disassembler.disassemble(inst)))
+        if exception != 31:
+            out.write("    Exception %d\n" % exception)
+        if version == CVT_GPR:
+            out.write("    Write GPR = 0x%016x\n" % val2)
+        elif version == CVT_LD_GPR:
+            out.write("    Memory Read [0x%016x] = 0x%016x\n" % (val1, val2))
+        elif version == CVT_ST_GPR:
+            out.write("    Memory Write [0x%016x] = 0x%016x\n" % (val1, val2))
+        elif version in (CVT_CAP, CVT_LD_CAP, CVT_ST_CAP):
+            prefix = {CVT_CAP: "    Write Cap", CVT_LD_CAP: "    Cap Memory Read [0x%016x]" % val1,
+                      CVT_ST_CAP: "    Cap Memory Write [0x%016x]" % val1}[version]
+            out.write("%s = perms:0x%016x cursor:0x%016x base:0x%016x length:0x%016x\n" %
+                      (prefix, val2, val3, val4, val5))
+
+
+def default_llvm_mc():
+    in_sdk = os.path.join(os.getenv("CHERI_SDK", "/"), "llvm-mc")
+    if os.path.isfile(in_sdk):
+        return in_sdk
+    return shutil.which("llvm-mc")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+    parser.add_argument("--llvm-mc", help="Path to llvm-mc used for disassembly", default=default_llvm_mc())
+    parser.add_argument("--triple", help="Target triple for disassembly", default="mips64-unknown-freebsd")
+    parser.add_argument("--host-byteorder", choices=("little", "big"), default=sys.byteorder,
+                        help="Byte order of the host that wrote the trace")
+    parser.add_argument("--start-record", type=int, default=0,
+                        help="Skip this many records (uses the frame index of compressed traces)")
+    parser.add_argument("TRACE", help="The binary trace file")
+    args = parser.parse_args()
+    with open(args.TRACE, "rb") as trace:
+        dump(trace, sys.stdout, Disassembler(args.llvm_mc, args.triple), args.host_byteorder,
+             args.start_record)
@@ -829,10 +829,6 @@ static bool fast_cc128_is_representable_new_addr(bool sealed, uint64_t base, cc1
     if (top == CC128_MAX_TOP && base == 0) {
         return true; // 1 << 65 is always representable
     }
-    if (length == 0) {
-        return true; // length 0 is always representable
-    }
-
     uint32_t e = cc128_get_exponent(length);
 
     int64_t b, r, Imid, Amid;
@@ -0,0 +1,124 @@
+#include "../cheri_compressed_cap.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Microbenchmark for the compressed capability operations that are on the
+// emulator fast paths. Reports nanoseconds per operation for decode, encode,
+// setbounds and the representability checks, separately for small (E = 0),
+// medium and large exponents since the cost of some of them depends on E.
+//
+// Usage: benchmark [iterations]
+
+#define NUM_INPUTS 4096
+
+struct bench_input {
+    cap_register_t cap;
+    uint64_t pesbt;
+    uint64_t new_addr;
+    uint64_t req_base;
+    cc128_length_t req_top;
+};
+
+struct exponent_range {
+    const char* name;
+    unsigned min_msb;
+    unsigned max_msb;
+};
+
+static const exponent_range ranges[] = {
+    {"small (E=0)", 1, CC128_MANTISSA_WIDTH - 2},
+    {"medium", CC128_MANTISSA_WIDTH - 1, 32},
+    {"large", 33, 63},
+};
+
+// Prevent the compiler from discarding the benchmarked computations.
+static volatile uint64_t sink;
+
+static std::vector<bench_input> make_inputs(const exponent_range& range, std::mt19937_64& rng) {
+    std::vector<bench_input> inputs(NUM_INPUTS);
+    for (bench_input& in : inputs) {
+        unsigned msb = range.min_msb + (unsigned)(rng() % (range.max_msb - range.min_msb + 1));
+        uint64_t length = (UINT64_C(1) << (msb - 1)) | (rng() & ((UINT64_C(1) << (msb - 1)) - 1));
+        uint64_t base = rng() % (UINT64_MAX - length);
+        memset(&in.cap, 0, sizeof(in.cap));
+        in.cap.cr_tag = true;
+        in.cap.cr_perms = CC128_PERMS_ALL;
+        in.cap.cr_uperms = CC128_UPERMS_ALL;
+        in.cap.cr_otype = CC128_OTYPE_UNSEALED;
+        in.cap.cr_ebt = CC128_RESET_EBT;
+        in.cap._cr_top = CC128_MAX_TOP;
+        in.cap._cr_cursor = base;
+        in.req_base = base;
+        in.req_top = (cc128_length_t)base + length;
+        cc128_setbounds(&in.cap, in.req_base, in.req_top);
+        in.pesbt = compress_128cap(&in.cap);
+        // Half of the new addresses are just out of bounds.
+        in.new_addr = (rng() & 1) ? (uint64_t)in.cap._cr_top + (rng() % length) : base + (rng() % length);
+        // setbounds needs a capability with the original bounds as input.
+        in.cap.cr_base = 0;
+        in.cap._cr_top = CC128_MAX_TOP;
+        in.cap.cr_ebt = CC128_RESET_EBT;
+    }
+    return inputs;
+}
+
+template <typename Fn> static double time_ns_per_op(const std::vector<bench_input>& inputs, uint64_t iterations, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink = sink + fn(inputs[i % NUM_INPUTS]);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (double)iterations;
+}
+
+int main(int argc, char** argv) {
+    uint64_t iterations = 10000000;
+    if (argc > 1)
+        iterations = strtoull(argv[1], nullptr, 0);
+    if (iterations == 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937_64 rng(0x1234567890abcdefull);
+    printf("%-12s %10s %10s %10s %10s %10s\n", "exponent", "decode", "encode", "setbounds", "rep-fast", "rep-slow");
+    for (const exponent_range& range : ranges) {
+        std::vector<bench_input> inputs = make_inputs(range, rng);
+        double decode = time_ns_per_op(inputs, iterations, [](const bench_input& in) {
+            cap_register_t result = {};
+            decompress_128cap(in.pesbt, in.new_addr, &result);
+            return result.cr_base ^ (uint64_t)result._cr_top;
+        });
+        double encode = time_ns_per_op(inputs, iterations, [](const bench_input& in) {
+            cap_register_t cap = {};
+            decompress_128cap(in.pesbt, in.new_addr, &cap);
+            return compress_128cap(&cap);
+        });
+        double setbounds = time_ns_per_op(inputs, iterations, [](const bench_input& in) {
+            cap_register_t cap = in.cap;
+            return (uint64_t)cc128_setbounds(&cap, in.req_base, in.req_top) ^ cap.cr_base;
+        });
+        double rep_fast = time_ns_per_op(inputs, iterations, [](const bench_input& in) {
+            cap_register_t cap = {};
+            decompress_128cap(in.pesbt, in.req_base, &cap);
+            return (uint64_t)fast_cc128_is_representable_new_addr(false, cap.cr_base, cap._cr_top - cap.cr_base,
+                                                                  cap._cr_cursor, in.new_addr);
+        });
+        double rep_slow = time_ns_per_op(inputs, iterations, [](const bench_input& in) {
+            cap_register_t cap = {};
+            decompress_128cap(in.pesbt, in.req_base, &cap);
+            return (uint64_t)cc128_is_representable_with_addr(&cap, in.new_addr);
+        });
+        printf("%-12s %10.2f %10.2f %10.2f %10.2f %10.2f\n", range.name, decode, encode, setbounds, rep_fast,
+               rep_slow);
+    }
+    printf("(ns per operation, %" PRIu64 " iterations; encode and the representability checks include a decode)\n",
+           iterations);
+    return 0;
+}
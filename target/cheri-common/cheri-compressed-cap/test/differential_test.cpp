@@ -0,0 +1,174 @@
+#include "../cheri_compressed_cap.h"
+#include <cinttypes>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#include "test_util.h"
+
+// Randomized differential tests: compare the optimized encode/decode,
+// setbounds and representability code against slow reference models that
+// only rely on the definition of the format (decode at the new address and
+// check that the bounds did not change, try each exponent in turn, etc.).
+
+#define NUM_ITERATIONS 50000
+
+static std::mt19937_64 rng(0x1234567890abcdefull);
+
+static uint64_t random_u64() { return rng(); }
+
+// Pick a length whose most significant bit is uniformly distributed so that
+// every exponent is covered instead of almost exclusively the largest one.
+static uint64_t random_length() {
+    unsigned msb = (unsigned)(random_u64() % 65);
+    if (msb == 0)
+        return 0;
+    uint64_t len = UINT64_C(1) << (msb - 1);
+    return len | (random_u64() & (len - 1));
+}
+
+// Random base so that base + length does not exceed 1 << 64. Some of the
+// bases are aligned to exercise the exact case.
+static uint64_t random_base(uint64_t length) {
+    uint64_t base = random_u64();
+    if (random_u64() & 1)
+        base &= ~((UINT64_C(1) << (random_u64() % 64)) - 1);
+    uint64_t max_base = UINT64_MAX - length;
+    return max_base == UINT64_MAX ? base : base % (max_base + 1);
+}
+
+/* Reference model: smallest representable region containing [base, top). */
+static void ref_setbounds(uint64_t base, cc128_length_t top, uint64_t* new_base, cc128_length_t* new_top) {
+    cc128_length_t length = top - base;
+    // Without an internal exponent the bottom 14 bits of base and top are
+    // stored directly and the length must fit in 12 bits.
+    if (length < (UINT64_C(1) << (CC128_MANTISSA_WIDTH - 2))) {
+        *new_base = base;
+        *new_top = top;
+        return;
+    }
+    // With internal exponent E the bottom three bits of B and T are implied
+    // zero, i.e. both bounds are aligned to 1 << (E + 3) and the length must
+    // be less than 1 << (E + MW - 1).
+    for (unsigned e = 0; e <= CC128_MAX_EXPONENT; e++) {
+        cc128_length_t align = (cc128_length_t)1 << (e + CC128_FIELD_EXPONENT_LOW_PART_SIZE);
+        cc128_length_t b = base & ~(align - 1);
+        cc128_length_t t = (top + align - 1) & ~(align - 1);
+        if (t - b < ((cc128_length_t)1 << (e + CC128_MANTISSA_WIDTH - 1))) {
+            *new_base = (uint64_t)b;
+            *new_top = t;
+            return;
+        }
+    }
+    FAIL("no exponent can represent the requested bounds");
+}
+
+/* Reference model: an address is representable iff decoding the capability
+ * with that address yields the same bounds. */
+static bool ref_is_representable(const cap_register_t& cap, uint64_t new_addr) {
+    uint64_t pesbt = compress_128cap(&cap);
+    cap_register_t decoded;
+    memset(&decoded, 0, sizeof(decoded));
+    decompress_128cap(pesbt, new_addr, &decoded);
+    return decoded.cr_base == cap.cr_base && decoded._cr_top == cap._cr_top;
+}
+
+static cap_register_t random_bounded_cap(uint64_t* req_base, cc128_length_t* req_top, bool* exact) {
+    uint64_t length = random_length();
+    uint64_t base = random_base(length);
+    cap_register_t cap = make_max_perms_cap(0, base, CC128_MAX_TOP);
+    *req_base = base;
+    *req_top = (cc128_length_t)base + length;
+    *exact = cc128_setbounds(&cap, *req_base, *req_top);
+    return cap;
+}
+
+TEST_CASE("setbounds matches the reference model", "[differential]") {
+    for (int i = 0; i < NUM_ITERATIONS; i++) {
+        uint64_t req_base;
+        cc128_length_t req_top;
+        bool exact;
+        cap_register_t cap = random_bounded_cap(&req_base, &req_top, &exact);
+        uint64_t ref_base;
+        cc128_length_t ref_top;
+        ref_setbounds(req_base, req_top, &ref_base, &ref_top);
+        CAPTURE(req_base, req_top, cap, ref_base, ref_top);
+        REQUIRE(cap.base() == ref_base);
+        REQUIRE(cap.top() == ref_top);
+        REQUIRE(exact == (ref_base == req_base && ref_top == req_top));
+        REQUIRE(cap.address() == req_base);
+        REQUIRE(cc128_is_representable_cap_exact(&cap));
+    }
+}
+
+TEST_CASE("decode round-trips for random bit patterns", "[differential]") {
+    for (int i = 0; i < NUM_ITERATIONS; i++) {
+        uint64_t pesbt = random_u64();
+        uint64_t cursor = random_u64();
+        cap_register_t cap;
+        memset(&cap, 0, sizeof(cap));
+        decompress_128cap(pesbt, cursor, &cap);
+        CAPTURE(pesbt, cursor, cap);
+        REQUIRE(cap.address() == cursor);
+        REQUIRE(compress_128cap(&cap) == pesbt);
+        REQUIRE((uint64_t)(cap.top() >> 64) <= 1);
+    }
+}
+
+TEST_CASE("decode is independent of the address within bounds", "[differential]") {
+    for (int i = 0; i < NUM_ITERATIONS; i++) {
+        uint64_t req_base;
+        cc128_length_t req_top;
+        bool exact;
+        cap_register_t cap = random_bounded_cap(&req_base, &req_top, &exact);
+        uint64_t pesbt = compress_128cap(&cap);
+        cc128_length_t length = cap.top() - cap.base();
+        uint64_t addr = length == 0 ? cap.base() : cap.base() + (uint64_t)(random_u64() % length);
+        cap_register_t decoded;
+        memset(&decoded, 0, sizeof(decoded));
+        decompress_128cap(pesbt, addr, &decoded);
+        CAPTURE(cap, addr, decoded);
+        REQUIRE(decoded.base() == cap.base());
+        REQUIRE(decoded.top() == cap.top());
+    }
+}
+
+// Addresses just outside the bounds are the interesting ones for the
+// representability checks, so pick a distance of random magnitude.
+static uint64_t random_new_addr(const cap_register_t& cap) {
+    uint64_t delta = random_u64() >> (random_u64() % 64);
+    switch (random_u64() % 4) {
+    case 0:
+        return cap.base() - delta;
+    case 1:
+        return (uint64_t)cap.top() + delta;
+    case 2:
+        return cap.address() + delta;
+    default:
+        return random_u64();
+    }
+}
+
+TEST_CASE("representability checks match the reference model", "[differential]") {
+    for (int i = 0; i < NUM_ITERATIONS; i++) {
+        uint64_t req_base;
+        cc128_length_t req_top;
+        bool exact;
+        cap_register_t cap = random_bounded_cap(&req_base, &req_top, &exact);
+        cc128_length_t length = cap.top() - cap.base();
+        for (int j = 0; j < 8; j++) {
+            uint64_t new_addr = random_new_addr(cap);
+            bool ref = ref_is_representable(cap, new_addr);
+            bool slow = cc128_is_representable_with_addr(&cap, new_addr);
+            bool fast = fast_cc128_is_representable_new_addr(false, cap.base(), length, cap.address(), new_addr);
+            CAPTURE(cap, new_addr, ref, slow, fast);
+            REQUIRE(slow == ref);
+            // The fast check is allowed to be conservative, but it must never
+            // accept an address that changes the bounds.
+            if (fast)
+                REQUIRE(ref);
+        }
+    }
+}
@@ -0,0 +1,138 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#pragma once
+#include "cheri_defs.h"
+
+#ifdef CHERI_128
+// Computing base and top of a compressed capability requires quite a few
+// shifts and corrections (see decompress_128cap_already_xored()). Programs
+// keep reloading the same capabilities (stack, globals, GOT entries), so we
+// memoize the decoded bounds in a small direct-mapped cache per vCPU.
+//
+// Base and top only depend on the pesbt bits and on the bits of the cursor
+// from E + MANTISSA_WIDTH - 3 upwards, so those form the key. The cache is a
+// pure function of its key and never needs to be invalidated.
+
+#define CHERI_DECODE_CACHE_BITS 8
+#define CHERI_DECODE_CACHE_SIZE (1 << CHERI_DECODE_CACHE_BITS)
+
+struct cheri_decode_cache_entry {
+    cc128_length_t top;
+    uint64_t base;
+    uint64_t pesbt; // in-memory format, i.e. xored with CC128_NULL_XOR_MASK
+    uint64_t cursor_hi;
+    bool valid;
+};
+
+struct cheri_decode_cache {
+    uint64_t hits;
+    uint64_t misses;
+    struct cheri_decode_cache_entry entries[CHERI_DECODE_CACHE_SIZE];
+};
+
+static inline uint32_t cheri_decode_cache_exponent(uint64_t xored_pesbt)
+{
+    uint32_t E = 0;
+    if (CC128_EXTRACT_FIELD(xored_pesbt, INTERNAL_EXPONENT)) {
+        E = (uint32_t)(CC128_EXTRACT_FIELD(xored_pesbt, EXPONENT_LOW_PART) |
+            (CC128_EXTRACT_FIELD(xored_pesbt, EXPONENT_HIGH_PART)
+             << CC128_FIELD_EXPONENT_LOW_PART_SIZE));
+    }
+    return MIN(CC128_MAX_EXPONENT, E);
+}
+
+/*
+ * The entry for @pesbt and @cursor (the inline CLC/CSC in
+ * target/mips/translate_cheri.c compute the same).
+ */
+static inline struct cheri_decode_cache_entry *
+cheri_decode_cache_entry(struct cheri_decode_cache *cache, uint64_t pesbt,
+                         uint64_t cursor, uint64_t *cursor_hi)
+{
+    uint64_t xored = pesbt ^ CC128_NULL_XOR_MASK;
+    uint32_t shift = cheri_decode_cache_exponent(xored) +
+                     CC128_MANTISSA_WIDTH - 3;
+    unsigned idx;
+
+    *cursor_hi = cursor >> shift;
+    idx = (unsigned)(((pesbt ^ *cursor_hi) * UINT64_C(0x9e3779b97f4a7c15))
+                     >> (64 - CHERI_DECODE_CACHE_BITS));
+    return &cache->entries[idx];
+}
+
+/*
+ * Like decompress_128cap(), but look up base and top in @cache first.
+ * The tag of @cdp is not modified.
+ */
+static inline void decompress_128cap_cached(struct cheri_decode_cache *cache,
+                                            uint64_t pesbt, uint64_t cursor,
+                                            cap_register_t *cdp)
+{
+    uint64_t xored = pesbt ^ CC128_NULL_XOR_MASK;
+    uint64_t cursor_hi;
+    struct cheri_decode_cache_entry *e =
+        cheri_decode_cache_entry(cache, pesbt, cursor, &cursor_hi);
+
+    if (likely(e->valid && e->pesbt == pesbt && e->cursor_hi == cursor_hi)) {
+        cache->hits++;
+        cdp->_cr_cursor = cursor;
+        cdp->cr_perms = (uint32_t)CC128_EXTRACT_FIELD(xored, HWPERMS);
+        cdp->cr_uperms = (uint32_t)CC128_EXTRACT_FIELD(xored, UPERMS);
+        cdp->cr_otype = (uint32_t)CC128_EXTRACT_FIELD(xored, OTYPE);
+        cdp->cr_flags = (uint8_t)CC128_EXTRACT_FIELD(xored, FLAGS);
+        cdp->cr_reserved = (uint8_t)CC128_EXTRACT_FIELD(xored, RESERVED);
+        cdp->cr_ebt = (uint32_t)CC128_EXTRACT_FIELD(xored, EBT);
+        cdp->cr_base = e->base;
+        cdp->_cr_top = e->top;
+        return;
+    }
+    cache->misses++;
+    decompress_128cap_already_xored(xored, cursor, cdp);
+    e->pesbt = pesbt;
+    e->cursor_hi = cursor_hi;
+    e->base = cdp->cr_base;
+    e->top = cdp->_cr_top;
+    e->valid = true;
+}
+
+/*
+ * Store the bounds of the already decoded @cap (with in-memory @pesbt) in
+ * @cache, e.g. if it came from a cache in front of this one.
+ */
+static inline void cheri_decode_cache_insert(struct cheri_decode_cache *cache,
+                                             uint64_t pesbt,
+                                             const cap_register_t *cap)
+{
+    uint64_t cursor_hi;
+    struct cheri_decode_cache_entry *e =
+        cheri_decode_cache_entry(cache, pesbt, cap->_cr_cursor, &cursor_hi);
+
+    e->pesbt = pesbt;
+    e->cursor_hi = cursor_hi;
+    e->base = cap->cr_base;
+    e->top = cap->_cr_top;
+    e->valid = true;
+}
+#endif /* CHERI_128 */
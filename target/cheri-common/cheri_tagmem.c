@@ -34,6 +34,18 @@
 #include "cheri_tagmem.h"
 #include "exec/exec-all.h"
 #include "exec/log.h"
+#include "qemu/atomic128.h"
+#include "qemu/bitmap.h"
+#include "qemu/bitops.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qemu/seqlock.h"
+#include "qemu/thread.h"
+#ifndef CONFIG_USER_ONLY
+#include "migration/qemu-file-types.h"
+#include "migration/register.h"
+#endif
 
 #if defined(TARGET_MIPS)
 #include "cheri_utils.h"
@@ -51,17 +63,48 @@
  * capability-sized word in physical memory.  This allows capabilities
  * to be safely loaded and stored in meory without loss of integrity.
  *
- * For emulation purposes the tag is an one-byte flag.  This makes it
- * easy to set or unset a tag without the need of locking or atomics.
- * This requires eight times the memory, however.  To reduce the amount
- * of memory needed the tag flag array is allocated sparsely, 4K at at
- * time, and on demand.
+ * The tags are stored as a bitmap with one bit per capability in a single
+ * anonymous mapping that covers all of RAM.  The host kernel zero-fills the
+ * pages of this mapping lazily when they are first written, so RAM that
+ * never holds a capability doesn't cost any tag memory and lookups don't
+ * need to check for unallocated tag blocks.  Tag bits are set and cleared
+ * with atomic operations since neighbouring tags share a host word.
+ *
+ * With MTTCG, other vCPUs must never see a tag set on data that was not
+ * written by the capability store that set it:
+ *
+ *  - Stores that set tags (capability stores, tag-preserving copies) hold
+ *    the lock of the tag "stripe" of their page and make its sequence count
+ *    odd while they update data and tags. Capability loads read the data
+ *    and then the tag, and retry if the sequence count changed in between
+ *    (see cheri_tag_load_host(); CLC generated inline by TCG takes the slow
+ *    path instead of retrying).
+ *  - Integer stores clear the tags they overwrite before the data changes,
+ *    so a capability load that sees any of their data also sees the tag
+ *    cleared. Since that alone doesn't stop a concurrent capability store
+ *    from setting the tag again before the data is written, they also
+ *    publish the granule they are writing in env_tlb(env)->c, and tag
+ *    setters wait until no other vCPU is writing their granule (see
+ *    cheri_tag_store_begin() and cheri_tag_write_lock()).
+ *
+ * None of this is needed unless parallel_cpus is set; in particular code
+ * running under cpu_exec_step_atomic() sees the tags unlocked.
+ *
+ * Most integer stores are to memory that never held a capability, so MTTCG
+ * code does them inline without looking at the tags. The first tag set in
+ * a page marks it in cheri_tagged_pages (while the other vCPUs are stopped,
+ * so none of them is in the middle of an inline store to it), after which
+ * the write TLB entries of the page carry TLB_CHERI_TAGGED. This sends the
+ * stores to store_helper(), which brackets them with cheri_tag_store_begin()
+ * and cheri_tag_store_end(). Pages stay marked once they had a tag.
  *
- * XXX Should consider adding a reference count per tag block so that
- * blocks can be deallocated when no longer used maybe.
+ * If the host has 16-byte atomics, the data of 128-bit capabilities is also
+ * always read and written with a single access. A compare-and-swap that
+ * keeps the tag set (e.g. CSCC replacing one capability with another) then
+ * doesn't need the stripe lock: it only publishes its granule like an
+ * integer store and does a host cmpxchg of the data, since other vCPUs can
+ * no longer see a torn capability with the tag set.
  */
-#include "cheri_tagmem.h"
-
 
 #if defined(CHERI_MAGIC128) || defined(CHERI_128)
 #define CAP_TAG_SHFT        4           // 5 for 256-bit caps, 4 for 128-bit
@@ -70,47 +113,109 @@
 #endif /* !(CHERI_MAGIC128 || CHERI_128) */
 #define CAP_SIZE            (1 << CAP_TAG_SHFT)
 #define CAP_MASK            ((1 << CAP_TAG_SHFT) - 1)
-#define CAP_TAGBLK_SHFT     12          // 2^12 or 4096 tags per block
-#define CAP_TAGBLK_MSK      ((1 << CAP_TAGBLK_SHFT) - 1)
-#ifdef CHERI_MAGIC128
-         /*
-          * With "magic 128-bit" capabilities the object type,
-          * permissions, sealed bit, and length are all stored in tag
-          * memory along with the tag. This makes the tag memory as
-          * large as main memory. Fortunately, for this implementation
-          * tags are not needed everywhere and sparsely allocated.
-          */
-#define CAP_TAGBLK_SZ       ((1 << CAP_TAGBLK_SHFT) * 16)
-#define CAP_TAGBLK_IDX(tag_idx) (((tag_idx) & CAP_TAGBLK_MSK) * 16)
-#if defined(HOST_WORDS_BIGENDIAN)
-#   define CAP_TAG_TPS_SHFT 0
+
+static unsigned long *_cheri_tagmem = NULL;
+static uint64_t cheri_ntags = 0ul;
+static unsigned long *cheri_tagged_pages = NULL;
+
+#define CHERI_TAG_STRIPES   64
+
+typedef struct CheriTagStripe {
+    QemuSpin lock;
+    QemuSeqLock sequence;
+} QEMU_ALIGNED(64) CheriTagStripe;
+
+static CheriTagStripe cheri_tag_stripes[CHERI_TAG_STRIPES];
+
+#define CHERI_TAG_NO_HAZARD UINTPTR_MAX
+
+#if CAP_SIZE == 16 && HAVE_CMPXCHG128 && HAVE_ATOMIC128 && \
+    !defined(CHERI_MAGIC128)
+#define CHERI_CAP_ATOMIC 1
 #else
-#   define CAP_TAG_TPS_SHFT 8
+#define CHERI_CAP_ATOMIC 0
 #endif
-#else /* ! CHERI_MAGIC128 */
-#define CAP_TAGBLK_SZ       (1 << CAP_TAGBLK_SHFT)
-#define CAP_TAGBLK_IDX(tag_idx) ((tag_idx) & CAP_TAGBLK_MSK)
-#endif /* ! CHERI_MAGIC128 */
 
-uint8_t **_cheri_tagmem = NULL;
-uint64_t cheri_ntagblks = 0ul;
+#ifdef CHERI_MAGIC128
+/*
+ * With "magic 128-bit" capabilities the object type, permissions, sealed
+ * bit, and length are stored in tag memory along with the tag.  This makes
+ * the tag memory as large as main memory.  Fortunately it is also populated
+ * lazily by the host, so only pages that hold capabilities are allocated.
+ */
+typedef struct {
+    uint64_t tps;
+    uint64_t length;
+} cheri_tag_m128_t;
+
+static cheri_tag_m128_t *_cheri_tagmem_m128 = NULL;
+#endif /* CHERI_MAGIC128 */
+
+#ifndef CONFIG_USER_ONLY
+static void cheri_tag_migration_init(void);
+#endif
 
-static inline uint8_t* get_cheri_tagmem(size_t index) {
-    assert(index < cheri_ntagblks && "Tag index out of bounds");
-    return _cheri_tagmem[index];
+static void *cheri_tag_alloc(uint64_t size)
+{
+    void *mem = qemu_anon_ram_alloc(size, NULL, false);
+    if (mem == NULL) {
+        error_report("%s: Can't allocate %" PRIu64 " bytes of tag memory",
+                     __func__, size);
+        exit(1);
+    }
+    return mem;
 }
 
 void cheri_tag_init(uint64_t memory_size)
 {
-    // printf("%s: memory_size=0x%lx\n", __func__, memory_size);
     if (_cheri_tagmem != NULL)
         return;
 
-    cheri_ntagblks = (memory_size >> CAP_TAG_SHFT) >> CAP_TAGBLK_SHFT;
-    _cheri_tagmem = (uint8_t **)g_malloc0(cheri_ntagblks * sizeof(uint8_t *));
-    if (_cheri_tagmem == NULL) {
-        error_report("%s: Can't allocated tag memory", __func__);
-        exit (-1);
+    for (int i = 0; i < CHERI_TAG_STRIPES; i++) {
+        qemu_spin_init(&cheri_tag_stripes[i].lock);
+        seqlock_init(&cheri_tag_stripes[i].sequence);
+    }
+    cheri_ntags = memory_size >> CAP_TAG_SHFT;
+    /* Round up to whole 64-bit groups of tags for migration. */
+    _cheri_tagmem = cheri_tag_alloc(BITS_TO_LONGS(ROUND_UP(cheri_ntags, 64)) *
+                                    sizeof(unsigned long));
+    cheri_tagged_pages = cheri_tag_alloc(
+        BITS_TO_LONGS(DIV_ROUND_UP(memory_size, TARGET_PAGE_SIZE)) *
+        sizeof(unsigned long));
+#ifdef CHERI_MAGIC128
+    _cheri_tagmem_m128 = cheri_tag_alloc(cheri_ntags *
+                                         sizeof(cheri_tag_m128_t));
+#endif
+#ifndef CONFIG_USER_ONLY
+    cheri_tag_migration_init();
+#endif
+}
+
+void *cheri_tagmem_for_addr(ram_addr_t ram_addr)
+{
+    uint64_t tag = ram_addr >> CAP_TAG_SHFT;
+
+    if (tag >= cheri_ntags)
+        return NULL;
+    /* ram_addr is page aligned so the first tag starts a host word. */
+    cheri_debug_assert(BIT_WORD(tag) * BITS_PER_LONG == tag);
+    return &_cheri_tagmem[BIT_WORD(tag)];
+}
+
+/* Whether the RAM page at ram_addr may hold tags (see TLB_CHERI_TAGGED) */
+bool cheri_tag_page_maybe_tagged(ram_addr_t ram_addr)
+{
+    return (ram_addr >> CAP_TAG_SHFT) < cheri_ntags &&
+        test_bit(ram_addr >> TARGET_PAGE_BITS, cheri_tagged_pages);
+}
+
+static void cheri_tag_set_page_tagged(ram_addr_t ram_addr)
+{
+    CPUState *cpu;
+
+    set_bit_atomic(ram_addr >> TARGET_PAGE_BITS, cheri_tagged_pages);
+    CPU_FOREACH(cpu) {
+        tlb_set_cheri_tagged(cpu, ram_addr & TARGET_PAGE_MASK);
     }
 }
 
@@ -122,7 +227,18 @@ static inline hwaddr v2p_addr(CPUArchState *env, target_ulong vaddr, int rw,
 #ifdef TARGET_MIPS
     paddr = cpu_mips_translate_address_c2(env, vaddr, rw, reg, prot);
 #else
-#pragma message("TODO: implement v2p_addr check")
+    /*
+     * Targets without capability TLB bits of their own resolve the address
+     * through the soft TLB. Any MMU fault is raised by the TLB fill, so the
+     * physical address is always valid here.
+     */
+    bool is_store = rw == MMU_DATA_STORE || rw == MMU_DATA_CAP_STORE;
+    CPUIOTLBEntry *iotlbentry =
+        probe_access_iotlb(env, vaddr, 1,
+                           is_store ? MMU_DATA_STORE : MMU_DATA_LOAD,
+                           cpu_mmu_index(env, false), pc, NULL);
+    *prot = iotlbentry->cheri_prot;
+    paddr = iotlbentry->paddr_page | (vaddr & ~TARGET_PAGE_MASK);
 #endif
 
     if (paddr == -1LL) {
@@ -133,46 +249,295 @@ static inline hwaddr v2p_addr(CPUArchState *env, target_ulong vaddr, int rw,
 }
 
 static inline void check_tagmem_writable(CPUArchState *env, target_ulong vaddr,
-                                         hwaddr paddr, ram_addr_t ram_addr, MemoryRegion *mr, uintptr_t pc)
+                                         ram_addr_t ram_addr, bool readonly,
+                                         uintptr_t pc)
 {
-    if (memory_region_is_rom(mr) || memory_region_is_romd(mr)) {
+    if (readonly) {
         error_report("QEMU ERROR: attempting change tag bit on read-only memory:");
-        error_report("%s: vaddr=0x%jx -> ram_addr=0x%jx (paddr=0x%jx)", __func__,
-            (uintmax_t)vaddr, (uintmax_t)ram_addr, (uintmax_t)paddr);
-#ifdef TARGET_MIPS
+        error_report("%s: vaddr=0x%jx -> ram_addr=0x%jx", __func__,
+            (uintmax_t)vaddr, (uintmax_t)ram_addr);
+#if defined(TARGET_MIPS)
         do_raise_c0_exception_impl(env, EXCP_DBE, 0, pc);
+#elif defined(TARGET_RISCV)
+        env->badaddr = vaddr;
+        riscv_raise_exception(env, RISCV_EXCP_STORE_AMO_ACCESS_FAULT, pc);
 #else
-#pragma message("TODO: implement ROM check")
+#error "check_tagmem_writable() is not implemented for this target"
+#endif
+    }
+}
+
+/* Index of the tag for vaddr relative to the first tag of its page. */
+static inline long tag_nr_in_page(target_ulong vaddr)
+{
+    return (vaddr & ~TARGET_PAGE_MASK) >> CAP_TAG_SHFT;
+}
+
+static inline CheriTagStripe *cheri_tag_stripe(ram_addr_t ram_addr)
+{
+    return &cheri_tag_stripes[(ram_addr >> TARGET_PAGE_BITS) %
+                              CHERI_TAG_STRIPES];
+}
+
+/*
+ * The sequence count that capability loads generated inline by TCG use like
+ * cheri_tag_load_host() to read the RAM page at ram_addr. Returns NULL if
+ * reading the data with two 64-bit loads isn't safe, i.e. if a CSCC can
+ * swap the data of a tagged capability without taking the stripe lock.
+ */
+unsigned *cheri_tag_seq_for_addr(ram_addr_t ram_addr)
+{
+    if (CHERI_CAP_ATOMIC)
+        return NULL;
+    return &cheri_tag_stripe(ram_addr)->sequence.sequence;
+}
+
+/*
+ * Accesses that can't keep data and tag consistent for other vCPUs (the
+ * slow paths through cpu_ld*()/cpu_st*()) are rare enough to simply be
+ * executed while all other vCPUs are stopped.
+ */
+static inline void cheri_tag_require_exclusive(CPUArchState *env,
+                                               uintptr_t pc)
+{
+    if (parallel_cpus) {
+        cpu_loop_exit_atomic(env_cpu(env), pc);
+    }
+}
+
+/*
+ * Call before setting a tag in the RAM page at @ram_addr: the first one
+ * restarts the instruction while the other vCPUs are stopped to make their
+ * stores to the page clear tags from then on. Must not be called with a
+ * stripe lock held.
+ */
+static inline void cheri_tag_mark_page(CPUArchState *env, ram_addr_t ram_addr,
+                                       uintptr_t pc)
+{
+    if (likely(test_bit(ram_addr >> TARGET_PAGE_BITS, cheri_tagged_pages)) ||
+        !qemu_tcg_mttcg_enabled())
+        return;
+    cheri_tag_require_exclusive(env, pc);
+    cheri_tag_set_page_tagged(ram_addr);
+}
+
+/*
+ * Prepare to write the data and tags of [ram_addr, ram_addr + len), which
+ * must not cross a page: lock out other writers and concurrent capability
+ * loads of the page, and wait until no other vCPU is in the middle of an
+ * integer store to the range. Returns the stripe to pass to
+ * cheri_tag_write_unlock() (NULL without MTTCG).
+ */
+static CheriTagStripe *cheri_tag_write_lock(CPUArchState *env,
+                                            ram_addr_t ram_addr,
+                                            ram_addr_t len)
+{
+    CheriTagStripe *stripe;
+    uintptr_t start = ram_addr & ~CAP_MASK;
+    uintptr_t end = ram_addr + len;
+    CPUState *cpu;
+
+    if (!parallel_cpus)
+        return NULL;
+
+    stripe = cheri_tag_stripe(ram_addr);
+    qemu_spin_lock(&stripe->lock);
+    seqlock_write_begin(&stripe->sequence);
+    /* Pairs with the barrier in cheri_tag_store_begin(). */
+    smp_mb();
+    CPU_FOREACH(cpu) {
+        CPUTLBCommon *c = &env_tlb((CPUArchState *)cpu->env_ptr)->c;
+        uintptr_t hazard;
+
+        if (cpu == env_cpu(env))
+            continue;
+        /* A hazard covers two granules for unaligned stores. */
+        while ((hazard = atomic_load_acquire(&c->cheri_tag_hazard)) !=
+                   CHERI_TAG_NO_HAZARD &&
+               hazard < end && hazard + 2 * CAP_SIZE > start) {
+            cpu_relax();
+        }
+    }
+    return stripe;
+}
+
+static void cheri_tag_write_unlock(CheriTagStripe *stripe)
+{
+    if (stripe) {
+        seqlock_write_end(&stripe->sequence);
+        qemu_spin_unlock(&stripe->lock);
+    }
+}
+
+/*
+ * Publish that this vCPU is about to write the granule at @ram_addr without
+ * holding the stripe lock, waiting for any tag writer of the stripe to
+ * finish first. Withdrawn by cheri_tag_store_end().
+ */
+static void cheri_tag_publish_hazard(CPUArchState *env,
+                                     CheriTagStripe *stripe,
+                                     ram_addr_t ram_addr)
+{
+    CPUTLBCommon *c = &env_tlb(env)->c;
+
+    for (;;) {
+        atomic_set(&c->cheri_tag_hazard, ram_addr & ~CAP_MASK);
+        /* Pairs with the barrier in cheri_tag_write_lock(). */
+        smp_mb();
+        if (!(atomic_read(&stripe->sequence.sequence) & 1))
+            return;
+        /* Let the tag writer finish, it might be waiting for us. */
+        atomic_set(&c->cheri_tag_hazard, CHERI_TAG_NO_HAZARD);
+        while (atomic_read(&stripe->sequence.sequence) & 1) {
+            cpu_relax();
+        }
+    }
+}
+
+/*
+ * Read, write and compare-and-swap the CAP_SIZE bytes of a capability in
+ * host memory, with single host atomics where possible (CHERI_CAP_ATOMIC).
+ * Otherwise these are only atomic with respect to each other when done
+ * under the stripe lock, or while the other vCPUs are stopped.
+ */
+static inline void cheri_cap_data_read(const void *host, void *data)
+{
+#if CHERI_CAP_ATOMIC
+    if (parallel_cpus) {
+        Int128 val = atomic16_read((Int128 *)host);
+        memcpy(data, &val, CAP_SIZE);
+        return;
+    }
 #endif
+    memcpy(data, host, CAP_SIZE);
+}
+
+static inline void cheri_cap_data_write(void *host, const void *data)
+{
+#if CHERI_CAP_ATOMIC
+    if (parallel_cpus) {
+        Int128 val;
+        memcpy(&val, data, CAP_SIZE);
+        atomic16_set((Int128 *)host, val);
+        return;
     }
+#endif
+    memcpy(host, data, CAP_SIZE);
 }
 
-static inline ram_addr_t p2r_addr(CPUArchState *env, hwaddr addr, MemoryRegion** mrp)
+static inline bool cheri_cap_data_cmpxchg(void *host, const void *expected,
+                                          const void *data)
 {
-    hwaddr l;
-    MemoryRegion *mr;
-    CPUState *cs = env_cpu(env);
+#if CHERI_CAP_ATOMIC
+    if (parallel_cpus) {
+        Int128 cmp, val;
+        memcpy(&cmp, expected, CAP_SIZE);
+        memcpy(&val, data, CAP_SIZE);
+        return int128_eq(atomic16_cmpxchg((Int128 *)host, cmp, val), cmp);
+    }
+#endif
+    if (memcmp(host, expected, CAP_SIZE) != 0)
+        return false;
+    memcpy(host, data, CAP_SIZE);
+    return true;
+}
 
-    mr = address_space_translate(cs->as, addr, &addr, &l, false, MEMTXATTRS_UNSPECIFIED);
-    if (mrp)
-        *mrp = mr;
+/*
+ * Find the tags of the page containing vaddr.
+ *
+ * The tag memory is resolved through the softmmu TLB: the CPUIOTLBEntry
+ * for the page caches a pointer to the page's tags (see
+ * tlb_set_page_with_attrs()). The entry is normally present already since
+ * the data access to the same address has just been performed, so this is
+ * a single TLB lookup instead of a walk of the target MMU followed by
+ * address_space_translate().
+ *
+ * Returns the tag bitmap of the page (index it with tag_nr_in_page()), or
+ * NULL if the page has no tags. *ret_ram_addr is set to -1 if the page is
+ * not backed by RAM. If host is not NULL, it is set to the host address of
+ * vaddr (see probe_access_iotlb()).
+ */
+static unsigned long *cheri_tag_lookup(CPUArchState *env, target_ulong vaddr,
+                                       int size, MMUAccessType at, int reg,
+                                       uintptr_t pc, ram_addr_t *ret_ram_addr,
+                                       int *prot, void **host)
+{
+    bool is_store = at == MMU_DATA_STORE || at == MMU_DATA_CAP_STORE;
+    int mmu_idx = cpu_mmu_index(env, false);
+    CPUIOTLBEntry *iotlbentry;
+
+    iotlbentry = probe_access_iotlb(env, vaddr, size,
+                                    is_store ? MMU_DATA_STORE : MMU_DATA_LOAD,
+                                    mmu_idx, pc, host);
+    if (prot)
+        *prot = iotlbentry->cheri_prot;
+
+#ifdef TARGET_MIPS
+    if (unlikely(at == MMU_DATA_CAP_STORE &&
+                 (iotlbentry->cheri_prot & PAGE_SC_TRAP))) {
+        /*
+         * The soft TLB can't express the store-capability inhibit, so let
+         * the MIPS TLB model raise the exception (with the right register
+         * number in CapCause).
+         */
+        int sc_prot;
+        (void)v2p_addr(env, vaddr, MMU_DATA_CAP_STORE, reg, pc, &sc_prot);
+    }
+#endif
 
-    if (!(memory_region_is_ram(mr) || memory_region_is_romd(mr))) {
-        return -1LL;
+    if (iotlbentry->tag_ram_addr == RAM_ADDR_INVALID) {
+        *ret_ram_addr = -1LL;
+        return NULL;
     }
-    return (memory_region_get_ram_addr(mr) & TARGET_PAGE_MASK) + addr;
+    *ret_ram_addr = iotlbentry->tag_ram_addr + (vaddr & ~TARGET_PAGE_MASK);
+    if (is_store)
+        check_tagmem_writable(env, vaddr, *ret_ram_addr,
+                              iotlbentry->tagmem_readonly, pc);
+    return iotlbentry->tagmem;
 }
 
-static inline ram_addr_t v2r_addr(CPUArchState *env, target_ulong vaddr, MMUAccessType rw,
-        int reg, uintptr_t pc)
+static inline void cheri_tag_reset_linkedflag(CPUArchState *env,
+                                              ram_addr_t ram_addr,
+                                              ram_addr_t len)
 {
-    int prot;
-    MemoryRegion* mr = NULL;
-    hwaddr paddr = v2p_addr(env, vaddr, rw, reg, pc, &prot);
-    ram_addr_t ram_addr = p2r_addr(env, paddr, &mr);
-    if (rw == MMU_DATA_CAP_STORE || rw == MMU_DATA_STORE)
-        check_tagmem_writable(env, vaddr, paddr, ram_addr, mr, pc);
-    return ram_addr;
+#ifdef TARGET_MIPS
+    /*
+     * Check if a write of @len bytes at @ram_addr touches the granule of the
+     * linked address and the linkedflag needs to be reset. This only notices
+     * our own stores, so store-conditionals also compare the memory against
+     * the value loaded by the load-linked (which catches stores from other
+     * vCPUs); this just makes them fail early.
+     */
+    if (env && QEMU_ALIGN_DOWN(ram_addr, CHERI_CAP_SIZE) <=
+        QEMU_ALIGN_DOWN(env->CP0_LLAddr, CHERI_CAP_SIZE) &&
+        ram_addr + len > QEMU_ALIGN_DOWN(env->CP0_LLAddr, CHERI_CAP_SIZE)) {
+        env->linkedflag = 0;
+        env->lladdr = 1;
+    }
+#endif
+}
+
+/*
+ * Clear the tags of the granules overlapping [vaddr, vaddr + size), all of
+ * which are in the page whose tags are @tags. Tags that are already clear
+ * are only read, so that stores to memory without capabilities don't keep
+ * bouncing the cache lines of the tag bitmap between host CPUs.
+ */
+static void cheri_tag_clear_granules(unsigned long *tags, target_ulong vaddr,
+                                     int32_t size, ram_addr_t ram_addr)
+{
+    long first = tag_nr_in_page(vaddr);
+    long last = tag_nr_in_page(vaddr + size - 1);
+
+    for (long nr = first; nr <= last; nr++) {
+        if (unlikely(qemu_loglevel_mask(CPU_LOG_INSTR))) {
+            qemu_log("    Cap Tag Write [" RAM_ADDR_FMT "] %d -> 0\n",
+                     (ram_addr & ~CAP_MASK) + (nr - first) * CAP_SIZE,
+                     test_bit(nr, tags));
+        }
+        if (test_bit(nr, tags))
+            clear_bit_atomic(nr, tags);
+    }
 }
 
 void cheri_tag_invalidate(CPUArchState *env, target_ulong vaddr, int32_t size, uintptr_t pc)
@@ -217,162 +582,437 @@ void cheri_tag_invalidate(CPUArchState *env, target_ulong vaddr, int32_t size, u
      * (MMU_DATA_STORE) rather than a capability store (MMU_DATA_CAP_STORE),
      * so that we don't require that the SC inhibit be clear.
      */
+    ram_addr_t ram_addr;
+    unsigned long *tags = cheri_tag_lookup(env, vaddr, size, MMU_DATA_STORE,
+                                           0xFF, pc, &ram_addr, NULL, NULL);
+    if (ram_addr == -1LL)
+        return;
+
+    if (tags != NULL)
+        cheri_tag_clear_granules(tags, vaddr, size, ram_addr);
+    cheri_tag_reset_linkedflag(env, ram_addr, size);
+}
+
+/*
+ * Start an integer store of @size bytes to @vaddr: clear the tags that it
+ * overwrites. With MTTCG this must be followed by cheri_tag_store_end()
+ * once the data has been written (no capability can be stored to the
+ * granule until then), and the store may not take a fault in between (a
+ * longjmp out of the store calls cheri_tag_store_end() from cpu_exec()).
+ */
+void cheri_tag_store_begin(CPUArchState *env, target_ulong vaddr,
+                           int32_t size, uintptr_t pc)
+{
+    ram_addr_t ram_addr;
+    unsigned long *tags;
 
-    int prot;
-    MemoryRegion* mr = NULL;
-    hwaddr paddr = v2p_addr(env, vaddr, MMU_DATA_STORE, 0xFF, pc, &prot);
-    ram_addr_t ram_addr = p2r_addr(env, paddr, &mr);
-    // Generate a trap if we try to clear tags in ROM instead of crashing
-    check_tagmem_writable(env, vaddr, paddr, ram_addr, mr, pc);
+    if (!parallel_cpus) {
+        cheri_tag_invalidate(env, vaddr, size, pc);
+        return;
+    }
+    if ((vaddr & TARGET_PAGE_MASK) != ((vaddr + size - 1) & TARGET_PAGE_MASK))
+        cpu_loop_exit_atomic(env_cpu(env), pc);
+
+    tags = cheri_tag_lookup(env, vaddr, size, MMU_DATA_STORE, 0xFF, pc,
+                            &ram_addr, NULL, NULL);
     if (ram_addr == -1LL)
         return;
-    cheri_tag_phys_invalidate(env, ram_addr, size);
 
+    if (tags != NULL) {
+        cheri_tag_publish_hazard(env, cheri_tag_stripe(ram_addr), ram_addr);
+        cheri_tag_clear_granules(tags, vaddr, size, ram_addr);
+    }
+    cheri_tag_reset_linkedflag(env, ram_addr, size);
 }
 
-void cheri_tag_phys_invalidate(CPUArchState *env, ram_addr_t ram_addr, ram_addr_t len)
+void cheri_tag_store_end(CPUArchState *env)
 {
-    uint64_t tag, addr, endaddr, tagmem_idx;
-    uint8_t *tagblk;
+    atomic_store_release(&env_tlb(env)->c.cheri_tag_hazard,
+                         CHERI_TAG_NO_HAZARD);
+}
 
-    endaddr = (uint64_t)(ram_addr + len);
+/*
+ * Clear the tags [first, end) of the bitmap a host word at a time and return
+ * the number of tags that were set. Words without any tags set are only read
+ * so that clearing never populates pages of the lazily allocated tag memory.
+ */
+static uint64_t cheri_tag_clear_range(unsigned long *tags, uint64_t first,
+                                      uint64_t end)
+{
+    uint64_t cleared = 0;
 
-    for(addr = (uint64_t)(ram_addr & ~CAP_MASK); addr < endaddr;
-            addr += CAP_SIZE) {
-        tag = addr >> CAP_TAG_SHFT;
-        tagmem_idx = tag >> CAP_TAGBLK_SHFT;
-        if (tagmem_idx > cheri_ntagblks)
-            return;
-        tagblk = get_cheri_tagmem(tagmem_idx);
+    while (first < end) {
+        unsigned long *p = &tags[BIT_WORD(first)];
+        unsigned long mask = BITMAP_FIRST_WORD_MASK(first);
 
-        if (tagblk != NULL) {
-            if (unlikely(qemu_loglevel_mask(CPU_LOG_INSTR))) {
-                qemu_log("    Cap Tag Write [%" HWADDR_PRIx "] %d -> 0\n", addr,
-                         tagblk[CAP_TAGBLK_IDX(tag)]);
+        if (BIT_WORD(first) == BIT_WORD(end - 1)) {
+            mask &= BITMAP_LAST_WORD_MASK(end);
+        }
+        if (atomic_read(p) & mask) {
+            if (mask == ~0UL) {
+                cleared += ctpopl(atomic_xchg(p, 0));
+            } else {
+                cleared += ctpopl(atomic_fetch_and(p, ~mask) & mask);
             }
-            tagblk[CAP_TAGBLK_IDX(tag)] = 0;
         }
+        first = (BIT_WORD(first) + 1) * BITS_PER_LONG;
     }
-#ifdef TARGET_MIPS
-    /* If a tag was cleared, unset the linkedflag and reset lladdr: */
-    /* Check RAM address to see if the linkedflag needs to be reset. */
-    if (env && QEMU_ALIGN_DOWN(ram_addr, CHERI_CAP_SIZE) ==
-        QEMU_ALIGN_DOWN(env->CP0_LLAddr, CHERI_CAP_SIZE)) {
-        env->linkedflag = 0;
-        env->lladdr = 1;
+    return cleared;
+}
+
+void cheri_tag_phys_invalidate(CPUArchState *env, ram_addr_t ram_addr, ram_addr_t len)
+{
+    uint64_t first = ram_addr >> CAP_TAG_SHFT;
+    uint64_t end = MIN(DIV_ROUND_UP(ram_addr + len, CAP_SIZE), cheri_ntags);
+    uint64_t cleared;
+
+    if (first >= end)
+        return;
+
+    cleared = cheri_tag_clear_range(_cheri_tagmem, first, end);
+    if (unlikely(qemu_loglevel_mask(CPU_LOG_INSTR)) && cleared) {
+        qemu_log("    Cap Tag Write [" RAM_ADDR_FMT "-" RAM_ADDR_FMT "] %"
+                 PRIu64 " tags -> 0\n", (ram_addr_t)(first << CAP_TAG_SHFT),
+                 (ram_addr_t)(end << CAP_TAG_SHFT), cleared);
     }
+    /* If a tag was cleared, unset the linkedflag and reset lladdr: */
+    cheri_tag_reset_linkedflag(env, ram_addr, len);
+}
+
+/*
+ * Bracket a write of @len bytes directly to the host memory of the RAM at
+ * @ram_addr, which must not cross a page (e.g. a chunk of the MIPS magic
+ * memset): clear the tags before the data changes and keep other vCPUs
+ * from storing capabilities to the range until cheri_tag_phys_store_end().
+ */
+void cheri_tag_phys_store_begin(CPUArchState *env, ram_addr_t ram_addr,
+                                ram_addr_t len)
+{
+    cheri_tag_write_lock(env, ram_addr, len);
+    cheri_tag_phys_invalidate(env, ram_addr, len);
+}
+
+void cheri_tag_phys_store_end(CPUArchState *env, ram_addr_t ram_addr)
+{
+    if (parallel_cpus)
+        cheri_tag_write_unlock(cheri_tag_stripe(ram_addr));
+}
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * Migration of tag memory
+ *
+ * The tags are saved together with the device state once the guest has
+ * stopped (they are 1/128th of RAM at most). Only blocks of the bitmap that
+ * have a tag set are sent, so the lazily allocated tag memory stays sparse
+ * on both sides. The stream consists of records starting with a flags word:
+ *
+ *   CHERI_TAGS_SAVE_FLAG_TAGS: first group, number of groups, then one
+ *       64-bit word of tags per group (tag 0 of the group in bit 0).
+ *   CHERI_TAGS_SAVE_FLAG_EOS: end of stream.
+ *
+ * With magic 128-bit capabilities the metadata of each tagged capability
+ * follows its group; metadata of untagged memory is not preserved.
+ */
+#define CHERI_TAGS_SAVE_FLAG_EOS    0
+#define CHERI_TAGS_SAVE_FLAG_TAGS   1
+#define CHERI_TAGS_BLOCK_GROUPS     512
+
+static inline uint64_t cheri_tag_group_read(uint64_t group)
+{
+#if HOST_LONG_BITS == 64
+    return atomic_read(&_cheri_tagmem[group]);
+#else
+    return atomic_read(&_cheri_tagmem[2 * group]) |
+           ((uint64_t)atomic_read(&_cheri_tagmem[2 * group + 1]) << 32);
 #endif
 }
 
-static uint8_t *cheri_tag_new_tagblk(uint64_t tag)
+static inline void cheri_tag_group_write(uint64_t group, uint64_t tags)
 {
-    uint8_t *tagblk, *old;
+#if HOST_LONG_BITS == 64
+    atomic_set(&_cheri_tagmem[group], tags);
+#else
+    atomic_set(&_cheri_tagmem[2 * group], (uint32_t)tags);
+    atomic_set(&_cheri_tagmem[2 * group + 1], (uint32_t)(tags >> 32));
+#endif
+}
 
-    tagblk = g_malloc0(CAP_TAGBLK_SZ);
-    if (tagblk == NULL) {
-        error_report("Can't allocate tag block.");
-        exit(1);
+static void cheri_tags_save(QEMUFile *f, void *opaque)
+{
+    uint64_t ngroups = DIV_ROUND_UP(cheri_ntags, 64);
+    uint64_t first, count, group;
+
+    for (first = 0; first < ngroups; first += CHERI_TAGS_BLOCK_GROUPS) {
+        count = MIN(ngroups - first, CHERI_TAGS_BLOCK_GROUPS);
+        /* Skip blocks without tags (reading them doesn't allocate). */
+        if (buffer_is_zero(&_cheri_tagmem[BIT_WORD(first * 64)],
+                           count * sizeof(uint64_t))) {
+            continue;
+        }
+        qemu_put_be64(f, CHERI_TAGS_SAVE_FLAG_TAGS);
+        qemu_put_be64(f, first);
+        qemu_put_be64(f, count);
+        for (group = first; group < first + count; group++) {
+            uint64_t tags = cheri_tag_group_read(group);
+
+            qemu_put_be64(f, tags);
+#ifdef CHERI_MAGIC128
+            while (tags) {
+                cheri_tag_m128_t *meta =
+                    &_cheri_tagmem_m128[group * 64 + ctz64(tags)];
+
+                qemu_put_be64(f, meta->tps);
+                qemu_put_be64(f, meta->length);
+                tags &= tags - 1;
+            }
+#endif
+        }
     }
+    qemu_put_be64(f, CHERI_TAGS_SAVE_FLAG_EOS);
+}
 
-    /* Possible race here so use atomic compare and swap. */
-    assert((tag >> CAP_TAGBLK_SHFT) < cheri_ntagblks && "Tag index out of range");
-    old = atomic_cmpxchg(&_cheri_tagmem[tag >> CAP_TAGBLK_SHFT],
-            NULL, tagblk);
-    if (old != NULL) {
-        /* Lost the race, free. */
-        g_free(tagblk);
-        return old;
-    } else {
-        return tagblk;
+static int cheri_tags_load(QEMUFile *f, void *opaque, int version_id)
+{
+    uint64_t ngroups = DIV_ROUND_UP(cheri_ntags, 64);
+
+    /* Drop the current tags, loadvm may be restoring a running guest. */
+    cheri_tag_clear_range(_cheri_tagmem, 0, cheri_ntags);
+
+    for (;;) {
+        uint64_t flags = qemu_get_be64(f);
+        uint64_t first, count, group;
+
+        switch (flags) {
+        case CHERI_TAGS_SAVE_FLAG_TAGS:
+            first = qemu_get_be64(f);
+            count = qemu_get_be64(f);
+            if (first > ngroups || count > ngroups - first) {
+                error_report("CHERI tags %" PRIu64 "+%" PRIu64
+                             " don't fit %" PRIu64 " tag groups",
+                             first, count, ngroups);
+                return -EINVAL;
+            }
+            for (group = first; group < first + count; group++) {
+                uint64_t tags = qemu_get_be64(f);
+
+                if (tags) {
+                    if (qemu_tcg_mttcg_enabled())
+                        cheri_tag_set_page_tagged(group * 64 * CAP_SIZE);
+                    cheri_tag_group_write(group, tags);
+                }
+#ifdef CHERI_MAGIC128
+                while (tags) {
+                    cheri_tag_m128_t *meta =
+                        &_cheri_tagmem_m128[group * 64 + ctz64(tags)];
+
+                    meta->tps = qemu_get_be64(f);
+                    meta->length = qemu_get_be64(f);
+                    tags &= tags - 1;
+                }
+#endif
+            }
+            break;
+        case CHERI_TAGS_SAVE_FLAG_EOS:
+            return qemu_file_get_error(f);
+        default:
+            error_report("Unexpected CHERI tag flags: %#" PRIx64, flags);
+            return -EINVAL;
+        }
     }
 }
 
+static SaveVMHandlers savevm_cheri_tags = {
+    .save_state = cheri_tags_save,
+    .load_state = cheri_tags_load,
+};
+
+static void cheri_tag_migration_init(void)
+{
+    register_savevm_live("cheri-tags", 0, 1, &savevm_cheri_tags, NULL);
+}
+#endif /* !CONFIG_USER_ONLY */
+
 void cheri_tag_set(CPUArchState *env, target_ulong vaddr, int reg, uintptr_t pc)
 {
     ram_addr_t ram_addr;
-    uint64_t tag;
-    uint8_t *tagblk;
+    unsigned long *tags;
 
     /*
      * This attempt to resolve a virtual address may cause both a data store
      * TLB fault (entry missing or D bit clear) and a capability store TLB
-     * fault (SC bit set).  v2r_addr bypasses the generic QEMU TCG soft-TLB
-     * (env->tlb_table and friends) but will populate the MIPS-specific TLB
-     * (env->tlb->mmu.r4k.tlb).  Therefore, while a data store to vaddr
-     * after a tag has been set might miss in the QEMU TCG soft-TLB, it
-     * won't miss in the MIPS model and therefore won't raise a processor
-     * exception (and will populate the QEMU TCG soft-TLB for subsequent
-     * data stores).
+     * fault (SC bit set). The data store fault is taken when filling the
+     * QEMU TCG soft-TLB entry for the page, which the following data stores
+     * then hit. The capability store fault is taken based on the
+     * PAGE_SC_TRAP bit recorded in that entry.
      */
-
-    ram_addr = v2r_addr(env, vaddr, MMU_DATA_CAP_STORE, reg, pc);
-    if (ram_addr == -1LL)
+    tags = cheri_tag_lookup(env, vaddr, CAP_SIZE, MMU_DATA_CAP_STORE, reg, pc,
+                            &ram_addr, NULL, NULL);
+    if (tags == NULL)
         return;
+    cheri_tag_require_exclusive(env, pc);
+    cheri_tag_mark_page(env, ram_addr, pc);
 
-    /* Get the tag number and tag block ptr. */
-    tag = ram_addr >> CAP_TAG_SHFT;
-    tagblk = get_cheri_tagmem(tag >> CAP_TAGBLK_SHFT);
-
-    if (tagblk == NULL) {
-        /* Allocated a tag block. */
-        tagblk = cheri_tag_new_tagblk(tag);
-    }
     if (unlikely(qemu_loglevel_mask(CPU_LOG_INSTR))) {
         qemu_log("    Cap Tag Write [" RAM_ADDR_FMT "] %d -> 1\n", ram_addr,
-                 tagblk[CAP_TAGBLK_IDX(tag)]);
+                 test_bit(tag_nr_in_page(vaddr), tags));
     }
-    tagblk[CAP_TAGBLK_IDX(tag)] = 1;
+    set_bit_atomic(tag_nr_in_page(vaddr), tags);
 
-#ifdef TARGET_MIPS
-    /* Check RAM address to see if the linkedflag needs to be reset. */
-    // FIXME: we should really be using a different approach for LL/SC
-    if (QEMU_ALIGN_DOWN(ram_addr, CHERI_CAP_SIZE) ==
-        QEMU_ALIGN_DOWN(env->CP0_LLAddr, CHERI_CAP_SIZE)) {
-        env->linkedflag = 0;
-        env->lladdr = 1;
+    cheri_tag_reset_linkedflag(env, ram_addr, CAP_SIZE);
+}
+
+int cheri_tag_get(CPUArchState *env, target_ulong vaddr, int reg,
+        hwaddr *ret_paddr, int *prot, uintptr_t pc)
+{
+    ram_addr_t ram_addr;
+    unsigned long *tags = cheri_tag_lookup(env, vaddr, CAP_SIZE,
+                                           MMU_DATA_CAP_LOAD, reg, pc,
+                                           &ram_addr, prot, NULL);
+    if (ret_paddr) {
+        /* Only needed for CLLC, so the extra MMU lookup doesn't matter. */
+        int ignored_prot;
+        *ret_paddr = v2p_addr(env, vaddr, MMU_DATA_CAP_LOAD, reg, pc,
+                              &ignored_prot);
     }
-#endif
+    if (tags == NULL)
+        return 0;
+    cheri_tag_require_exclusive(env, pc);
+    return test_bit(tag_nr_in_page(vaddr), tags);
 }
 
-static uint8_t *
-cheri_tag_get_block(CPUArchState *env, target_ulong vaddr, MMUAccessType at,
-    int reg, int xshift, uintptr_t pc,
-    hwaddr *ret_paddr, ram_addr_t *ret_ram_addr, uint64_t *ret_tag, int *prot)
+/*
+ * Fast path for capability loads: translate vaddr and find its tag with a
+ * single TLB lookup, then copy the CAP_SIZE bytes of the capability (in
+ * guest memory byte order) from the host page to @data, consistently with
+ * its tag. Returns false without reading anything if the capability has to
+ * be loaded through the slow path (cpu_ld*() and cheri_tag_get()).
+ */
+bool cheri_tag_load_host(CPUArchState *env, target_ulong vaddr, int reg,
+                         void *data, int *tag, int *prot, uintptr_t pc)
 {
-    hwaddr paddr;
     ram_addr_t ram_addr;
-    uint64_t tag;
+    void *host;
+    unsigned long *tags = cheri_tag_lookup(env, vaddr, CAP_SIZE,
+                                           MMU_DATA_CAP_LOAD, reg, pc,
+                                           &ram_addr, prot, &host);
+    long nr = tag_nr_in_page(vaddr);
+    CheriTagStripe *stripe;
+    unsigned seq;
 
-    paddr = v2p_addr(env, vaddr, at, reg, pc, prot);
+    if (host == NULL)
+        return false;
+    if (tags == NULL) {
+        memcpy(data, host, CAP_SIZE);
+        *tag = 0;
+        return true;
+    }
 
-    if (ret_paddr)
-        *ret_paddr = paddr;
+    stripe = cheri_tag_stripe(ram_addr);
+    do {
+        seq = seqlock_read_begin(&stripe->sequence);
+        cheri_cap_data_read(host, data);
+        /* Integer stores clear the tag before writing the data. */
+        smp_rmb();
+        *tag = test_bit(nr, tags);
+    } while (seqlock_read_retry(&stripe->sequence, seq));
+    return true;
+}
 
-    ram_addr = p2r_addr(env, paddr, NULL);
-    if (ram_addr == -1LL)
-        return NULL;
+static bool cheri_tag_write_host(CPUArchState *env, target_ulong vaddr,
+                                 int reg, const void *expected,
+                                 bool expected_tag, const void *data,
+                                 bool tag, bool *stored, uintptr_t pc)
+{
+    ram_addr_t ram_addr;
+    void *host;
+    unsigned long *tags = cheri_tag_lookup(env, vaddr, CAP_SIZE,
+                                           tag ? MMU_DATA_CAP_STORE : MMU_DATA_STORE,
+                                           reg, pc, &ram_addr, NULL, &host);
+    long nr = tag_nr_in_page(vaddr);
+    CheriTagStripe *stripe;
+
+    if (host == NULL) {
+        if (tags != NULL)
+            cheri_tag_require_exclusive(env, pc);
+        return false;
+    }
+    if (tag && tags != NULL)
+        cheri_tag_mark_page(env, ram_addr, pc);
 
-    if (ret_ram_addr)
-        *ret_ram_addr = ram_addr;
+    if (CHERI_CAP_ATOMIC && parallel_cpus && expected != NULL &&
+        tags != NULL && expected_tag && tag) {
+        /*
+         * The tag stays set, so a host cmpxchg of the data is enough. Don't
+         * touch the tag afterwards: an integer store may have cleared it.
+         */
+        cheri_tag_publish_hazard(env, cheri_tag_stripe(ram_addr), ram_addr);
+        *stored = test_bit(nr, tags) &&
+            cheri_cap_data_cmpxchg(host, expected, data);
+        cheri_tag_store_end(env);
+        if (*stored && unlikely(qemu_loglevel_mask(CPU_LOG_INSTR))) {
+            qemu_log("    Cap Tag Write [" RAM_ADDR_FMT "] 1 -> 1\n",
+                     ram_addr);
+        }
+        if (*stored)
+            cheri_tag_reset_linkedflag(env, ram_addr, CAP_SIZE);
+        return true;
+    }
 
-    /* Get the tag number and tag block ptr. */
-    tag = (ram_addr >> (CAP_TAG_SHFT + xshift)) << xshift;
-    if (ret_tag)
-        *ret_tag = tag;
+    stripe = tags ? cheri_tag_write_lock(env, ram_addr, CAP_SIZE) : NULL;
+    if (expected == NULL) {
+        cheri_cap_data_write(host, data);
+        *stored = true;
+    } else {
+        *stored = (tags != NULL && test_bit(nr, tags)) == expected_tag &&
+            cheri_cap_data_cmpxchg(host, expected, data);
+    }
+    if (*stored) {
+        if (tags != NULL) {
+            if (unlikely(qemu_loglevel_mask(CPU_LOG_INSTR))) {
+                qemu_log("    Cap Tag Write [" RAM_ADDR_FMT "] %d -> %d\n",
+                         ram_addr, test_bit(nr, tags), tag);
+            }
+            if (tag)
+                set_bit_atomic(nr, tags);
+            else if (test_bit(nr, tags))
+                clear_bit_atomic(nr, tags);
+        }
+    }
+    cheri_tag_write_unlock(stripe);
+    if (*stored && ram_addr != -1LL)
+        cheri_tag_reset_linkedflag(env, ram_addr, CAP_SIZE);
+    return true;
+}
 
-    return get_cheri_tagmem(tag >> CAP_TAGBLK_SHFT);
+/*
+ * Fast path for capability stores: like cheri_tag_set() (or
+ * cheri_tag_invalidate() if the tag is clear) followed by the data stores,
+ * but with a single TLB lookup and writing the CAP_SIZE bytes of @data (in
+ * guest memory byte order) directly to the host page. Other vCPUs see data
+ * and tag change at once. Returns false without storing anything if the
+ * capability has to be stored through the slow path.
+ */
+bool cheri_tag_store_host(CPUArchState *env, target_ulong vaddr, int reg,
+                          const void *data, bool tag, uintptr_t pc)
+{
+    bool stored;
+    return cheri_tag_write_host(env, vaddr, reg, NULL, false, data, tag,
+                                &stored, pc);
 }
 
-int cheri_tag_get(CPUArchState *env, target_ulong vaddr, int reg,
-        hwaddr *ret_paddr, int *prot, uintptr_t pc)
+/*
+ * Like cheri_tag_store_host(), but only store the capability if the memory
+ * still holds @expected with tag @expected_tag (e.g. for store-conditional).
+ * *stored tells whether it did.
+ */
+bool cheri_tag_cmpxchg_host(CPUArchState *env, target_ulong vaddr, int reg,
+                            const void *expected, bool expected_tag,
+                            const void *data, bool tag, bool *stored,
+                            uintptr_t pc)
 {
-    uint64_t tag;
-    uint8_t *tagblk = cheri_tag_get_block(env, vaddr, MMU_DATA_CAP_LOAD, reg,
-                                          0, pc, ret_paddr, NULL, &tag, prot);
-    if (tagblk == NULL)
-        return 0;
-    else
-        return tagblk[CAP_TAGBLK_IDX(tag)];
+    return cheri_tag_write_host(env, vaddr, reg, expected, expected_tag, data,
+                                tag, stored, pc);
 }
 
 /* QEMU currently tells the kernel that there are no caches installed
@@ -384,82 +1024,245 @@ int cheri_tag_get(CPUArchState *env, target_ulong vaddr, int reg,
 int cheri_tag_get_many(CPUArchState *env, target_ulong vaddr, int reg,
         hwaddr *ret_paddr, uintptr_t pc)
 {
-    uint64_t tag;
-    int prot;
-    uint8_t *tagblk = cheri_tag_get_block(env, vaddr, MMU_DATA_CAP_LOAD, reg,
-                                          CAP_TAG_GET_MANY_SHFT, pc, ret_paddr,
-                                          NULL, &tag, &prot);
+    ram_addr_t ram_addr;
+    target_ulong line_addr =
+        vaddr & ~(target_ulong)((CAP_SIZE << CAP_TAG_GET_MANY_SHFT) - 1);
+    unsigned long *tags = cheri_tag_lookup(env, line_addr,
+                                           CAP_SIZE << CAP_TAG_GET_MANY_SHFT,
+                                           MMU_DATA_CAP_LOAD, reg, pc,
+                                           &ram_addr, NULL, NULL);
 
     /*
      * XXX Right now, the sole consumer of this function is CLoadTags, and
      * we let it "see around" the TLB capability load inhibit.  That should
      * perhaps change?
      */
-    (void) prot;
+    if (ret_paddr) {
+        int ignored_prot;
+        *ret_paddr = v2p_addr(env, vaddr, MMU_DATA_CAP_LOAD, reg, pc,
+                              &ignored_prot);
+    }
 
-    if (tagblk == NULL)
+    if (tags == NULL)
         return 0;
     else {
-#define TAG_BYTE_TO_BIT(ix) (tagblk[CAP_TAGBLK_IDX(tag+ix)] ? (1 << ix) : 0)
-        return TAG_BYTE_TO_BIT(0)
-             | TAG_BYTE_TO_BIT(1)
-             | TAG_BYTE_TO_BIT(2)
-             | TAG_BYTE_TO_BIT(3)
-             | TAG_BYTE_TO_BIT(4)
-             | TAG_BYTE_TO_BIT(5)
-             | TAG_BYTE_TO_BIT(6)
-             | TAG_BYTE_TO_BIT(7);
-#undef TAG_BYTE_TO_BIT
+        /* The 8 tags of a line never straddle a host word. */
+        long nr = tag_nr_in_page(line_addr);
+        return (atomic_read(&tags[BIT_WORD(nr)]) >> (nr % BITS_PER_LONG)) &
+               ((1 << (1 << CAP_TAG_GET_MANY_SHFT)) - 1);
     }
 }
 
+/*
+ * Find the first tagged capability in [vaddr, vaddr + len), which must be
+ * capability aligned and not cross a page boundary, by scanning the tag
+ * bitmap a host word at a time. Returns its offset from vaddr, or len if
+ * there is none. Pages without tag memory are skipped without looking at
+ * them. Like CLoadTags this ignores the capability load inhibit.
+ */
+target_ulong cheri_tag_find_next(CPUArchState *env, target_ulong vaddr,
+                                 target_ulong len, uintptr_t pc)
+{
+    ram_addr_t ram_addr;
+    unsigned long *tags = cheri_tag_lookup(env, vaddr, len, MMU_DATA_LOAD,
+                                           0xFF, pc, &ram_addr, NULL, NULL);
+    long first = tag_nr_in_page(vaddr);
+    long end = first + (len >> CAP_TAG_SHFT);
+    long nr;
+
+    cheri_debug_assert(((vaddr | len) & CAP_MASK) == 0 && len != 0 &&
+                       (vaddr & ~TARGET_PAGE_MASK) + len <= TARGET_PAGE_SIZE);
+    if (tags == NULL)
+        return len;
+    nr = find_next_bit(tags, end, first);
+    return nr < end ? (nr - first) << CAP_TAG_SHFT : len;
+}
+
+/*
+ * Fast path for bulk copies that preserve tags (e.g. the MIPS magic
+ * capability memcpy): copy @len bytes from @src to @dest, neither of which
+ * may cross a page boundary, directly between the host pages, together with
+ * the tags of all capabilities that are copied completely. Capabilities in
+ * @dest that are only partially overwritten lose their tags, as do all of
+ * them if @src and @dest are not equally aligned.
+ *
+ * This takes the same TLB faults as the data accesses would. Returns false
+ * without copying anything if the chunk has to use the slow path, i.e. if
+ * either page is not RAM or a tagged capability would hit a capability
+ * load/store inhibit in the TLB.
+ */
+bool cheri_tag_copy_host(CPUArchState *env, target_ulong dest,
+                         target_ulong src, target_ulong len, uintptr_t pc)
+{
+    int mmu_idx = cpu_mmu_index(env, false);
+    CPUIOTLBEntry *iotlbentry;
+    unsigned long *src_tags, *dest_tags;
+    ram_addr_t src_ram_addr, dest_ram_addr;
+    void *src_host, *dest_host;
+    const void *from;
+    int src_prot;
+    target_ulong src_off = src & ~TARGET_PAGE_MASK;
+    target_ulong dest_off = dest & ~TARGET_PAGE_MASK;
+    bool preserve = ((src_off ^ dest_off) & CAP_MASK) == 0;
+    /* Tags of @dest that are modified and of those overwritten completely: */
+    long first = dest_off >> CAP_TAG_SHFT;
+    long end = (dest_off + len + CAP_MASK) >> CAP_TAG_SHFT;
+    long full_first = (dest_off + CAP_MASK) >> CAP_TAG_SHFT;
+    long full_end = (dest_off + len) >> CAP_TAG_SHFT;
+    long src_delta = ((long)src_off - (long)dest_off) / CAP_SIZE;
+    /* The tags to copy, indexed like those of @dest: */
+    unsigned long copied[BITS_TO_LONGS(TARGET_PAGE_SIZE >> CAP_TAG_SHFT)];
+    uint8_t bounce[TARGET_PAGE_SIZE];
+    CheriTagStripe *stripe;
+    bool any_tags = false;
+
+    cheri_debug_assert(len != 0 && src_off + len <= TARGET_PAGE_SIZE &&
+                       dest_off + len <= TARGET_PAGE_SIZE);
+
+    /* The destination probe might evict the source entry, so copy it out. */
+    iotlbentry = probe_access_iotlb(env, src, len, MMU_DATA_LOAD, mmu_idx, pc,
+                                    &src_host);
+    src_tags = iotlbentry->tagmem;
+    src_ram_addr = iotlbentry->tag_ram_addr;
+    src_prot = iotlbentry->cheri_prot;
+    iotlbentry = probe_access_iotlb(env, dest, len, MMU_DATA_STORE, mmu_idx,
+                                    pc, &dest_host);
+    if (src_host == NULL || dest_host == NULL)
+        return false;
+    dest_tags = iotlbentry->tagmem;
+    dest_ram_addr = iotlbentry->tag_ram_addr;
+
+    from = src_host;
+    if (preserve && src_tags && full_first < full_end) {
+        CheriTagStripe *src_stripe = cheri_tag_stripe(src_ram_addr);
+        unsigned seq = 0;
+
+        /*
+         * With MTTCG, take a consistent snapshot of the source first. This
+         * can't be done while holding the lock of the destination, which
+         * might be the source stripe of a concurrent copy the other way.
+         */
+        do {
+            if (parallel_cpus) {
+                seq = seqlock_read_begin(&src_stripe->sequence);
+                memcpy(bounce, src_host, len);
+                from = bounce;
+#if CHERI_CAP_ATOMIC
+                /*
+                 * A CSCC may replace tagged capabilities without changing
+                 * the sequence count, so read those in one go. Tags only
+                 * get set under the stripe lock, so checking them first
+                 * catches all of them.
+                 */
+                for (long nr = full_first; nr < full_end; nr++) {
+                    if (test_bit(nr + src_delta, src_tags)) {
+                        long off = nr * CAP_SIZE - dest_off;
+                        cheri_cap_data_read(src_host + off, bounce + off);
+                    }
+                }
+#endif
+                smp_rmb();
+            }
+            bitmap_zero(copied, full_end);
+            for (long nr = full_first; nr < full_end; nr++) {
+                if (test_bit(nr + src_delta, src_tags))
+                    set_bit(nr, copied);
+            }
+        } while (parallel_cpus &&
+                 seqlock_read_retry(&src_stripe->sequence, seq));
+        any_tags = find_next_bit(copied, full_end, full_first) < full_end;
+    }
+    if (any_tags && ((src_prot & (PAGE_LC_CLEAR | PAGE_LC_TRAP)) ||
+                     (iotlbentry->cheri_prot & PAGE_SC_TRAP) ||
+                     iotlbentry->tagmem_readonly || dest_tags == NULL))
+        return false;
+
+    if (dest_tags == NULL) {
+        memmove(dest_host, from, len);
+        return true;
+    }
+    if (any_tags)
+        cheri_tag_mark_page(env, dest_ram_addr, pc);
+    stripe = cheri_tag_write_lock(env, dest_ram_addr + dest_off, len);
+    memmove(dest_host, from, len);
+    if (!any_tags) {
+        cheri_tag_clear_range(dest_tags, first, end);
+    } else {
+        for (long nr = first; nr < end; nr++) {
+            if (nr >= full_first && nr < full_end && test_bit(nr, copied)) {
+#ifdef CHERI_MAGIC128
+                _cheri_tagmem_m128[(dest_ram_addr >> CAP_TAG_SHFT) + nr] =
+                    _cheri_tagmem_m128[(src_ram_addr >> CAP_TAG_SHFT) + nr +
+                                       src_delta];
+#endif
+                set_bit_atomic(nr, dest_tags);
+            } else if (test_bit(nr, dest_tags)) {
+                clear_bit_atomic(nr, dest_tags);
+            }
+        }
+        if (unlikely(qemu_loglevel_mask(CPU_LOG_INSTR))) {
+            qemu_log("    Cap Tag Copy [" RAM_ADDR_FMT "-" RAM_ADDR_FMT
+                     "] <- [" RAM_ADDR_FMT "]\n", dest_ram_addr + dest_off,
+                     dest_ram_addr + dest_off + len, src_ram_addr + src_off);
+        }
+    }
+    cheri_tag_write_unlock(stripe);
+    cheri_tag_reset_linkedflag(env, dest_ram_addr + dest_off, len);
+    return true;
+}
+
 #ifdef CHERI_MAGIC128
 void cheri_tag_set_m128(CPUArchState *env, target_ulong vaddr, int reg,
         uint8_t tagbit, uint64_t tps, uint64_t length, hwaddr *ret_paddr, uintptr_t pc)
 {
-    int prot;
-    uint64_t tag;
-    uint64_t *tagblk64;
     ram_addr_t ram_addr;
 
     // If the data is untagged we shouldn't get a tlb fault
-    uint8_t *tagblk = cheri_tag_get_block(env, vaddr,
-					  tagbit ? MMU_DATA_CAP_STORE : MMU_DATA_STORE,
-					  reg, 0, pc, ret_paddr, &ram_addr, &tag, &prot);
-    if (tagblk == NULL) {
-        /* Allocated a tag block. */
-        tagblk = cheri_tag_new_tagblk(tag);
-    }
-    tagblk64 = (uint64_t *)&tagblk[CAP_TAGBLK_IDX(tag)];
-    *tagblk64 = (tps << CAP_TAG_TPS_SHFT) | tagbit;
-    tagblk64++;
-    *tagblk64 = length;
-
-
-    /* Check RAM address to see if the linkedflag needs to be reset. */
-    if (QEMU_ALIGN_DOWN(ram_addr, CHERI_CAP_SIZE) ==
-        QEMU_ALIGN_DOWN(env->CP0_LLAddr, CHERI_CAP_SIZE)) {
-        env->linkedflag = 0;
-        env->lladdr = 1;
+    unsigned long *tags = cheri_tag_lookup(env, vaddr, CAP_SIZE,
+                                           tagbit ? MMU_DATA_CAP_STORE : MMU_DATA_STORE,
+                                           reg, pc, &ram_addr, NULL, NULL);
+    if (ret_paddr) {
+        int ignored_prot;
+        *ret_paddr = v2p_addr(env, vaddr, MMU_DATA_STORE, reg, pc,
+                              &ignored_prot);
     }
+    if (tags == NULL)
+        return;
+    if (tagbit)
+        cheri_tag_mark_page(env, ram_addr, pc);
 
-    return;
+    cheri_tag_m128_t *meta = &_cheri_tagmem_m128[ram_addr >> CAP_TAG_SHFT];
+    meta->tps = tps;
+    meta->length = length;
+    if (tagbit)
+        set_bit_atomic(tag_nr_in_page(vaddr), tags);
+    else
+        clear_bit_atomic(tag_nr_in_page(vaddr), tags);
+
+    cheri_tag_reset_linkedflag(env, ram_addr, CAP_SIZE);
 }
 
 int cheri_tag_get_m128(CPUArchState *env, target_ulong vaddr, int reg,
         uint64_t *ret_tps, uint64_t *ret_length, hwaddr *ret_paddr, int *prot, uintptr_t pc)
 {
-    uint64_t tag;
-    uint8_t *tagblk = cheri_tag_get_block(env, vaddr, MMU_DATA_CAP_LOAD, reg,
-                                          0, pc, ret_paddr, NULL, &tag, prot);
+    ram_addr_t ram_addr;
+    unsigned long *tags = cheri_tag_lookup(env, vaddr, CAP_SIZE,
+                                           MMU_DATA_CAP_LOAD, reg, pc,
+                                           &ram_addr, prot, NULL);
+    if (ret_paddr) {
+        int ignored_prot;
+        *ret_paddr = v2p_addr(env, vaddr, MMU_DATA_CAP_LOAD, reg, pc,
+                              &ignored_prot);
+    }
 
-    if (tagblk == NULL) {
+    if (tags == NULL) {
         *ret_tps = *ret_length = 0ULL;
         return 0;
     } else {
-        *ret_tps = (*(uint64_t *)&tagblk[CAP_TAGBLK_IDX(tag)]) >> CAP_TAG_TPS_SHFT;
-        *ret_length = *(uint64_t *)&tagblk[CAP_TAGBLK_IDX(tag) + 8];
-        return tagblk[CAP_TAGBLK_IDX(tag)];
+        cheri_tag_m128_t *meta = &_cheri_tagmem_m128[ram_addr >> CAP_TAG_SHFT];
+        *ret_tps = meta->tps;
+        *ret_length = meta->length;
+        return test_bit(tag_nr_in_page(vaddr), tags);
     }
 }
 #endif /* CHERI_MAGIC128 */
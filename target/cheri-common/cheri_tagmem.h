@@ -39,14 +39,37 @@
 /* Note: for cheri_tag_phys_invalidate, env may be NULL */
 void cheri_tag_phys_invalidate(CPUArchState *env, ram_addr_t paddr, ram_addr_t len);
 void cheri_tag_init(uint64_t memory_size);
+/* Tag storage for the capability at ram_addr (NULL if not allocated yet) */
+void *cheri_tagmem_for_addr(ram_addr_t ram_addr);
+bool cheri_tag_page_maybe_tagged(ram_addr_t ram_addr);
+unsigned *cheri_tag_seq_for_addr(ram_addr_t ram_addr);
 void cheri_tag_invalidate(CPUArchState *env, target_ulong vaddr, int32_t size,
                           uintptr_t pc);
+/* Bracket integer stores for MTTCG (see cheri_tagmem.c) */
+void cheri_tag_store_begin(CPUArchState *env, target_ulong vaddr, int32_t size,
+                           uintptr_t pc);
+void cheri_tag_store_end(CPUArchState *env);
+void cheri_tag_phys_store_begin(CPUArchState *env, ram_addr_t ram_addr,
+                                ram_addr_t len);
+void cheri_tag_phys_store_end(CPUArchState *env, ram_addr_t ram_addr);
 int  cheri_tag_get(CPUArchState *env, target_ulong vaddr, int reg,
         hwaddr *ret_paddr, int *prot, uintptr_t pc);
 int  cheri_tag_get_many(CPUArchState *env, target_ulong vaddr, int reg,
         hwaddr *ret_paddr, uintptr_t pc);
+target_ulong cheri_tag_find_next(CPUArchState *env, target_ulong vaddr,
+        target_ulong len, uintptr_t pc);
 void cheri_tag_set(CPUArchState *env, target_ulong vaddr, int reg,
         uintptr_t pc);
+/* Single-lookup fast paths for CLC/CSC (false: use the functions above) */
+bool cheri_tag_load_host(CPUArchState *env, target_ulong vaddr, int reg,
+        void *data, int *tag, int *prot, uintptr_t pc);
+bool cheri_tag_store_host(CPUArchState *env, target_ulong vaddr, int reg,
+        const void *data, bool tag, uintptr_t pc);
+bool cheri_tag_cmpxchg_host(CPUArchState *env, target_ulong vaddr, int reg,
+        const void *expected, bool expected_tag, const void *data, bool tag,
+        bool *stored, uintptr_t pc);
+bool cheri_tag_copy_host(CPUArchState *env, target_ulong dest,
+        target_ulong src, target_ulong len, uintptr_t pc);
 #ifdef CHERI_MAGIC128
 int  cheri_tag_get_m128(CPUArchState *env, target_ulong vaddr, int reg,
         uint64_t *tps, uint64_t *length, hwaddr *ret_paddr, int *prot, uintptr_t pc);
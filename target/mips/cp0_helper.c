@@ -882,9 +882,9 @@ void helper_mtc0_memorymapid(CPUMIPSState *env, target_ulong arg1)
     int32_t old;
     old = env->CP0_MemoryMapID;
     env->CP0_MemoryMapID = (int32_t) arg1;
-    /* If the MemoryMapID changes, flush qemu's TLB.  */
+    /* If the MemoryMapID changes, switch to its soft TLB slot.  */
     if (old != env->CP0_MemoryMapID) {
-        cpu_mips_tlb_flush(env);
+        cpu_mips_update_asid_slot(env);
     }
 }
 
@@ -1162,10 +1162,9 @@ void helper_mtc0_entryhi(CPUMIPSState *env, target_ulong arg1)
     if (env->CP0_Config3 & (1 << CP0C3_MT)) {
         sync_c0_entryhi(env, env->current_tc);
     }
-    /* If the ASID changes, flush qemu's TLB.  */
-    if ((old & env->CP0_EntryHi_ASID_mask) !=
-        (val & env->CP0_EntryHi_ASID_mask)) {
-        tlb_flush(env_cpu(env));
+    /* If the ASID changes, switch to its soft TLB slot.  */
+    if (old != val) {
+        cpu_mips_update_asid_slot(env);
     }
 }
 
@@ -1196,7 +1195,7 @@ void helper_mtc0_status(CPUMIPSState *env, target_ulong arg1)
                 old, old & env->CP0_Cause & CP0Ca_IP_mask,
                 val, val & env->CP0_Cause & CP0Ca_IP_mask,
                 env->CP0_Cause);
-        switch (cpu_mmu_index(env, false)) {
+        switch (mips_mmu_idx_mode(cpu_mmu_index(env, false))) {
         case 3:
             qemu_log(", ERL\n");
             break;
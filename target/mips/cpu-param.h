@@ -24,6 +24,6 @@
 #endif
 #endif
 #define TARGET_PAGE_BITS 12
-#define NB_MMU_MODES 4
+#define NB_MMU_MODES 16 /* MIPS_ASID_SLOTS * MIPS_MMU_MODES_PER_SLOT */
 
 #endif
@@ -222,25 +222,26 @@ static void dump_cpu_ips_on_exit(void) {
     CPU_FOREACH(cpu) {
         CPUMIPSState *env = cpu->env_ptr;
         double duration_s = (get_clock() - start_ns) / 1000000000.0;
-        uint64_t inst_total = env->statcounters_icount_kernel + env->statcounters_icount_user;
+        uint64_t inst_total = env->statcounters.icount_kernel + env->statcounters.icount_user;
         info_report("CPU%d executed instructions: %jd (%jd user, %jd kernel) in %.2fs KIPS: %.2f\r\n", cpu->cpu_index,
-                    (uintmax_t)inst_total, (uintmax_t)env->statcounters_icount_user,
-                    (uintmax_t)env->statcounters_icount_kernel, duration_s,
+                    (uintmax_t)inst_total, (uintmax_t)env->statcounters.icount_user,
+                    (uintmax_t)env->statcounters.icount_kernel, duration_s,
                     (double)(inst_total / duration_s) / 1000.0);
     }
 }
-#if defined(DO_CHERI_STATISTICS)
+/*
+ * The statistics are always collected, but only printed on exit when bounds
+ * logging was requested. Otherwise use "info cpustats" in the monitor.
+ */
 static void dump_stats_on_exit(void)
 {
     if (qemu_log_enabled() && qemu_loglevel_mask(CPU_LOG_INSTR | CPU_LOG_CHERI_BOUNDS)) {
         FILE* logf = qemu_log_lock();
         cheri_cpu_dump_statistics_f(NULL, logf, 0);
         qemu_log_unlock(logf);
-    } else
-        cheri_cpu_dump_statistics_f(NULL, stderr, 0);
+    }
 }
 #endif
-#endif
 
 static void mips_cpu_class_init(ObjectClass *c, void *data)
 {
@@ -284,10 +285,8 @@ static void mips_cpu_class_init(ObjectClass *c, void *data)
     cc->dump_statistics = cheri_cpu_dump_statistics;
     start_ns = get_clock();
     atexit(dump_cpu_ips_on_exit);
-#if defined(DO_CHERI_STATISTICS)
     atexit(dump_stats_on_exit);
 #endif
-#endif
 
 }
 
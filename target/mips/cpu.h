@@ -8,6 +8,11 @@
 
 #ifdef TARGET_CHERI
 #include "cheri_defs.h"
+#include "cheri_capregs.h"
+#include "cheri_decode_cache.h"
+#endif
+#ifdef CONFIG_MIPS_LOG_INSTR
+#include "qemu/log.h"
 #endif
 
 #define TCG_GUEST_DEFAULT_MO (0)
@@ -159,9 +164,60 @@ struct cvtrace {
 } __attribute__((packed));
 typedef struct cvtrace cvtrace_t;
 
+/*
+ * Per-vCPU ring of finished cvtrace records. Only the vCPU thread advances
+ * head and only the writer thread (see cvtrace_buffer.c) advances tail.
+ */
+struct cvtrace_ring {
+    cvtrace_t *records;
+    unsigned head;
+    unsigned tail;
+};
+
 /* Version 3 Cheri Stream Trace header info */
 #define CVT_QEMU_VERSION    (0x80U + 3)
 #define CVT_QEMU_MAGIC      "CheriTraceV03"
+/* Same records, delta encoded in seekable frames (see cvtrace_compress.c) */
+#define CVT_QEMU_MAGIC_COMPRESSED "CheriTraceZ03"
+
+/*
+ * Restricts instruction logging to a set of ASIDs and virtual address ranges
+ * (-cheri-trace-filter or the cheri-trace-filter monitor command). The filter
+ * is applied when code is translated, so changing it flushes all TBs.
+ */
+#define CHERI_TRACE_FILTER_MAX_RANGES 8
+struct cheri_trace_filter {
+    bool filter_asids;
+    uint64_t asids[256 / 64];
+    unsigned num_ranges;
+    struct {
+        uint64_t start;
+        uint64_t end;       /* inclusive */
+    } ranges[CHERI_TRACE_FILTER_MAX_RANGES];
+};
+extern struct cheri_trace_filter cheri_trace_filter;
+
+static inline bool cheri_trace_filter_allows_asid(uint8_t asid)
+{
+    return !cheri_trace_filter.filter_asids ||
+        (cheri_trace_filter.asids[asid / 64] & (UINT64_C(1) << (asid % 64)));
+}
+
+static inline bool cheri_trace_filter_allows_pc(uint64_t pc)
+{
+    unsigned i;
+
+    if (cheri_trace_filter.num_ranges == 0) {
+        return true;
+    }
+    for (i = 0; i < cheri_trace_filter.num_ranges; i++) {
+        if (pc >= cheri_trace_filter.ranges[i].start &&
+            pc <= cheri_trace_filter.ranges[i].end) {
+            return true;
+        }
+    }
+    return false;
+}
 #endif // CONFIG_MIPS_LOG_INSTR
 
 #if defined(TARGET_CHERI)
@@ -517,6 +573,24 @@ struct cheri_cap_hwregs {
 #define CP0_REG31__KSCRATCH6       7
 
 
+#ifdef CHERI_128
+/*
+ * Decompressed copies of recently used capability registers. An entry is
+ * current while its raw words match gpcapregs, so writes from TCG or
+ * update_capreg_raw() never need to invalidate it.
+ */
+#define CAPREG_DECODE_CACHE_SIZE 4
+
+struct capreg_decode_cache_entry {
+    cap_register_t cap;
+    target_ulong pesbt;
+    uint32_t last_use;
+    uint8_t num;
+    uint8_t state;
+    bool valid;
+};
+#endif
+
 typedef struct TCState TCState;
 struct TCState {
     target_ulong gpr[32];
@@ -529,7 +603,21 @@ struct TCState {
 #if defined(TARGET_CHERI)
     cap_register_t PCC;
     cap_register_t CapBranchTarget; /* Target of the next cjr/cjalr/ccall */
+#ifdef CHERI_128
+    /*
+     * The capability registers are stored compressed (see cheri_capregs.h)
+     * so that TCG and CLC/CSC can move them around as raw words. Accessors
+     * decompress them on demand into the small _CGPR_decoded cache (see
+     * get_readonly_capreg()).
+     */
+    struct GPCapRegs gpcapregs;
+    struct capreg_decode_cache_entry _CGPR_decoded[CAPREG_DECODE_CACHE_SIZE];
+    uint32_t _CGPR_decoded_clock;
+    /* Points to the bounds memo in CPUMIPSState, set on reset */
+    struct cheri_decode_cache *decode_cache;
+#else
     cap_register_t _CGPR[32];
+#endif
     struct cheri_cap_hwregs CHWR;
 // #define CP2CAP_RCC  24  /* Return Code Capability */
 #define CP2CAP_IDC  26  /* Invoked Data Capability */
@@ -592,11 +680,107 @@ struct TCState {
 
 
 #if defined(TARGET_CHERI)
+#ifdef CHERI_128
+static inline bool
+_capreg_decode_cache_hit(const TCState* state, unsigned num,
+                         const struct capreg_decode_cache_entry *e) {
+    return e->valid && e->num == num &&
+        e->pesbt == state->gpcapregs.pesbt[num] &&
+        e->cap._cr_cursor == state->gpcapregs.cursor[num] &&
+        e->state == get_capreg_state(state->gpcapregs.capreg_state, num);
+}
+
+/* Returns the entry for @num, or the least recently used one if missing. */
+static inline struct capreg_decode_cache_entry *
+_capreg_decode_cache_lookup(TCState* state, unsigned num, bool *hit) {
+    struct capreg_decode_cache_entry *lru = &state->_CGPR_decoded[0];
+
+    for (int i = 0; i < CAPREG_DECODE_CACHE_SIZE; i++) {
+        struct capreg_decode_cache_entry *e = &state->_CGPR_decoded[i];
+        if (_capreg_decode_cache_hit(state, num, e)) {
+            *hit = true;
+            e->last_use = ++state->_CGPR_decoded_clock;
+            return e;
+        }
+        if ((int32_t)(e->last_use - lru->last_use) < 0)
+            lru = e;
+    }
+    *hit = false;
+    lru->last_use = ++state->_CGPR_decoded_clock;
+    return lru;
+}
+
+static inline void
+_capreg_decode_cache_fill(TCState* state, unsigned num,
+                          struct capreg_decode_cache_entry *e) {
+    e->valid = true;
+    e->num = num;
+    e->pesbt = state->gpcapregs.pesbt[num];
+    e->state = get_capreg_state(state->gpcapregs.capreg_state, num);
+}
+
+static inline const cap_register_t*
+_decode_capreg(TCState* state, unsigned num,
+               struct capreg_decode_cache_entry *e) {
+    _capreg_decode_cache_fill(state, num, e);
+    decompress_128cap_cached(state->decode_cache, e->pesbt,
+                             state->gpcapregs.cursor[num], &e->cap);
+    e->cap.cr_tag = e->state == CREG_TAGGED_CAP;
+    return &e->cap;
+}
+
+/*
+ * Returns a decompressed view of capability register @num.
+ *
+ * The pointer refers to an entry of the small LRU _CGPR_decoded cache. It
+ * stays valid only until CAPREG_DECODE_CACHE_SIZE - 1 other capability
+ * registers have been read with get_readonly_capreg()/get_capreg_0_is_ddc()
+ * or written with update_capreg(), and until any write to @num itself.
+ * Callers that access more registers than that while holding the pointer
+ * must copy the value instead.
+ */
+static inline  __attribute__((always_inline)) const cap_register_t*
+get_readonly_capreg(TCState* state, unsigned num) {
+    bool hit;
+    struct capreg_decode_cache_entry *e =
+        _capreg_decode_cache_lookup(state, num, &hit);
+
+    if (likely(hit))
+        return &e->cap;
+    return _decode_capreg(state, num, e);
+}
+
+/* Tag of a capability register, without decompressing it */
+static inline bool get_capreg_tag(const TCState* state, unsigned num) {
+    return get_capreg_state(state->gpcapregs.capreg_state, num) ==
+        CREG_TAGGED_CAP;
+}
+
+/* Hardware permissions of a capability register, without decompressing it */
+static inline uint32_t get_capreg_hwperms(const TCState* state, unsigned num) {
+    return (uint32_t)CC128_EXTRACT_FIELD(
+        state->gpcapregs.pesbt[num] ^ CC128_NULL_XOR_MASK, HWPERMS);
+}
+
+static inline void reset_capreg_decode_cache(TCState* state) {
+    memset(state->_CGPR_decoded, 0, sizeof(state->_CGPR_decoded));
+    state->_CGPR_decoded_clock = 0;
+}
+#else
 static inline  __attribute__((always_inline)) const cap_register_t*
 get_readonly_capreg(TCState* state, unsigned num) {
     return &state->_CGPR[num];
 }
 
+static inline bool get_capreg_tag(TCState* state, unsigned num) {
+    return get_readonly_capreg(state, num)->cr_tag;
+}
+
+static inline uint32_t get_capreg_hwperms(TCState* state, unsigned num) {
+    return get_readonly_capreg(state, num)->cr_perms;
+}
+#endif
+
 /// return a read-only capability register with register number 0 meaning $ddc
 /// This is useful for cl*/cs*/cll*/csc*/cfromptr/cbuildcap since using $ddc as the address
 /// argument there will cause a trap
@@ -608,15 +792,50 @@ get_capreg_0_is_ddc(TCState* state, unsigned num) {
     if (unlikely(num == 0)) {
         return &state->CHWR.DDC;
     }
-    return &state->_CGPR[num];
+    return get_readonly_capreg(state, num);
+}
+
+#ifdef CHERI_128
+/*
+ * Write a capability in memory format (e.g. as loaded by CLC) without
+ * decompressing it.
+ */
+static inline void
+update_capreg_raw(TCState* state, unsigned num, uint64_t pesbt,
+                  uint64_t cursor, bool tag) {
+    enum CapRegState cs = tag ? CREG_TAGGED_CAP :
+        (pesbt == 0 ? CREG_INTEGER : CREG_UNTAGGED_CAP);
+
+    // writing to $c0/$cnull is a no-op
+    if (unlikely(num == 0))
+        return;
+    state->gpcapregs.cursor[num] = cursor;
+    state->gpcapregs.pesbt[num] = pesbt;
+    state->gpcapregs.capreg_state =
+        (state->gpcapregs.capreg_state & capreg_state_set_to_integer_mask(num)) |
+        ((uint64_t)cs << (num * 2));
 }
+#endif
 
 static inline void
 update_capreg(TCState* state, unsigned num, const cap_register_t* newval) {
     // writing to $c0/$cnull is a no-op
     if (unlikely(num == 0))
         return;
+#ifdef CHERI_128
+    bool hit;
+    struct capreg_decode_cache_entry *e;
+
+    /* Only packs the fields, the bounds are already in cr_ebt. */
+    update_capreg_raw(state, num, compress_128cap(newval),
+                      newval->_cr_cursor, newval->cr_tag);
+    /* Keep the value as written so that reads don't have to decompress it. */
+    e = _capreg_decode_cache_lookup(state, num, &hit);
+    _capreg_decode_cache_fill(state, num, e);
+    e->cap = *newval;
+#else
     state->_CGPR[num] = *newval;
+#endif
 }
 
 #define CP2HWR_BASE_INDEX 0
@@ -634,8 +853,71 @@ enum CP2HWR {
     CP2HWR_EPCC = CP2HWR_BASE_INDEX + 31, /* Exception PC Capability */
 };
 
+/*
+ * BERI statcounters. The instruction counts are updated by inline TCG code at
+ * the start of every TB (see generate_statcounters_icount_start()), so keep
+ * them together.
+ */
+struct mips_statcounters {
+    uint64_t icount;
+    uint64_t icount_user;
+    uint64_t icount_kernel;
+    uint64_t itlb_miss;
+    uint64_t dtlb_miss;
+    uint64_t cap_read;
+    uint64_t cap_read_tagged;
+    uint64_t cap_write;
+    uint64_t cap_write_tagged;
+    uint64_t imprecise_setbounds;
+    uint64_t unrepresentable_caps;
+};
+
+/* Operations that can create out-of-bounds capabilities */
+enum oob_stat_op {
+    OOB_STAT_cincoffset,
+    OOB_STAT_csetoffset,
+    OOB_STAT_csetaddr,
+    OOB_STAT_candaddr,
+    OOB_STAT_cgetpccsetoffset,
+    OOB_STAT_cgetpccincoffset,
+    OOB_STAT_cgetpccsetaddr,
+    OOB_STAT_cfromptr,
+    OOB_STAT_NUM_OPS
+};
+
+/* Number of "out of bounds by up to N bytes" buckets */
+#define OOB_STAT_NUM_BUCKETS 13
+
+struct oob_stats_info {
+    uint64_t num_uses;
+    uint64_t unrepresentable; // Number of OOB caps that were unrepresentable
+    uint64_t after_bounds[OOB_STAT_NUM_BUCKETS + 1]; // Number of OOB caps created pointing to after end
+    uint64_t before_bounds[OOB_STAT_NUM_BUCKETS + 1];  // Number of OOB caps created pointing to before start
+};
+
 #endif
 
+/* Work done by the magic library call nops (see helper_magic_library_function) */
+enum magic_nop_stat {
+    MAGIC_NOP_STAT_MEMSET_ZERO,
+    MAGIC_NOP_STAT_MEMSET_NONZERO,
+    MAGIC_NOP_STAT_MEMCPY,
+    MAGIC_NOP_STAT_MEMMOVE,
+    MAGIC_NOP_STAT_BCOPY,
+    MAGIC_NOP_STAT_CAP_MEMCPY,
+    MAGIC_NOP_STAT_STRING,
+    MAGIC_NOP_STAT_MEMMOVE_SLOWPATH,
+    MAGIC_NOP_STAT_TAG_SCAN,
+    MAGIC_NOP_STAT_NUM
+};
+
+struct magic_nop_stats {
+    uint64_t kernel_mode_bytes;
+    uint64_t kernel_mode_count;
+    uint64_t user_mode_bytes;
+    uint64_t user_mode_count;
+};
+
 struct MIPSITUState;
 typedef struct CPUMIPSState CPUMIPSState;
 struct CPUMIPSState {
@@ -1086,6 +1368,9 @@ struct CPUMIPSState {
     uint32_t llnewval_wp;
 #ifdef TARGET_CHERI
     uint64_t linkedflag; // TODO: remove this!
+    /* Capability loaded by CLLC (memory format), compared by CSCC */
+    uint8_t llcap[CHERI_CAP_SIZE];
+    bool llcap_tag;
 #endif
     uint64_t CP0_LLAddr_rw_bitmask;
     int CP0_LLAddr_shift;
@@ -1173,9 +1458,9 @@ struct CPUMIPSState {
     uint32_t hflags;    /* CPU State */
     /* TMASK defines different execution modes */
 #ifdef TARGET_CHERI
-#define MIPS_HFLAG_TMASK  0x2F5807FF
+#define MIPS_HFLAG_TMASK  0xEF5807FF
 #else
-#define MIPS_HFLAG_TMASK  0x1F5807FF
+#define MIPS_HFLAG_TMASK  0xDF5807FF
 #endif /* TARGET_CHERI */
 #define MIPS_HFLAG_MODE   0x00007 /* execution modes                    */
     /*
@@ -1240,6 +1525,14 @@ struct CPUMIPSState {
 #define MIPS_HFLAG_ERL   0x10000000 /* error level flag */
 #ifdef TARGET_CHERI
 #define MIPS_HFLAG_COP2X   0x20000000 /* CHERI/CP2 enabled              */
+#endif /* TARGET_CHERI */
+    /*
+     * Soft TLB slot holding the translations for the current ASID/MMID
+     * (see cpu_mips_update_asid_slot()). It is part of the MMU index.
+     */
+#define MIPS_HFLAG_ASID_SLOT       0xC0000000
+#define MIPS_HFLAG_ASID_SLOT_SHIFT 30
+#ifdef TARGET_CHERI
     // int btcr;                    /* cjr/cjalr Cap register target      */
 #endif /* TARGET_CHERI */
     target_ulong btarget;        /* Jump / branch target               */
@@ -1252,23 +1545,22 @@ struct CPUMIPSState {
     uint64_t insn_flags; /* Supported instruction set */
     int saarp;
 
+    struct magic_nop_stats magic_nop_stats[MAGIC_NOP_STAT_NUM];
+
 
 
 #if defined(TARGET_CHERI)
     /* BERI Statcounters (CHERI only for now): */
-    uint64_t statcounters_icount;
-    uint64_t statcounters_icount_user;
-    uint64_t statcounters_icount_kernel;
-    uint64_t statcounters_itlb_miss;
-    uint64_t statcounters_dtlb_miss;
-    uint64_t statcounters_cap_read;
-    uint64_t statcounters_cap_read_tagged;
-    uint64_t statcounters_cap_write;
-    uint64_t statcounters_cap_write_tagged;
-
-    uint64_t statcounters_imprecise_setbounds;
-    uint64_t statcounters_unrepresentable_caps;
-    /* TODO: we could implement the TLB ones as well */
+    struct mips_statcounters statcounters;
+    /* Values at the last rdhwr_statcounters_reset (see op_helper_beri.c) */
+    struct mips_statcounters statcounters_base;
+    /* Out-of-bounds capability statistics (see op_helper_cheri.c) */
+    struct oob_stats_info oob_stats[OOB_STAT_NUM_OPS];
+
+#ifdef CHERI_128
+    /* Memoized bounds of recently loaded capabilities */
+    struct cheri_decode_cache decode_cache;
+#endif
 
     /*
      * See section 3.9.2 (Table 3.3) of the CHERI Architecture Reference v7.
@@ -1348,6 +1640,7 @@ struct CPUMIPSState {
 #endif // TARGET_CHERI
 
     cvtrace_t cvtrace;
+    struct cvtrace_ring cvtrace_ring;
 #endif /* CONFIG_MIPS_LOG_INSTR */
     target_ulong exception_base; /* ExceptionBase input to the core */
 };
@@ -1382,13 +1675,32 @@ extern uint32_t cpu_rddsp(uint32_t mask_num, CPUMIPSState *env);
  */
 #define MMU_USER_IDX 2
 
+/*
+ * Each of the MIPS_ASID_SLOTS most recently used ASIDs (or MMIDs) gets its
+ * own group of MMU indexes, so that switching between address spaces does
+ * not need to flush the soft TLB. Within a group the MMU index is the
+ * execution mode: the KSU bits or 3 for ERL.
+ */
+#define MIPS_ASID_SLOTS           4
+#define MIPS_MMU_MODES_PER_SLOT   4
+#define MIPS_MMU_IDX_MODE_MASK    (MIPS_MMU_MODES_PER_SLOT - 1)
+
+static inline int mips_mmu_idx_mode(int mmu_idx)
+{
+    return mmu_idx & MIPS_MMU_IDX_MODE_MASK;
+}
+
 static inline int hflags_mmu_index(uint32_t hflags)
 {
+    int slot = (hflags & MIPS_HFLAG_ASID_SLOT) >> MIPS_HFLAG_ASID_SLOT_SHIFT;
+    int mode;
+
     if (hflags & MIPS_HFLAG_ERL) {
-        return 3; /* ERL */
+        mode = 3; /* ERL */
     } else {
-        return hflags & MIPS_HFLAG_KSU;
+        mode = hflags & MIPS_HFLAG_KSU;
     }
+    return slot * MIPS_MMU_MODES_PER_SLOT + mode;
 }
 
 static inline int cpu_mmu_index(CPUMIPSState *env, bool ifetch)
@@ -1399,6 +1711,11 @@ static inline int cpu_mmu_index(CPUMIPSState *env, bool ifetch)
 typedef CPUMIPSState CPUArchState;
 typedef MIPSCPU ArchCPU;
 
+#ifdef TARGET_CHERI
+/* Allows tcg-op.c to inline the DDC checks for legacy loads and stores. */
+#define CHERI_DDC_ENV_OFFSET offsetof(CPUMIPSState, active_tc.CHWR.DDC)
+#endif
+
 #include "exec/cpu-all.h"
 
 /*
@@ -1493,7 +1810,7 @@ target_ulong exception_resume_pc(CPUMIPSState *env);
 void dump_store(CPUMIPSState *env, int opc, target_ulong addr,
     target_ulong value);
 #ifdef TARGET_CHERI
-void dump_changed_capreg(CPUMIPSState *env, cap_register_t *cr,
+void dump_changed_capreg(CPUMIPSState *env, const cap_register_t *cr,
                          cap_register_t *old_reg, const char* name);
 void dump_changed_cop2(CPUMIPSState *env, TCState *cur);
 #endif /* TARGET_CHERI */
@@ -1508,6 +1825,72 @@ static inline void cpu_get_tb_cpu_state(CPUMIPSState *env, target_ulong *pc,
                             MIPS_HFLAG_HWRENA_ULR);
 }
 
+#ifdef TARGET_CHERI
+/* Bits of TranslationBlock.cheri_flags */
+#define TB_FLAG_CHERI_PCC_VALID     (1 << 0) /* PCC tagged, unsealed and executable */
+#define TB_FLAG_CHERI_PCC_FULL_TOP  (1 << 1) /* PCC top is 2^64 (cs_top is 0) */
+#define TB_FLAG_CHERI_LOG_INSTR     (1 << 2) /* Log each instruction */
+
+static inline bool cheri_should_log_instr(CPUMIPSState *env)
+{
+#ifdef CONFIG_MIPS_LOG_INSTR
+    return (qemu_loglevel_mask(CPU_LOG_INSTR_ANY) ||
+            env->user_only_tracing_enabled) &&
+        cheri_trace_filter_allows_asid(env->CP0_EntryHi & 0xff);
+#else
+    return false;
+#endif
+}
+
+/*
+ * In addition to the MIPS state, translated code depends on the PCC bounds
+ * (checked once at translation time instead of before every instruction)
+ * and on whether instructions are being logged.
+ */
+static inline void cpu_get_tb_cpu_state_cheri(CPUMIPSState *env,
+                                              target_ulong *pc,
+                                              target_ulong *cs_base,
+                                              target_ulong *cs_top,
+                                              uint32_t *cheri_flags,
+                                              uint32_t *flags)
+{
+    const cap_register_t *pcc = &env->active_tc.PCC;
+
+    cpu_get_tb_cpu_state(env, pc, cs_base, flags);
+    *cs_base = pcc->cr_base;
+    *cs_top = (target_ulong)pcc->_cr_top;
+    *cheri_flags = 0;
+    if (pcc->cr_tag && pcc->cr_otype >= CAP_OTYPE_UNSEALED &&
+        (pcc->cr_perms & CAP_PERM_EXECUTE)) {
+        *cheri_flags |= TB_FLAG_CHERI_PCC_VALID;
+    }
+    if (pcc->_cr_top > UINT64_MAX) {
+        *cheri_flags |= TB_FLAG_CHERI_PCC_FULL_TOP;
+    }
+    if (cheri_should_log_instr(env)) {
+        *cheri_flags |= TB_FLAG_CHERI_LOG_INSTR;
+    }
+}
+
+/*
+ * The statcounters instruction counts are charged for the whole TB when it
+ * starts (see generate_statcounters_icount_start()). cpu_restore_state()
+ * calls this when a TB with hflags @tb_flags is left early because of an
+ * exception, with the number of instructions that did not complete.
+ */
+static inline void cpu_statcounters_uncount(CPUMIPSState *env,
+                                            uint32_t tb_flags, int num_insns)
+{
+    env->statcounters.icount -= num_insns;
+    if ((tb_flags & MIPS_HFLAG_KSU) == MIPS_HFLAG_UM &&
+        !(tb_flags & MIPS_HFLAG_ERL)) {
+        env->statcounters.icount_user -= num_insns;
+    } else {
+        env->statcounters.icount_kernel -= num_insns;
+    }
+}
+#endif /* TARGET_CHERI */
+
 static inline bool should_use_error_epc(CPUMIPSState *env)
 {
     // If ERL is set, eret and exceptions use ErrorEPC instead of EPC
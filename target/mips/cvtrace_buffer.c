@@ -0,0 +1,207 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/log.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "cpu.h"
+#include "internal.h"
+
+#ifdef CONFIG_MIPS_LOG_INSTR
+
+/*
+ * Writing a CheriVis trace used to take the log lock and call fwrite() once
+ * per instruction. Instead, each vCPU appends its finished records to a
+ * lock-free single-producer ring and a background thread copies them to the
+ * log file in large chunks.
+ *
+ * The trace only contains the encoded instructions; use
+ * scripts/cheri-cvtrace-dump.py to disassemble it offline. With
+ * "-cheri-trace-format cvtrace-compressed" the writer thread also delta
+ * encodes the records (see cvtrace_compress.c).
+ */
+
+#define CVTRACE_RING_SIZE       (1u << 16) /* records, must be a power of 2 */
+#define CVTRACE_WRITER_PERIOD_MS 50
+
+static QemuThread cvtrace_writer_thread;
+static QemuMutex cvtrace_drain_lock; /* serializes consumers of the rings */
+static QemuMutex cvtrace_wakeup_lock;
+static QemuCond cvtrace_wakeup;
+static bool cvtrace_writer_started;
+
+static void cvtrace_write_header(FILE *logfile)
+{
+    char buffer[sizeof(cvtrace_t)] = { 0 };
+
+    if (cvtrace_compress) {
+        cvtrace_compress_start(logfile);
+        return;
+    }
+    buffer[0] = CVT_QEMU_VERSION;
+    g_strlcpy(buffer + 1, CVT_QEMU_MAGIC, sizeof(buffer) - 2);
+    fwrite(buffer, sizeof(buffer), 1, logfile);
+}
+
+/* Must be called with cvtrace_drain_lock held. */
+static void cvtrace_ring_drain(struct cvtrace_ring *ring, FILE *logfile)
+{
+    unsigned head = atomic_load_acquire(&ring->head);
+    unsigned tail = ring->tail;
+
+    while (logfile && tail != head) {
+        unsigned idx = tail & (CVTRACE_RING_SIZE - 1);
+        unsigned n = MIN(head - tail, CVTRACE_RING_SIZE - idx);
+
+        if (cvtrace_compress) {
+            cvtrace_compress_records(logfile, &ring->records[idx], n);
+        } else {
+            fwrite(&ring->records[idx], sizeof(cvtrace_t), n, logfile);
+        }
+        tail += n;
+    }
+    /* Records are dropped if logging has been switched off in the meantime */
+    atomic_store_release(&ring->tail, head);
+}
+
+/*
+ * Write all pending records of all vCPUs to the log file. @end_frame
+ * terminates the current compressed frame, @final is set if the log file
+ * may be closed afterwards and also appends the frame index.
+ */
+static void cvtrace_buffer_drain(bool end_frame, bool final)
+{
+    CPUState *cs;
+    FILE *logfile;
+
+    if (!atomic_read(&cvtrace_writer_started)) {
+        return;
+    }
+
+    qemu_mutex_lock(&cvtrace_drain_lock);
+    logfile = qemu_log_lock();
+    if (logfile && ftell(logfile) == 0) {
+        cvtrace_write_header(logfile);
+    }
+    CPU_FOREACH(cs) {
+        struct cvtrace_ring *ring = &MIPS_CPU(cs)->env.cvtrace_ring;
+        if (atomic_read(&ring->records)) {
+            cvtrace_ring_drain(ring, logfile);
+        }
+    }
+    if (logfile && cvtrace_compress && (end_frame || final)) {
+        cvtrace_compress_finish(logfile, final);
+    }
+    qemu_log_unlock(logfile);
+    qemu_mutex_unlock(&cvtrace_drain_lock);
+}
+
+/*
+ * Called synchronously when tracing is suspended (e.g. on a switch to kernel
+ * mode with user-only tracing). The log file stays open, so this only writes
+ * the pending records and keeps the current frame open.
+ */
+void cvtrace_buffer_flush(void)
+{
+    cvtrace_buffer_drain(false, false);
+}
+
+/*
+ * Called synchronously before tracing is switched off, since the log file
+ * may be closed afterwards.
+ */
+void cvtrace_buffer_finish(void)
+{
+    cvtrace_buffer_drain(true, true);
+}
+
+static void *cvtrace_writer(void *arg)
+{
+    rcu_register_thread();
+    for (;;) {
+        qemu_mutex_lock(&cvtrace_wakeup_lock);
+        qemu_cond_timedwait(&cvtrace_wakeup, &cvtrace_wakeup_lock,
+                            CVTRACE_WRITER_PERIOD_MS);
+        qemu_mutex_unlock(&cvtrace_wakeup_lock);
+        cvtrace_buffer_drain(true, false);
+    }
+    return NULL;
+}
+
+static void cvtrace_flush_at_exit(void)
+{
+    cvtrace_buffer_finish();
+    qemu_log_flush();
+}
+
+static void cvtrace_ring_init(struct cvtrace_ring *ring)
+{
+    qemu_mutex_lock(&cvtrace_drain_lock);
+    if (!cvtrace_writer_started) {
+        qemu_thread_create(&cvtrace_writer_thread, "cvtrace writer",
+                           cvtrace_writer, NULL, QEMU_THREAD_DETACHED);
+        atexit(cvtrace_flush_at_exit);
+        atomic_set(&cvtrace_writer_started, true);
+    }
+    atomic_set(&ring->records, g_new(cvtrace_t, CVTRACE_RING_SIZE));
+    qemu_mutex_unlock(&cvtrace_drain_lock);
+}
+
+/*
+ * Append a finished record to the ring of the current vCPU. This only blocks
+ * if the writer thread cannot keep up and the ring is full.
+ */
+void cvtrace_buffer_push(CPUMIPSState *env, const cvtrace_t *record)
+{
+    struct cvtrace_ring *ring = &env->cvtrace_ring;
+    unsigned head = ring->head;
+
+    if (unlikely(!ring->records)) {
+        cvtrace_ring_init(ring);
+    }
+
+    while (unlikely(head - atomic_load_acquire(&ring->tail) >=
+                    CVTRACE_RING_SIZE)) {
+        qemu_cond_signal(&cvtrace_wakeup);
+        g_usleep(100);
+    }
+    ring->records[head & (CVTRACE_RING_SIZE - 1)] = *record;
+    atomic_store_release(&ring->head, head + 1);
+
+    /* Wake up the writer early once the ring is half full. */
+    if (unlikely(((head + 1) & (CVTRACE_RING_SIZE / 2 - 1)) == 0)) {
+        qemu_cond_signal(&cvtrace_wakeup);
+    }
+}
+
+static void __attribute__((constructor)) cvtrace_buffer_init(void)
+{
+    qemu_mutex_init(&cvtrace_drain_lock);
+    qemu_mutex_init(&cvtrace_wakeup_lock);
+    qemu_cond_init(&cvtrace_wakeup);
+}
+
+#endif /* CONFIG_MIPS_LOG_INSTR */
@@ -0,0 +1,235 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "cpu.h"
+#include "internal.h"
+
+#ifdef CONFIG_MIPS_LOG_INSTR
+
+/*
+ * Compressed CheriVis trace (-cheri-trace-format cvtrace-compressed).
+ *
+ * The file starts with the usual 58 byte header record, but using
+ * CVT_QEMU_MAGIC_COMPRESSED. It is followed by a sequence of chunks, each
+ * with a 12 byte little-endian header:
+ *
+ *   uint32_t magic;        CVTRACE_FRAME_MAGIC or CVTRACE_INDEX_MAGIC
+ *   uint32_t count;        number of records / index entries
+ *   uint32_t size;         size of the payload following the header
+ *
+ * Frame payloads hold delta encoded records. The encoder state is reset at
+ * the start of every frame, so each frame can be decoded on its own. An
+ * index chunk is written whenever tracing is switched off and at exit. It
+ * lists the file offset and the number of the first record of every frame
+ * written so far (two uint64_t each), and ends with the file offset of the
+ * index chunk itself followed by CVTRACE_INDEX_FOOTER. Readers can find the
+ * last index by looking at the end of the file and fall back to walking the
+ * chunk headers if the trace was not terminated cleanly.
+ *
+ * Each record is encoded as:
+ *
+ *   uint8_t flags;         CVTRACE_VALn present, CVTRACE_THREAD_ASID
+ *   uint8_t version;
+ *   uint8_t exception;
+ *   varint cycles;
+ *   varint zigzag(pc - previous pc - 4);
+ *   uint32_t inst;         little-endian
+ *   varint zigzag(valN - previous non-zero valN) for all present valN
+ *   uint8_t thread, asid;  only if they differ from the previous record
+ *
+ * Varints use 7 bits per byte, least significant group first. All
+ * integers are decoded to host values; the byte order of the raw
+ * records is not preserved.
+ */
+
+#define CVTRACE_FRAME_MAGIC     0x46545643U /* "CVTF" */
+#define CVTRACE_INDEX_MAGIC     0x49545643U /* "CVTI" */
+#define CVTRACE_INDEX_FOOTER    "CVTIDX01"
+#define CVTRACE_FRAME_RECORDS   4096
+#define CVTRACE_MAX_RECORD_SIZE (3 + 3 + 10 + 4 + 5 * 10 + 2)
+
+#define CVTRACE_VAL(n)          (1 << (n))
+#define CVTRACE_THREAD_ASID     (1 << 5)
+
+struct cvtrace_index_entry {
+    uint64_t offset;
+    uint64_t first_record;
+};
+
+/* Only accessed by the thread that holds cvtrace_drain_lock. */
+static struct {
+    uint8_t buf[CVTRACE_FRAME_RECORDS * CVTRACE_MAX_RECORD_SIZE];
+    size_t size;
+    unsigned count;
+    uint64_t pc;
+    uint64_t val[5];
+    uint8_t thread;
+    uint8_t asid;
+    uint64_t total_records;
+    GArray *index;
+} cvtrace_frame;
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+static inline uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static void cvtrace_frame_reset(void)
+{
+    memset(cvtrace_frame.val, 0, sizeof(cvtrace_frame.val));
+    cvtrace_frame.size = 0;
+    cvtrace_frame.count = 0;
+    cvtrace_frame.pc = 0;
+    cvtrace_frame.thread = 0;
+    cvtrace_frame.asid = 0;
+}
+
+static void cvtrace_write_chunk_header(FILE *logfile, uint32_t magic,
+                                       uint32_t count, uint32_t size)
+{
+    uint32_t header[3] = { cpu_to_le32(magic), cpu_to_le32(count),
+                           cpu_to_le32(size) };
+
+    fwrite(header, sizeof(header), 1, logfile);
+}
+
+static void cvtrace_frame_write(FILE *logfile)
+{
+    struct cvtrace_index_entry entry;
+
+    if (cvtrace_frame.count == 0) {
+        return;
+    }
+    if (!cvtrace_frame.index) {
+        cvtrace_frame.index = g_array_new(false, false,
+                                          sizeof(struct cvtrace_index_entry));
+    }
+    entry.offset = cpu_to_le64(ftell(logfile));
+    entry.first_record = cpu_to_le64(cvtrace_frame.total_records);
+    g_array_append_val(cvtrace_frame.index, entry);
+
+    cvtrace_write_chunk_header(logfile, CVTRACE_FRAME_MAGIC,
+                               cvtrace_frame.count, cvtrace_frame.size);
+    fwrite(cvtrace_frame.buf, cvtrace_frame.size, 1, logfile);
+    cvtrace_frame.total_records += cvtrace_frame.count;
+    cvtrace_frame_reset();
+}
+
+static void cvtrace_index_write(FILE *logfile)
+{
+    GArray *index = cvtrace_frame.index;
+    uint64_t offset = cpu_to_le64(ftell(logfile));
+
+    cvtrace_write_chunk_header(logfile, CVTRACE_INDEX_MAGIC, index->len,
+                               index->len * sizeof(struct cvtrace_index_entry) +
+                               sizeof(offset) + strlen(CVTRACE_INDEX_FOOTER));
+    fwrite(index->data, sizeof(struct cvtrace_index_entry), index->len,
+           logfile);
+    fwrite(&offset, sizeof(offset), 1, logfile);
+    fwrite(CVTRACE_INDEX_FOOTER, strlen(CVTRACE_INDEX_FOOTER), 1, logfile);
+}
+
+/* Write the file header; called when the log file is empty. */
+void cvtrace_compress_start(FILE *logfile)
+{
+    char buffer[sizeof(cvtrace_t)] = { 0 };
+
+    buffer[0] = CVT_QEMU_VERSION;
+    g_strlcpy(buffer + 1, CVT_QEMU_MAGIC_COMPRESSED, sizeof(buffer) - 2);
+    fwrite(buffer, sizeof(buffer), 1, logfile);
+
+    if (cvtrace_frame.index) {
+        g_array_set_size(cvtrace_frame.index, 0);
+    }
+    cvtrace_frame.total_records = 0;
+    cvtrace_frame_reset();
+}
+
+void cvtrace_compress_records(FILE *logfile, const cvtrace_t *records,
+                              size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        const cvtrace_t *r = &records[i];
+        const uint64_t val[5] = { tswap64(r->val1), tswap64(r->val2),
+                                  tswap64(r->val3), tswap64(r->val4),
+                                  tswap64(r->val5) };
+        uint64_t pc = tswap64(r->pc);
+        uint8_t *start = cvtrace_frame.buf + cvtrace_frame.size;
+        uint8_t *p = start + 1;
+        uint8_t flags = 0;
+
+        *p++ = r->version;
+        *p++ = r->exception;
+        p = put_varint(p, tswap16(r->cycles));
+        p = put_varint(p, zigzag(pc - cvtrace_frame.pc - 4));
+        cvtrace_frame.pc = pc;
+        stl_le_p(p, r->inst);
+        p += 4;
+        for (int n = 0; n < 5; n++) {
+            if (val[n] != 0) {
+                flags |= CVTRACE_VAL(n);
+                p = put_varint(p, zigzag(val[n] - cvtrace_frame.val[n]));
+                cvtrace_frame.val[n] = val[n];
+            }
+        }
+        if (r->thread != cvtrace_frame.thread ||
+            r->asid != cvtrace_frame.asid) {
+            flags |= CVTRACE_THREAD_ASID;
+            *p++ = cvtrace_frame.thread = r->thread;
+            *p++ = cvtrace_frame.asid = r->asid;
+        }
+        *start = flags;
+        cvtrace_frame.size = p - cvtrace_frame.buf;
+
+        if (++cvtrace_frame.count == CVTRACE_FRAME_RECORDS) {
+            cvtrace_frame_write(logfile);
+        }
+    }
+}
+
+/*
+ * Terminate the current frame. If @write_index is set the log file may be
+ * closed afterwards, so also append an index of all frames written so far.
+ */
+void cvtrace_compress_finish(FILE *logfile, bool write_index)
+{
+    cvtrace_frame_write(logfile);
+    if (write_index && cvtrace_frame.index && cvtrace_frame.index->len) {
+        cvtrace_index_write(logfile);
+    }
+}
+
+#endif /* CONFIG_MIPS_LOG_INSTR */
@@ -156,7 +156,7 @@ int mips_gdb_set_sys_reg(CPUMIPSState *env, uint8_t *mem_buf, int n)
 }
 
 #if defined(TARGET_CHERI)
-static int gdb_get_capreg(uint8_t *mem_buf, cap_register_t *cap)
+static int gdb_get_capreg(uint8_t *mem_buf, const cap_register_t *cap)
 {
 #if defined(CHERI_128)
     // If the capability has a valid tag bit we must recompress since the
@@ -184,7 +184,7 @@ static int gdb_get_capreg(uint8_t *mem_buf, cap_register_t *cap)
 int mips_gdb_get_cheri_reg(CPUMIPSState *env, uint8_t *mem_buf, int n)
 {
     if (n < 32)
-        return gdb_get_capreg(mem_buf, &env->active_tc._CGPR[n]);
+        return gdb_get_capreg(mem_buf, get_readonly_capreg(&env->active_tc, n));
     switch (n) {
     case 32:
         return gdb_get_capreg(mem_buf, &env->active_tc.CHWR.DDC);
@@ -216,7 +216,7 @@ int mips_gdb_get_cheri_reg(CPUMIPSState *env, uint8_t *mem_buf, int n)
         if (env->active_tc.CHWR.DDC.cr_tag)
             cap_valid |= 1;
         for (i = 1; i < 32; i++) {
-            if (env->active_tc._CGPR[i].cr_tag)
+            if (get_readonly_capreg(&env->active_tc, i)->cr_tag)
                 cap_valid |= ((uint64_t)1 << i);
         }
         if (env->active_tc.PCC.cr_tag)
@@ -74,13 +74,166 @@ int fixed_mmu_map_address(CPUMIPSState *env, hwaddr *physical, int *prot,
 }
 
 /* MIPS32/MIPS64 R4000-style MMU emulation */
+
+/*
+ * The r4k TLB entries (including the shadow entries above nb_tlb) are
+ * indexed by a hash of their VPN, their page size and their ASID/MMID, so
+ * that a soft TLB miss does not have to scan all of them. Global entries
+ * are hashed with R4K_TLB_KEY_GLOBAL instead of their ASID/MMID.
+ *
+ * Every entry below tlb_in_use that can match is in the index. Entries that
+ * were invalidated with EHINV may still be, so lookups check the full match
+ * condition.
+ */
+#define R4K_TLB_KEY_GLOBAL (UINT64_C(1) << 32)
+
+static inline target_ulong r4k_tlb_mask(uint32_t page_mask)
+{
+    /* 1k pages are not supported. */
+    return page_mask | ~(TARGET_PAGE_MASK << 1);
+}
+
+static inline unsigned r4k_tlb_hash(target_ulong tag, uint32_t page_mask,
+                                    uint64_t key)
+{
+    uint64_t h = ((uint64_t)tag ^ page_mask) * UINT64_C(0x9e3779b97f4a7c15);
+
+    h = (h ^ key) * UINT64_C(0x9e3779b97f4a7c15);
+    return h >> (64 - MIPS_TLB_HASH_BITS);
+}
+
+static inline uint64_t r4k_tlb_key(CPUMIPSState *env, r4k_tlb_t *tlb)
+{
+    bool mi = !!((env->CP0_Config5 >> CP0C5_MI) & 1);
+
+    if (tlb->G) {
+        return R4K_TLB_KEY_GLOBAL;
+    }
+    return mi ? tlb->MMID : (uint32_t) tlb->ASID;
+}
+
+void r4k_tlb_index_insert(CPUMIPSState *env, int idx)
+{
+    CPUMIPSTLBContext *ctx = env->tlb;
+    r4k_tlb_t *tlb = &ctx->mmu.r4k.tlb[idx];
+    target_ulong tag = tlb->VPN & ~r4k_tlb_mask(tlb->PageMask);
+    unsigned bucket, i;
+
+    assert(ctx->tlb_hash_bucket[idx] < 0);
+    if (tlb->EHINV) {
+        return;
+    }
+    bucket = r4k_tlb_hash(tag, tlb->PageMask, r4k_tlb_key(env, tlb));
+    ctx->tlb_hash_next[idx] = ctx->tlb_hash_head[bucket];
+    ctx->tlb_hash_head[bucket] = idx;
+    ctx->tlb_hash_bucket[idx] = bucket;
+
+    for (i = 0; i < ctx->nb_tlb_page_masks; i++) {
+        if (ctx->tlb_page_masks[i] == tlb->PageMask) {
+            break;
+        }
+    }
+    if (i == ctx->nb_tlb_page_masks) {
+        ctx->tlb_page_masks[i] = tlb->PageMask;
+        ctx->tlb_page_mask_refs[i] = 0;
+        ctx->nb_tlb_page_masks++;
+    }
+    ctx->tlb_page_mask_refs[i]++;
+}
+
+void r4k_tlb_index_remove(CPUMIPSState *env, int idx)
+{
+    CPUMIPSTLBContext *ctx = env->tlb;
+    r4k_tlb_t *tlb = &ctx->mmu.r4k.tlb[idx];
+    int16_t *link;
+    unsigned i;
+
+    if (ctx->tlb_hash_bucket[idx] < 0) {
+        return;
+    }
+    link = &ctx->tlb_hash_head[ctx->tlb_hash_bucket[idx]];
+    while (*link != idx) {
+        link = &ctx->tlb_hash_next[*link];
+    }
+    *link = ctx->tlb_hash_next[idx];
+    ctx->tlb_hash_bucket[idx] = -1;
+
+    for (i = 0; ctx->tlb_page_masks[i] != tlb->PageMask; i++) {
+        assert(i + 1 < ctx->nb_tlb_page_masks);
+    }
+    if (--ctx->tlb_page_mask_refs[i] == 0) {
+        ctx->nb_tlb_page_masks--;
+        ctx->tlb_page_masks[i] = ctx->tlb_page_masks[ctx->nb_tlb_page_masks];
+        ctx->tlb_page_mask_refs[i] =
+            ctx->tlb_page_mask_refs[ctx->nb_tlb_page_masks];
+    }
+}
+
+/* Rebuild the index after the TLB contents were replaced wholesale. */
+void r4k_tlb_index_rebuild(CPUMIPSState *env)
+{
+    CPUMIPSTLBContext *ctx = env->tlb;
+    int i;
+
+    memset(ctx->tlb_hash_head, -1, sizeof(ctx->tlb_hash_head));
+    memset(ctx->tlb_hash_bucket, -1, sizeof(ctx->tlb_hash_bucket));
+    ctx->nb_tlb_page_masks = 0;
+    for (i = 0; i < ctx->tlb_in_use; i++) {
+        r4k_tlb_index_insert(env, i);
+    }
+}
+
+static int r4k_tlb_lookup_bucket(CPUMIPSState *env, target_ulong tag,
+                                 uint32_t page_mask, uint64_t key, int best)
+{
+    CPUMIPSTLBContext *ctx = env->tlb;
+    target_ulong mask = r4k_tlb_mask(page_mask);
+    int i;
+
+    for (i = ctx->tlb_hash_head[r4k_tlb_hash(tag, page_mask, key)]; i >= 0;
+         i = ctx->tlb_hash_next[i]) {
+        r4k_tlb_t *tlb = &ctx->mmu.r4k.tlb[i];
+
+        if (tlb->PageMask == page_mask && (tlb->VPN & ~mask) == tag &&
+            r4k_tlb_key(env, tlb) == key && !tlb->EHINV &&
+            (best < 0 || i < best)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+ * Return the lowest index of a TLB entry that matches @address (at that
+ * entry's page size) and is either global or belongs to @mmid, or -1 if
+ * there is none.
+ */
+int r4k_tlb_lookup(CPUMIPSState *env, target_ulong address, uint32_t mmid)
+{
+    CPUMIPSTLBContext *ctx = env->tlb;
+    int best = -1;
+    unsigned i;
+
+    for (i = 0; i < ctx->nb_tlb_page_masks; i++) {
+        uint32_t page_mask = ctx->tlb_page_masks[i];
+        target_ulong tag = address & ~r4k_tlb_mask(page_mask);
+
+#if defined(TARGET_MIPS64)
+        tag &= env->SEGMask;
+#endif
+        best = r4k_tlb_lookup_bucket(env, tag, page_mask, R4K_TLB_KEY_GLOBAL,
+                                     best);
+        best = r4k_tlb_lookup_bucket(env, tag, page_mask, mmid, best);
+    }
+    return best;
+}
+
 int r4k_map_address(CPUMIPSState *env, hwaddr *physical, int *prot,
                     target_ulong address, int rw, int access_type)
 {
     uint16_t ASID = env->CP0_EntryHi & env->CP0_EntryHi_ASID_mask;
     uint32_t MMID = env->CP0_MemoryMapID;
     bool mi = !!((env->CP0_Config5 >> CP0C5_MI) & 1);
-    uint32_t tlb_mmid;
     int i;
 
     MMID = mi ? MMID : (uint32_t) ASID;
@@ -106,81 +259,81 @@ int r4k_map_address(CPUMIPSState *env, hwaddr *physical, int *prot,
     bool gclg = !!(env->CP0_EntryHi & (1UL << gclg_bit));
 #endif
 
-    for (i = 0; i < env->tlb->tlb_in_use; i++) {
+    /* Check ASID/MMID, virtual page number & size */
+    i = r4k_tlb_lookup(env, address, MMID);
+    if (i >= 0) {
+        /* TLB match */
         r4k_tlb_t *tlb = &env->tlb->mmu.r4k.tlb[i];
         /* 1k pages are not supported. */
         target_ulong mask = tlb->PageMask | ~(TARGET_PAGE_MASK << 1);
-        target_ulong tag = address & ~mask;
-        target_ulong VPN = tlb->VPN & ~mask;
-#if defined(TARGET_MIPS64)
-        tag &= env->SEGMask;
-#endif
-
-        /* Check ASID/MMID, virtual page number & size */
-        tlb_mmid = mi ? tlb->MMID : (uint32_t) tlb->ASID;
-        if ((tlb->G == 1 || tlb_mmid == MMID) && VPN == tag && !tlb->EHINV) {
-            /* TLB match */
-            int n = !!(address & mask & ~(mask >> 1));
-            /* Check access rights */
-            if (!(n ? tlb->V1 : tlb->V0)) {
-                return TLBRET_INVALID;
-            }
+        int n = !!(address & mask & ~(mask >> 1));
+        /* Check access rights */
+        if (!(n ? tlb->V1 : tlb->V0)) {
+            return TLBRET_INVALID;
+        }
 #if defined(TARGET_CHERI)
-            if (rw == MMU_DATA_CAP_STORE) {
-                /*
-                 * If we're trying to do a cap-store, first check for the
-                 * dirty/store-permitted bit before looking at the the
-                 * store-capability inhibit.
-                 */
-                if (!(n ? tlb->D1 : tlb->D0)) {
-                    return TLBRET_DIRTY;
-                }
-                if (n ? tlb->S1 : tlb->S0) {
-                    return TLBRET_S;
-                }
+        if (rw == MMU_DATA_CAP_STORE) {
+            /*
+             * If we're trying to do a cap-store, first check for the
+             * dirty/store-permitted bit before looking at the the
+             * store-capability inhibit.
+             */
+            if (!(n ? tlb->D1 : tlb->D0)) {
+                return TLBRET_DIRTY;
             }
-#else
-            if (rw == MMU_INST_FETCH && (n ? tlb->XI1 : tlb->XI0)) {
-                return TLBRET_XI;
-            }
-            if (rw == MMU_DATA_LOAD && (n ? tlb->RI1 : tlb->RI0)) {
-                return TLBRET_RI;
+            if (n ? tlb->S1 : tlb->S0) {
+                return TLBRET_S;
             }
+        }
+#else
+        if (rw == MMU_INST_FETCH && (n ? tlb->XI1 : tlb->XI0)) {
+            return TLBRET_XI;
+        }
+        if (rw == MMU_DATA_LOAD && (n ? tlb->RI1 : tlb->RI0)) {
+            return TLBRET_RI;
+        }
 #endif /* TARGET_CHERI */
 
-            if (( (rw != MMU_DATA_STORE)
+        if (( (rw != MMU_DATA_STORE)
 #if defined(TARGET_CHERI)
-                  && (rw != MMU_DATA_CAP_STORE)
+              && (rw != MMU_DATA_CAP_STORE)
 #endif
-                ) || (n ? tlb->D1 : tlb->D0)) {
+            ) || (n ? tlb->D1 : tlb->D0)) {
 
-                *physical = tlb->PFN[n] | (address & (mask >> 1));
-                *prot = PAGE_READ;
-                if (n ? tlb->D1 : tlb->D0) {
-                    *prot |= PAGE_WRITE;
-                }
+            *physical = tlb->PFN[n] | (address & (mask >> 1));
+            *prot = PAGE_READ;
+            if (n ? tlb->D1 : tlb->D0) {
+                *prot |= PAGE_WRITE;
+            }
 #if !defined(TARGET_CHERI)
-                if (!(n ? tlb->XI1 : tlb->XI0)) {
+            if (!(n ? tlb->XI1 : tlb->XI0)) {
 #else
-                if (true) {
+            if (true) {
 #endif
-                    *prot |= PAGE_EXEC;
-                }
+                *prot |= PAGE_EXEC;
+            }
 
 #if defined(TARGET_CHERI)
-                if (n ? tlb->L1 : tlb->L0) {
-                    *prot |= PAGE_LC_CLEAR;
-                }
-                bool pclg = n ? tlb->CLG1 : tlb->CLG0;
-                if (pclg != gclg) {
-                    *prot |= PAGE_LC_TRAP;
-                }
+            if (n ? tlb->L1 : tlb->L0) {
+                *prot |= PAGE_LC_CLEAR;
+            }
+            bool pclg = n ? tlb->CLG1 : tlb->CLG0;
+            if (pclg != gclg) {
+                *prot |= PAGE_LC_TRAP;
+            }
+            /*
+             * Remember the store-capability inhibit so that tagged
+             * stores through the soft TLB can raise the exception
+             * without another lookup (see cheri_tag_set()).
+             */
+            if (n ? tlb->S1 : tlb->S0) {
+                *prot |= PAGE_SC_TRAP;
+            }
 #endif
 
-                return TLBRET_MATCH;
-            }
-            return TLBRET_DIRTY;
+            return TLBRET_MATCH;
         }
+        return TLBRET_DIRTY;
     }
     return TLBRET_NOMATCH;
 }
@@ -202,7 +355,7 @@ static int is_seg_am_mapped(unsigned int am, bool eu, int mmu_idx)
      */
     int32_t adetlb_mask;
 
-    switch (mmu_idx) {
+    switch (mips_mmu_idx_mode(mmu_idx)) {
     case 3: /* ERL */
         /* If EU is set, always unmapped */
         if (eu) {
@@ -283,8 +436,8 @@ static int get_physical_address(CPUMIPSState *env, hwaddr *physical,
 {
     /* User mode can only access useg/xuseg */
 #if defined(TARGET_MIPS64)
-    int user_mode = mmu_idx == MIPS_HFLAG_UM;
-    int supervisor_mode = mmu_idx == MIPS_HFLAG_SM;
+    int user_mode = mips_mmu_idx_mode(mmu_idx) == MIPS_HFLAG_UM;
+    int supervisor_mode = mips_mmu_idx_mode(mmu_idx) == MIPS_HFLAG_SM;
     int kernel_mode = !user_mode && !supervisor_mode;
     int UX = (env->CP0_Status & (1 << CP0St_UX)) != 0;
     int SX = (env->CP0_Status & (1 << CP0St_SX)) != 0;
@@ -427,7 +580,9 @@ void cpu_mips_tlb_flush(CPUMIPSState *env)
 {
     /* Flush qemu's TLB and discard all shadowed entries.  */
     tlb_flush(env_cpu(env));
-    env->tlb->tlb_in_use = env->tlb->nb_tlb;
+    while (env->tlb->tlb_in_use > env->tlb->nb_tlb) {
+        r4k_tlb_index_remove(env, --env->tlb->tlb_in_use);
+    }
 }
 
 /* Called for updates to CP0_Status.  */
@@ -623,9 +778,9 @@ static void raise_mmu_exception(CPUMIPSState *env, target_ulong address,
     env->error_code = error_code;
 #ifdef TARGET_CHERI
     if (rw == MMU_INST_FETCH)
-        env->statcounters_itlb_miss++;
+        env->statcounters.itlb_miss++;
     else
-        env->statcounters_dtlb_miss++;
+        env->statcounters.dtlb_miss++;
 #endif
 }
 
@@ -1628,27 +1783,128 @@ bool mips_cpu_exec_interrupt(CPUState *cs, int interrupt_request)
 }
 
 #if !defined(CONFIG_USER_ONLY)
+QEMU_BUILD_BUG_ON(MIPS_ASID_SLOTS * MIPS_MMU_MODES_PER_SLOT > NB_MMU_MODES);
+QEMU_BUILD_BUG_ON(MIPS_ASID_SLOTS - 1 >
+                  MIPS_HFLAG_ASID_SLOT >> MIPS_HFLAG_ASID_SLOT_SHIFT);
+
+static inline uint16_t mips_asid_slot_idxmap(int slot)
+{
+    return ((1 << MIPS_MMU_MODES_PER_SLOT) - 1) <<
+           (slot * MIPS_MMU_MODES_PER_SLOT);
+}
+
+/* The address space that r4k_map_address() translates for. */
+static uint64_t mips_asid_slot_key(CPUMIPSState *env)
+{
+    bool mi = !!((env->CP0_Config5 >> CP0C5_MI) & 1);
+    uint64_t key;
+
+    if (mi) {
+        key = (uint32_t)env->CP0_MemoryMapID;
+    } else {
+        key = env->CP0_EntryHi & env->CP0_EntryHi_ASID_mask;
+    }
+#if defined(TARGET_CHERI)
+    /* The global capability load generation bits end up in the page prot. */
+    key |= extract64(env->CP0_EntryHi, CP0EnHi_CLGU, 3) << 32;
+#endif
+    return key;
+}
+
+/*
+ * Called when EntryHi.ASID or MemoryMapID may have changed. The soft TLB
+ * keeps the translations of the MIPS_ASID_SLOTS most recently used address
+ * spaces in separate groups of MMU indexes (see hflags_mmu_index()), so
+ * only the least recently used group is flushed when switching to an
+ * address space that has no slot yet.
+ *
+ * This changes env->hflags, so the caller must end the TB.
+ */
+void cpu_mips_update_asid_slot(CPUMIPSState *env)
+{
+    CPUMIPSTLBContext *ctx = env->tlb;
+    uint64_t key = mips_asid_slot_key(env);
+    int slot = (env->hflags & MIPS_HFLAG_ASID_SLOT) >>
+               MIPS_HFLAG_ASID_SLOT_SHIFT;
+    int i;
+
+    if (ctx->asid_slot_key[slot] == key) {
+        return;
+    }
+
+    /*
+     * Entries shadowed by tlbwr are only invisible to the guest as long as
+     * it does not switch address spaces.
+     */
+    while (ctx->tlb_in_use > ctx->nb_tlb) {
+        r4k_invalidate_tlb(env, --ctx->tlb_in_use, 0);
+        r4k_tlb_index_remove(env, ctx->tlb_in_use);
+    }
+
+    slot = -1;
+    for (i = 0; i < MIPS_ASID_SLOTS; i++) {
+        if ((ctx->asid_slot_valid & (1 << i)) &&
+            ctx->asid_slot_key[i] == key) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        slot = 0;
+        for (i = 1; i < MIPS_ASID_SLOTS; i++) {
+            if (ctx->asid_slot_lru[i] < ctx->asid_slot_lru[slot]) {
+                slot = i;
+            }
+        }
+        tlb_flush_by_mmuidx(env_cpu(env), mips_asid_slot_idxmap(slot));
+        ctx->asid_slot_key[slot] = key;
+        ctx->asid_slot_valid |= 1 << slot;
+    }
+    ctx->asid_slot_lru[slot] = ++ctx->asid_slot_clock;
+    env->hflags = (env->hflags & ~MIPS_HFLAG_ASID_SLOT) |
+                  ((uint32_t)slot << MIPS_HFLAG_ASID_SLOT_SHIFT);
+}
+
+/* Put the current address space in slot 0 and flush all others. */
+void cpu_mips_reset_asid_slots(CPUMIPSState *env)
+{
+    CPUMIPSTLBContext *ctx = env->tlb;
+
+    memset(ctx->asid_slot_lru, 0, sizeof(ctx->asid_slot_lru));
+    ctx->asid_slot_key[0] = mips_asid_slot_key(env);
+    ctx->asid_slot_lru[0] = ctx->asid_slot_clock = 1;
+    ctx->asid_slot_valid = 1;
+    env->hflags &= ~MIPS_HFLAG_ASID_SLOT;
+    tlb_flush(env_cpu(env));
+}
+
 void r4k_invalidate_tlb(CPUMIPSState *env, int idx, int use_extra)
 {
     CPUState *cs = env_cpu(env);
+    CPUMIPSTLBContext *ctx = env->tlb;
     r4k_tlb_t *tlb;
     target_ulong addr;
     target_ulong end;
-    uint16_t ASID = env->CP0_EntryHi & env->CP0_EntryHi_ASID_mask;
-    uint32_t MMID = env->CP0_MemoryMapID;
     bool mi = !!((env->CP0_Config5 >> CP0C5_MI) & 1);
     uint32_t tlb_mmid;
+    uint16_t idxmap = 0;
     target_ulong mask;
+    int i;
 
-    MMID = mi ? MMID : (uint32_t) ASID;
-
-    tlb = &env->tlb->mmu.r4k.tlb[idx];
+    tlb = &ctx->mmu.r4k.tlb[idx];
     /*
-     * The qemu TLB is flushed when the ASID/MMID changes, so no need to
-     * flush these entries again.
+     * Only the soft TLB slots of the entry's address space can hold
+     * translations derived from it; if it has none there is nothing to
+     * flush.
      */
     tlb_mmid = mi ? tlb->MMID : (uint32_t) tlb->ASID;
-    if (tlb->G == 0 && tlb_mmid != MMID) {
+    for (i = 0; i < MIPS_ASID_SLOTS; i++) {
+        if ((ctx->asid_slot_valid & (1 << i)) &&
+            (tlb->G || (uint32_t)ctx->asid_slot_key[i] == tlb_mmid)) {
+            idxmap |= mips_asid_slot_idxmap(i);
+        }
+    }
+    if (idxmap == 0) {
         return;
     }
 
@@ -1659,6 +1915,7 @@ void r4k_invalidate_tlb(CPUMIPSState *env, int idx, int use_extra)
          * tell that it's there.
          */
         env->tlb->mmu.r4k.tlb[env->tlb->tlb_in_use] = *tlb;
+        r4k_tlb_index_insert(env, env->tlb->tlb_in_use);
         env->tlb->tlb_in_use++;
         return;
     }
@@ -1674,7 +1931,7 @@ void r4k_invalidate_tlb(CPUMIPSState *env, int idx, int use_extra)
 #endif
         end = addr | (mask >> 1);
         while (addr < end) {
-            tlb_flush_page(cs, addr);
+            tlb_flush_page_by_mmuidx(cs, addr, idxmap);
             addr += TARGET_PAGE_SIZE;
         }
     }
@@ -1687,7 +1944,7 @@ void r4k_invalidate_tlb(CPUMIPSState *env, int idx, int use_extra)
 #endif
         end = addr | mask;
         while (addr - 1 < end) {
-            tlb_flush_page(cs, addr);
+            tlb_flush_page_by_mmuidx(cs, addr, idxmap);
             addr += TARGET_PAGE_SIZE;
         }
     }
@@ -130,6 +130,9 @@ struct r4k_tlb_t {
     uint64_t PFN[2];
 };
 
+#define MIPS_TLB_HASH_BITS 8
+#define MIPS_TLB_HASH_SIZE (1 << MIPS_TLB_HASH_BITS)
+
 struct CPUMIPSTLBContext {
     uint32_t nb_tlb;
     uint32_t tlb_in_use;
@@ -141,11 +144,30 @@ struct CPUMIPSTLBContext {
     void (*helper_tlbr)(struct CPUMIPSState *env);
     void (*helper_tlbinv)(struct CPUMIPSState *env);
     void (*helper_tlbinvf)(struct CPUMIPSState *env);
+    /*
+     * Address space cached in each group of soft TLB MMU indexes, see
+     * cpu_mips_update_asid_slot().
+     */
+    uint64_t asid_slot_key[MIPS_ASID_SLOTS];
+    uint64_t asid_slot_lru[MIPS_ASID_SLOTS];
+    uint64_t asid_slot_clock;
+    uint8_t asid_slot_valid;
     union {
         struct {
             r4k_tlb_t tlb[MIPS_TLB_MAX];
         } r4k;
     } mmu;
+    /*
+     * Hash index of mmu.r4k.tlb, see r4k_tlb_lookup(). The chains are
+     * linked through tlb_hash_next and end with -1.
+     */
+    int16_t tlb_hash_head[MIPS_TLB_HASH_SIZE];
+    int16_t tlb_hash_next[MIPS_TLB_MAX];
+    int16_t tlb_hash_bucket[MIPS_TLB_MAX]; /* -1 if not in the index */
+    /* The distinct page masks of the indexed entries */
+    uint32_t tlb_page_masks[MIPS_TLB_MAX];
+    uint16_t tlb_page_mask_refs[MIPS_TLB_MAX];
+    uint32_t nb_tlb_page_masks;
 };
 
 int no_mmu_map_address(CPUMIPSState *env, hwaddr *physical, int *prot,
@@ -161,6 +183,12 @@ void r4k_helper_tlbr(CPUMIPSState *env);
 void r4k_helper_tlbinv(CPUMIPSState *env);
 void r4k_helper_tlbinvf(CPUMIPSState *env);
 void r4k_invalidate_tlb(CPUMIPSState *env, int idx, int use_extra);
+int r4k_tlb_lookup(CPUMIPSState *env, target_ulong address, uint32_t mmid);
+void r4k_tlb_index_insert(CPUMIPSState *env, int idx);
+void r4k_tlb_index_remove(CPUMIPSState *env, int idx);
+void r4k_tlb_index_rebuild(CPUMIPSState *env);
+void cpu_mips_update_asid_slot(CPUMIPSState *env);
+void cpu_mips_reset_asid_slots(CPUMIPSState *env);
 
 void mips_cpu_do_transaction_failed(CPUState *cs, hwaddr physaddr,
                                     vaddr addr, unsigned size,
@@ -624,8 +652,20 @@ static inline target_ulong get_CP0_ErrorEPC(CPUMIPSState *env)
 
 void set_CP0_EPC(CPUMIPSState *env, target_ulong value);
 void set_CP0_ErrorEPC(CPUMIPSState *env, target_ulong value);
+/* op_helper.c */
+extern const char *const magic_nop_stat_names[MAGIC_NOP_STAT_NUM];
 #ifdef CONFIG_MIPS_LOG_INSTR
 void r4k_dump_tlb(CPUMIPSState *env, int idx);
+/* cvtrace_buffer.c */
+void cvtrace_buffer_push(CPUMIPSState *env, const cvtrace_t *record);
+void cvtrace_buffer_flush(void);
+void cvtrace_buffer_finish(void);
+/* cvtrace_compress.c */
+extern bool cvtrace_compress; /* -cheri-trace-format cvtrace-compressed */
+void cvtrace_compress_start(FILE *logfile);
+void cvtrace_compress_records(FILE *logfile, const cvtrace_t *records,
+                              size_t count);
+void cvtrace_compress_finish(FILE *logfile, bool write_index);
 #endif
 void do_hexdump(FILE* f, uint8_t* buffer, target_ulong length, target_ulong vaddr);
 hwaddr do_translate_address(CPUMIPSState *env, target_ulong address, int rw,
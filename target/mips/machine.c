@@ -12,6 +12,12 @@ static int cpu_post_load(void *opaque, int version_id)
     restore_msa_fp_status(env);
     compute_hflags(env);
     restore_pamask(env);
+#ifdef CHERI_128
+    /* The decompressed capability registers are only a cache. */
+    reset_capreg_decode_cache(&env->active_tc);
+#endif
+    r4k_tlb_index_rebuild(env);
+    cpu_mips_reset_asid_slots(env);
 
     return 0;
 }
@@ -222,6 +228,97 @@ const VMStateDescription vmstate_tlb = {
     }
 };
 
+#ifdef TARGET_CHERI
+/* CHERI capability state */
+
+static int get_capreg(QEMUFile *f, void *pv, size_t size,
+                      const VMStateField *field)
+{
+    cap_register_t *v = pv;
+    uint64_t top_hi, top_lo;
+
+    v->_cr_cursor = qemu_get_be64(f);
+    v->cr_base = qemu_get_be64(f);
+    top_hi = qemu_get_be64(f);
+    top_lo = qemu_get_be64(f);
+    v->_cr_top = ((cc128_length_t)top_hi << 64) | top_lo;
+    v->cr_perms = qemu_get_be32(f);
+    v->cr_uperms = qemu_get_be32(f);
+    v->cr_otype = qemu_get_be32(f);
+    v->cr_ebt = qemu_get_be32(f);
+    v->cr_flags = qemu_get_byte(f);
+    v->cr_reserved = qemu_get_byte(f);
+    v->cr_tag = qemu_get_byte(f);
+
+    return 0;
+}
+
+static int put_capreg(QEMUFile *f, void *pv, size_t size,
+                      const VMStateField *field, QJSON *vmdesc)
+{
+    cap_register_t *v = pv;
+
+    qemu_put_be64(f, v->_cr_cursor);
+    qemu_put_be64(f, v->cr_base);
+    qemu_put_be64(f, (uint64_t)(v->_cr_top >> 64));
+    qemu_put_be64(f, (uint64_t)v->_cr_top);
+    qemu_put_be32(f, v->cr_perms);
+    qemu_put_be32(f, v->cr_uperms);
+    qemu_put_be32(f, v->cr_otype);
+    qemu_put_be32(f, v->cr_ebt);
+    qemu_put_byte(f, v->cr_flags);
+    qemu_put_byte(f, v->cr_reserved);
+    qemu_put_byte(f, v->cr_tag);
+
+    return 0;
+}
+
+const VMStateInfo vmstate_info_capreg = {
+    .name = "cap_register",
+    .get  = get_capreg,
+    .put  = put_capreg,
+};
+
+#define VMSTATE_CAPREG(_f, _s)                                  \
+    VMSTATE_SINGLE(_f, _s, 0, vmstate_info_capreg, cap_register_t)
+
+#define VMSTATE_CAPREG_ARRAY(_f, _s, _n)                        \
+    VMSTATE_ARRAY(_f, _s, _n, 0, vmstate_info_capreg, cap_register_t)
+
+/*
+ * Only the active TC is saved: the CHERI CPUs don't implement MT, so the
+ * capability state of the inactive TCs is never used.
+ */
+const VMStateDescription vmstate_cheri = {
+    .name = "cpu/cheri",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_CAPREG(env.active_tc.PCC, MIPSCPU),
+        VMSTATE_CAPREG(env.active_tc.CapBranchTarget, MIPSCPU),
+#ifdef CHERI_128
+        VMSTATE_UINTTL_ARRAY(env.active_tc.gpcapregs.cursor, MIPSCPU, 32),
+        VMSTATE_UINTTL_ARRAY(env.active_tc.gpcapregs.pesbt, MIPSCPU, 32),
+        VMSTATE_UINT64(env.active_tc.gpcapregs.capreg_state, MIPSCPU),
+#else
+        VMSTATE_CAPREG_ARRAY(env.active_tc._CGPR, MIPSCPU, 32),
+#endif
+        VMSTATE_CAPREG(env.active_tc.CHWR.DDC, MIPSCPU),
+        VMSTATE_CAPREG(env.active_tc.CHWR.UserTlsCap, MIPSCPU),
+        VMSTATE_CAPREG(env.active_tc.CHWR.PrivTlsCap, MIPSCPU),
+        VMSTATE_CAPREG(env.active_tc.CHWR.KR1C, MIPSCPU),
+        VMSTATE_CAPREG(env.active_tc.CHWR.KR2C, MIPSCPU),
+        VMSTATE_CAPREG(env.active_tc.CHWR.ErrorEPCC, MIPSCPU),
+        VMSTATE_CAPREG(env.active_tc.CHWR.KCC, MIPSCPU),
+        VMSTATE_CAPREG(env.active_tc.CHWR.KDC, MIPSCPU),
+        VMSTATE_CAPREG(env.active_tc.CHWR.EPCC, MIPSCPU),
+        VMSTATE_UINT16(env.CP2_CapCause, MIPSCPU),
+        VMSTATE_UINT64(env.linkedflag, MIPSCPU),
+        VMSTATE_END_OF_LIST()
+    }
+};
+#endif /* TARGET_CHERI */
+
 /* MIPS CPU state */
 
 const VMStateDescription vmstate_mips_cpu = {
@@ -297,7 +394,7 @@ const VMStateDescription vmstate_mips_cpu = {
         VMSTATE_INT32(env.CP0_SRSMap, MIPSCPU),
         VMSTATE_INT32(env.CP0_Cause, MIPSCPU),
 #ifndef TARGET_CHERI
-        // FIXME: would be nice to print for CHERI but needs direct field access
+        /* CHERI keeps EPC in EPCC, see vmstate_cheri */
         VMSTATE_UINTTL(env.CP0_EPC, MIPSCPU),
 #endif
         VMSTATE_INT32(env.CP0_PRid, MIPSCPU),
@@ -324,7 +421,7 @@ const VMStateDescription vmstate_mips_cpu = {
         VMSTATE_INT32(env.CP0_TagHi, MIPSCPU),
         VMSTATE_INT32(env.CP0_DataHi, MIPSCPU),
 #ifndef TARGET_CHERI
-        // FIXME: would be nice to print for CHERI but needs direct field access
+        /* CHERI keeps ErrorEPC in ErrorEPCC, see vmstate_cheri */
         VMSTATE_UINTTL(env.CP0_ErrorEPC, MIPSCPU),
 #endif
         VMSTATE_INT32(env.CP0_DESAVE, MIPSCPU),
@@ -338,4 +435,10 @@ const VMStateDescription vmstate_mips_cpu = {
 
         VMSTATE_END_OF_LIST()
     },
+#ifdef TARGET_CHERI
+    .subsections = (const VMStateDescription*[]) {
+        &vmstate_cheri,
+        NULL
+    }
+#endif
 };
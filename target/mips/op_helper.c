@@ -377,12 +377,18 @@ static inline target_ulong ccheck_store_right(CPUMIPSState *env, target_ulong of
 }
 #endif
 
-static inline void invalidate_tags_store_left_right(CPUMIPSState *env,
-                                                    target_ulong addr,
-                                                    uintptr_t retpc) {
+static inline void store_left_right_begin(CPUMIPSState *env,
+                                          target_ulong addr,
+                                          uintptr_t retpc) {
 #ifdef TARGET_CHERI
     // swr/sdr/swl/sdl will never invalidate more than one capability
-    cheri_tag_invalidate(env, addr, 1, retpc);
+    cheri_tag_store_begin(env, addr, 1, retpc);
+#endif
+}
+
+static inline void store_left_right_end(CPUMIPSState *env) {
+#ifdef TARGET_CHERI
+    cheri_tag_store_end(env);
 #endif
 }
 
@@ -395,6 +401,7 @@ void helper_swl(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
     const int num_bytes = 4 - GET_LMASK(arg2);
     arg2 = check_ddc(env, CAP_PERM_STORE, arg2, num_bytes, GETPC());
 #endif
+    store_left_right_begin(env, arg2, GETPC());
     cpu_stb_mmuidx_ra(env, arg2, (uint8_t)(arg1 >> 24), mem_idx, GETPC());
 
     if (GET_LMASK(arg2) <= 2) {
@@ -411,7 +418,7 @@ void helper_swl(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
         cpu_stb_mmuidx_ra(env, GET_OFFSET(arg2, 3), (uint8_t)arg1,
                           mem_idx, GETPC());
     }
-    invalidate_tags_store_left_right(env, arg2, GETPC());
+    store_left_right_end(env);
 }
 
 void helper_swr(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
@@ -419,6 +426,7 @@ void helper_swr(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
 #ifdef TARGET_CHERI
     arg2 = ccheck_store_right(env, arg2, 4, GETPC());
 #endif
+    store_left_right_begin(env, arg2, GETPC());
     cpu_stb_mmuidx_ra(env, arg2, (uint8_t)arg1, mem_idx, GETPC());
 
     if (GET_LMASK(arg2) >= 1) {
@@ -435,7 +443,7 @@ void helper_swr(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
         cpu_stb_mmuidx_ra(env, GET_OFFSET(arg2, -3), (uint8_t)(arg1 >> 24),
                           mem_idx, GETPC());
     }
-    invalidate_tags_store_left_right(env, arg2, GETPC());
+    store_left_right_end(env);
 }
 
 #if defined(TARGET_MIPS64)
@@ -456,6 +464,7 @@ void helper_sdl(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
     const int num_bytes = 4 - GET_LMASK(arg2);
     arg2 = check_ddc(env, CAP_PERM_STORE, arg2, num_bytes, GETPC());
 #endif
+    store_left_right_begin(env, arg2, GETPC());
     cpu_stb_mmuidx_ra(env, arg2, (uint8_t)(arg1 >> 56), mem_idx, GETPC());
 
     if (GET_LMASK64(arg2) <= 6) {
@@ -492,7 +501,7 @@ void helper_sdl(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
         cpu_stb_mmuidx_ra(env, GET_OFFSET(arg2, 7), (uint8_t)arg1,
                           mem_idx, GETPC());
     }
-    invalidate_tags_store_left_right(env, arg2, GETPC());
+    store_left_right_end(env);
 }
 
 void helper_sdr(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
@@ -501,6 +510,7 @@ void helper_sdr(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
 #ifdef TARGET_CHERI
     arg2 = ccheck_store_right(env, arg2, 8, GETPC());
 #endif
+    store_left_right_begin(env, arg2, GETPC());
     cpu_stb_mmuidx_ra(env, arg2, (uint8_t)arg1, mem_idx, GETPC());
 
     if (GET_LMASK64(arg2) >= 1) {
@@ -537,7 +547,7 @@ void helper_sdr(CPUMIPSState *env, target_ulong arg1, target_ulong arg2,
         cpu_stb_mmuidx_ra(env, GET_OFFSET(arg2, -7), (uint8_t)(arg1 >> 56),
                           mem_idx, GETPC());
     }
-    invalidate_tags_store_left_right(env, arg2, GETPC());
+    store_left_right_end(env);
 }
 #endif /* TARGET_MIPS64 */
 
@@ -678,6 +688,7 @@ static void r4k_mips_tlb_flush_extra(CPUMIPSState *env, int first)
     /* Discard entries from env->tlb[first] onwards.  */
     while (env->tlb->tlb_in_use > first) {
         r4k_invalidate_tlb(env, --env->tlb->tlb_in_use, 0);
+        r4k_tlb_index_remove(env, env->tlb->tlb_in_use);
     }
 }
 
@@ -698,6 +709,7 @@ static void r4k_fill_tlb(CPUMIPSState *env, int idx)
 
     /* XXX: detect conflicting TLBs and raise a MCHECK exception when needed */
     tlb = &env->tlb->mmu.r4k.tlb[idx];
+    r4k_tlb_index_remove(env, idx);
     if (env->CP0_EntryHi & (1 << CP0EnHi_EHINV)) {
         tlb->EHINV = 1;
         return;
@@ -735,6 +747,7 @@ static void r4k_fill_tlb(CPUMIPSState *env, int idx)
     tlb->RI1 = (env->CP0_EntryLo1 >> CP0EnLo_RI) & 1;
 #endif /* TARGET_CHERI */
     tlb->PFN[1] = (get_tlb_pfn_from_entrylo(env->CP0_EntryLo1) & ~mask) << 12;
+    r4k_tlb_index_insert(env, idx);
 }
 
 void r4k_helper_tlbinv(CPUMIPSState *env)
@@ -857,50 +870,20 @@ void r4k_helper_tlbwr(CPUMIPSState *env)
 void r4k_helper_tlbp(CPUMIPSState *env)
 {
     bool mi = !!((env->CP0_Config5 >> CP0C5_MI) & 1);
-    r4k_tlb_t *tlb;
-    target_ulong mask;
-    target_ulong tag;
-    target_ulong VPN;
     uint16_t ASID = env->CP0_EntryHi & env->CP0_EntryHi_ASID_mask;
     uint32_t MMID = env->CP0_MemoryMapID;
-    uint32_t tlb_mmid;
     int i;
 
     MMID = mi ? MMID : (uint32_t) ASID;
-    for (i = 0; i < env->tlb->nb_tlb; i++) {
-        tlb = &env->tlb->mmu.r4k.tlb[i];
-        /* 1k pages are not supported. */
-        mask = tlb->PageMask | ~(TARGET_PAGE_MASK << 1);
-        tag = env->CP0_EntryHi & ~mask;
-        VPN = tlb->VPN & ~mask;
-#if defined(TARGET_MIPS64)
-        tag &= env->SEGMask;
-#endif
-        tlb_mmid = mi ? tlb->MMID : (uint32_t) tlb->ASID;
-        /* Check ASID/MMID, virtual page number & size */
-        if ((tlb->G == 1 || tlb_mmid == MMID) && VPN == tag && !tlb->EHINV) {
-            /* TLB match */
-            env->CP0_Index = i;
-            break;
-        }
-    }
-    if (i == env->tlb->nb_tlb) {
+    /* Check ASID/MMID, virtual page number & size */
+    i = r4k_tlb_lookup(env, env->CP0_EntryHi, MMID);
+    if (i >= 0 && i < env->tlb->nb_tlb) {
+        /* TLB match */
+        env->CP0_Index = i;
+    } else {
         /* No match.  Discard any shadow entries, if any of them match.  */
-        for (i = env->tlb->nb_tlb; i < env->tlb->tlb_in_use; i++) {
-            tlb = &env->tlb->mmu.r4k.tlb[i];
-            /* 1k pages are not supported. */
-            mask = tlb->PageMask | ~(TARGET_PAGE_MASK << 1);
-            tag = env->CP0_EntryHi & ~mask;
-            VPN = tlb->VPN & ~mask;
-#if defined(TARGET_MIPS64)
-            tag &= env->SEGMask;
-#endif
-            tlb_mmid = mi ? tlb->MMID : (uint32_t) tlb->ASID;
-            /* Check ASID/MMID, virtual page number & size */
-            if ((tlb->G == 1 || tlb_mmid == MMID) && VPN == tag) {
-                r4k_mips_tlb_flush_extra(env, i);
-                break;
-            }
+        if (i >= 0) {
+            r4k_mips_tlb_flush_extra(env, i);
         }
 
         env->CP0_Index |= 0x80000000;
@@ -920,22 +903,12 @@ static inline uint64_t get_entrylo_pfn_from_tlb(uint64_t tlb_pfn)
 void r4k_helper_tlbr(CPUMIPSState *env)
 {
     bool mi = !!((env->CP0_Config5 >> CP0C5_MI) & 1);
-    uint16_t ASID = env->CP0_EntryHi & env->CP0_EntryHi_ASID_mask;
-    uint32_t MMID = env->CP0_MemoryMapID;
-    uint32_t tlb_mmid;
     r4k_tlb_t *tlb;
     int idx;
 
-    MMID = mi ? MMID : (uint32_t) ASID;
     idx = (env->CP0_Index & ~0x80000000) % env->tlb->nb_tlb;
     tlb = &env->tlb->mmu.r4k.tlb[idx];
 
-    tlb_mmid = mi ? tlb->MMID : (uint32_t) tlb->ASID;
-    /* If this will change the current ASID/MMID, flush qemu's TLB.  */
-    if (MMID != tlb_mmid) {
-        cpu_mips_tlb_flush(env);
-    }
-
     r4k_mips_tlb_flush_extra(env, env->tlb->nb_tlb);
 
     if (tlb->EHINV) {
@@ -970,6 +943,8 @@ void r4k_helper_tlbr(CPUMIPSState *env)
                         (tlb->C1 << 3) |
                         get_entrylo_pfn_from_tlb(tlb->PFN[1] >> 12);
     }
+    /* This may have changed the current ASID/MMID. */
+    cpu_mips_update_asid_slot(env);
 }
 
 void helper_tlbwi(CPUMIPSState *env)
@@ -1102,7 +1077,7 @@ static void debug_post_eret(CPUMIPSState *env)
         if (env->hflags & MIPS_HFLAG_DM) {
             qemu_log(" DEPC " TARGET_FMT_lx, env->CP0_DEPC);
         }
-        switch (cpu_mmu_index(env, false)) {
+        switch (mips_mmu_idx_mode(cpu_mmu_index(env, false))) {
         case 3:
             qemu_log(", ERL\n");
             break;
@@ -1776,6 +1751,18 @@ static inline target_ulong adj_len_to_page(target_ulong len, target_ulong addr)
 #define MIPS_REGNUM_A2 6
 #define MIPS_REGNUM_A3 7
 
+const char *const magic_nop_stat_names[MAGIC_NOP_STAT_NUM] = {
+    [MAGIC_NOP_STAT_MEMSET_ZERO] = "memset (zero)",
+    [MAGIC_NOP_STAT_MEMSET_NONZERO] = "memset (nonzero)",
+    [MAGIC_NOP_STAT_MEMCPY] = "memcpy",
+    [MAGIC_NOP_STAT_MEMMOVE] = "memmove",
+    [MAGIC_NOP_STAT_BCOPY] = "bcopy",
+    [MAGIC_NOP_STAT_CAP_MEMCPY] = "tag-preserving memcpy",
+    [MAGIC_NOP_STAT_STRING] = "strlen/strnlen/strcmp/memcmp",
+    [MAGIC_NOP_STAT_MEMMOVE_SLOWPATH] = "memmove/memcpy/bcopy slowpath",
+    [MAGIC_NOP_STAT_TAG_SCAN] = "tag scan",
+};
+
 #ifdef CONFIG_DEBUG_TCG
 #define MAGIC_MEMSET_STATS 1
 #else
@@ -1785,44 +1772,44 @@ static inline target_ulong adj_len_to_page(target_ulong len, target_ulong addr)
 #if MAGIC_MEMSET_STATS != 0
 static bool memset_stats_dump_registered = false;
 
-struct nop_stats {
-    uint64_t kernel_mode_bytes;
-    uint64_t kernel_mode_count;
-    uint64_t user_mode_bytes;
-    uint64_t user_mode_count;
-};
-
-static struct nop_stats magic_memset_zero_bytes;
-static struct nop_stats magic_memset_nonzero_bytes;
-
-static struct nop_stats magic_memcpy_bytes;
-static struct nop_stats magic_memmove_bytes;
-static struct nop_stats magic_bcopy_bytes;
-
-static struct nop_stats magic_memmove_slowpath;
-
-static inline void print_nop_stats(const char* msg, struct nop_stats* stats) {
-    warn_report("%s in kernel mode: %" PRId64 " (%f MB) in %" PRId64 " calls\r", msg,
+static inline void print_nop_stats(const char* msg, const struct magic_nop_stats* stats) {
+    warn_report("%s with magic nop in kernel mode: %" PRId64 " (%f MB) in %" PRId64 " calls\r", msg,
                 stats->kernel_mode_bytes, stats->kernel_mode_bytes / (1024.0 * 1024.0), stats->kernel_mode_count);
-    warn_report("%s in user   mode: %" PRId64 " (%f MB) in %" PRId64 " calls\r", msg,
+    warn_report("%s with magic nop in user   mode: %" PRId64 " (%f MB) in %" PRId64 " calls\r", msg,
                 stats->user_mode_bytes, stats->user_mode_bytes / (1024.0 * 1024.0), stats->user_mode_count);
 }
 
 static void dump_memset_stats_on_exit(void) {
-    print_nop_stats("memset (zero)    with magic nop", &magic_memset_zero_bytes);
-    print_nop_stats("memset (nonzero) with magic nop", &magic_memset_nonzero_bytes);
-    print_nop_stats("memcpy with magic nop", &magic_memcpy_bytes);
-    print_nop_stats("memmove with magic nop", &magic_memmove_bytes);
-    print_nop_stats("bcopy with magic nop", &magic_bcopy_bytes);
-    print_nop_stats("memmove/memcpy/bcopy slowpath", &magic_memmove_slowpath);
+    for (int i = 0; i < MAGIC_NOP_STAT_NUM; i++) {
+        struct magic_nop_stats sum = { 0 };
+        CPUState *cpu;
+
+        CPU_FOREACH(cpu) {
+            const struct magic_nop_stats *stats =
+                &MIPS_CPU(cpu)->env.magic_nop_stats[i];
+            sum.kernel_mode_bytes += stats->kernel_mode_bytes;
+            sum.kernel_mode_count += stats->kernel_mode_count;
+            sum.user_mode_bytes += stats->user_mode_bytes;
+            sum.user_mode_count += stats->user_mode_count;
+        }
+        print_nop_stats(magic_nop_stat_names[i], &sum);
+    }
 }
+#endif
 
-static inline void collect_magic_nop_stats(CPUMIPSState *env, struct nop_stats* stats, target_ulong bytes) {
-    if (!memset_stats_dump_registered) {
+/*
+ * The per-vCPU counts are always collected (they can be queried with
+ * query-cheri-stats), but are only printed on exit in debug builds.
+ */
+static inline void collect_magic_nop_stats(CPUMIPSState *env, enum magic_nop_stat stat, target_ulong bytes) {
+    struct magic_nop_stats *stats = &env->magic_nop_stats[stat];
+#if MAGIC_MEMSET_STATS != 0
+    if (!atomic_read(&memset_stats_dump_registered) &&
+        !atomic_xchg(&memset_stats_dump_registered, true)) {
         // TODO: move this to CPU_init
         atexit(dump_memset_stats_on_exit);
-        memset_stats_dump_registered = true;
     }
+#endif
     if (in_kernel_mode(env)) {
         stats->kernel_mode_bytes += bytes;
         stats->kernel_mode_count++;
@@ -1831,20 +1818,19 @@ static inline void collect_magic_nop_stats(CPUMIPSState *env, struct nop_stats*
         stats->user_mode_count++;
     }
 }
-#else
-#define collect_magic_nop_stats(env, stats, bytes)
-#endif
 
 
 static inline void
 store_byte_and_clear_tag(CPUMIPSState *env, target_ulong vaddr, uint8_t val,
                          TCGMemOpIdx oi, uintptr_t retaddr)
 {
+#ifdef TARGET_CHERI
+    // Invalidate the tag bit to ensure we are consistent with sb
+    cheri_tag_store_begin(env, vaddr, 1, retaddr);
+#endif
     helper_ret_stb_mmu(env, vaddr, val, oi, retaddr);
 #ifdef TARGET_CHERI
-    // If we returned (i.e. write was successful) we also need to invalidate the
-    // tags bit to ensure we are consistent with sb
-    cheri_tag_invalidate(env, vaddr, 1, retaddr);
+    cheri_tag_store_end(env);
 #endif
 }
 
@@ -1852,11 +1838,13 @@ static inline void
 store_u32_and_clear_tag(CPUMIPSState *env, target_ulong vaddr, uint32_t val,
                          TCGMemOpIdx oi, uintptr_t retaddr)
 {
+#ifdef TARGET_CHERI
+    // Invalidate the tag bit to ensure we are consistent with sw
+    cheri_tag_store_begin(env, vaddr, 4, retaddr);
+#endif
     helper_ret_stw_mmu(env, vaddr, val, oi, retaddr);
 #ifdef TARGET_CHERI
-    // If we returned (i.e. write was successful) we also need to invalidate the
-    // tags bit to ensure we are consistent with sb
-    cheri_tag_invalidate(env, vaddr, 4, retaddr);
+    cheri_tag_store_end(env);
 #endif
 }
 
@@ -1866,6 +1854,55 @@ store_u32_and_clear_tag(CPUMIPSState *env, target_ulong vaddr, uint32_t val,
 #define CHECK_AND_ADD_DDC(env, perms, ptr, len, retpc) ptr
 #endif
 
+/*
+ * Return a host pointer for @len bytes at @vaddr (which must not cross a page
+ * boundary) or NULL if the access has to go through the slow path (I/O).
+ * This takes the TLB fault if the page is not mapped and marks clean RAM
+ * pages as dirty (invalidating any TBs on the page) for stores.
+ */
+static inline void *magic_probe_host(CPUMIPSState *env, target_ulong vaddr,
+                                     target_ulong len, MMUAccessType access_type,
+                                     int mmu_idx, uintptr_t ra)
+{
+#ifdef CONFIG_USER_ONLY
+    return NULL; // adj_len_to_page() does not split at page boundaries
+#else
+    return probe_access(env, vaddr, len, access_type, mmu_idx, ra);
+#endif
+}
+
+/*
+ * Update the state that a series of stores to @len bytes at @vaddr would
+ * change before they are written directly to @hostaddr. This must be followed
+ * by magic_host_store_end() once the data has been written (capability stores
+ * from other vCPUs to the range are held off until then).
+ */
+static inline void magic_host_store_begin(CPUMIPSState *env, void *hostaddr,
+                                          target_ulong vaddr, target_ulong len,
+                                          uintptr_t ra)
+{
+#ifdef TARGET_CHERI
+    // qemu_ram_addr_from_host is faster than using the v2r routines in cheri_tag_invalidate
+    ram_addr_t ram_addr = qemu_ram_addr_from_host(hostaddr);
+    if (ram_addr != RAM_ADDR_INVALID) {
+        /* This also resets the linked flag if the range covers LLAddr. */
+        cheri_tag_phys_store_begin(env, ram_addr, len);
+    } else {
+        cheri_tag_invalidate(env, vaddr, len, ra);
+    }
+#endif
+}
+
+static inline void magic_host_store_end(CPUMIPSState *env, void *hostaddr)
+{
+#ifdef TARGET_CHERI
+    ram_addr_t ram_addr = qemu_ram_addr_from_host(hostaddr);
+    if (ram_addr != RAM_ADDR_INVALID) {
+        cheri_tag_phys_store_end(env, ram_addr);
+    }
+#endif
+}
+
 static bool do_magic_memmove(CPUMIPSState *env, uint64_t ra, int dest_regnum, int src_regnum)
 {
     tcg_debug_assert(dest_regnum != src_regnum);
@@ -1915,114 +1952,53 @@ static bool do_magic_memmove(CPUMIPSState *env, uint64_t ra, int dest_regnum, in
 
     const target_ulong dest_past_end = original_dest + original_len;
     const target_ulong src_past_end = original_src + original_len;
-#if 0 // FIXME: for some reason this causes errors
-    const bool log_instr = qemu_loglevel_mask(CPU_LOG_INSTR | CPU_LOG_CVTRACE);
-    const bool dest_same_page = (original_dest & TARGET_PAGE_MASK) == ((dest_past_end - 1) & TARGET_PAGE_MASK);
-    const bool src_same_page = (original_dest & TARGET_PAGE_MASK) == ((dest_past_end - 1) & TARGET_PAGE_MASK);
-    // If neither src nor dest buffer cross a page boundary we can just do an address_space_read+write
-    // Fast case: less than a page and neither of the buffers crosses a page boundary
-    CPUState *cs = env_cpu(env);
-    if (dest_same_page && src_same_page) {
-        tcg_debug_assert(already_written == 0);
-        tcg_debug_assert(len <= TARGET_PAGE_SIZE);
-        // The translation operation might trap and longjump out!
-        hwaddr src_paddr = do_translate_address(env, original_src, MMU_DATA_LOAD, ra);
-        hwaddr dest_paddr = do_translate_address(env, original_dest, MMU_DATA_STORE, ra);
-#ifdef TARGET_CHERI
-        if (dest_paddr <= env->CP0_LLAddr && dest_paddr + len > env->CP0_LLAddr) {
-            // reset the linked flag if we touch the address with this write
-            env->linkedflag = 0;
-            env->lladdr = 0;
-        }
-#endif
-        // Do a single load+store to update the MMU flags
-        // uint8_t first_value = helper_ret_ldub_mmu(env, original_src, oi, ra);
-        // Note: address_space_write will also clear the tag bits!
-        MemTxResult result = MEMTX_ERROR;
-        uint8_t buffer[TARGET_PAGE_SIZE];
-        result = address_space_read(cs->as, src_paddr, MEMTXATTRS_UNSPECIFIED, buffer, len);
-        if (result != MEMTX_OK) {
-            warn_report("magic memmove: error reading %d bytes from paddr %"HWADDR_PRIx
-                        ". Unmapped memory? Error code was %d\r", (int)len, src_paddr, result);
-            // same ignored error would happen with normal loads/stores -> just continue
-        }
-        fprintf(stderr, "Used fast path to read %d bytes\r\n", (int)len);
-        // do_hexdump(stderr, buffer, len, original_src);
-        // fprintf(stderr, "\r");
-        // also write one byte to the target buffer to ensure that the flags are updated
-        // store_byte_and_clear_tag(env, original_dest, first_value, oi, ra); // might trap
-        result = address_space_write(cs->as, dest_paddr, MEMTXATTRS_UNSPECIFIED, buffer, len);
-        if (unlikely(log_instr)) {
-            for (int i = 0; i < len; i++) {
-                helper_dump_load(env, original_src + i, buffer[i], MO_8);
-                helper_dump_store(env, original_dest + i, buffer[i], MO_8);
-            }
-        }
-        if (result != MEMTX_OK) {
-            warn_report("magic memmove: error writing %d bytes to paddr %"HWADDR_PRIx
-                        ". Unmapped memory? Error code was %d\r", (int)len, dest_paddr, result);
-            // same ignored error would happen with normal loads/stores -> just continue
-        }
-        already_written += len;
-        env->active_tc.gpr[MIPS_REGNUM_V0] = already_written;
-        goto success;
-    }
-#endif
-
     const bool has_overlap = MAX(original_dest, original_src) >= MAX(dest_past_end, src_past_end);
     if (has_overlap) {
         warn_report("Found multipage magic memmove with overlap: dst=" TARGET_FMT_plx " src=" TARGET_FMT_plx
                     " len=0x" TARGET_FMT_lx "\r", original_dest, original_src, original_len);
-        // slow path: byte copies
     }
 
+    // Copy page by page (starting at the end if dest is above src so that
+    // overlapping moves work). $v0 always holds the number of bytes copied so
+    // far, which is where the continuation resumes if a probe or store traps.
     const bool copy_backwards = original_src < original_dest;
-    if (copy_backwards) {
-        target_ulong current_dest_cursor = original_dest + len - 1;
-        target_ulong current_src_cursor = original_src + len - 1;
-        /* Slow path (probably attempt to do this to an I/O device or
-         * similar, or clearing of a block of code we have translations
-         * cached for). Just do a series of byte writes as the architecture
-         * demands. It's not worth trying to use a cpu_physical_memory_map(),
-         * memset(), unmap() sequence here because:
-         *  + we'd need to account for the blocksize being larger than a page
-         *  + the direct-RAM access case is almost always going to be dealt
-         *    with in the fastpath code above, so there's no speed benefit
-         *  + we would have to deal with the map returning NULL because the
-         *    bounce buffer was in use
-         */
-        tcg_debug_assert(original_len - already_written == len);
-        collect_magic_nop_stats(env, &magic_memmove_slowpath, len);
-        while (already_written < original_len) {
-            uint8_t value = helper_ret_ldub_mmu(env, current_src_cursor, oi, ra);
-            store_byte_and_clear_tag(env, current_dest_cursor, value, oi, ra); // might trap
-             current_dest_cursor--;
-            current_src_cursor--;
-            already_written++;
+    while (already_written < original_len) {
+        const target_ulong remaining = original_len - already_written;
+        target_ulong src, dest, chunk;
+        if (copy_backwards) {
+            const target_ulong src_end = original_src + remaining;
+            const target_ulong dest_end = original_dest + remaining;
+            chunk = MIN(remaining, MIN(((src_end - 1) & ~TARGET_PAGE_MASK) + 1,
+                                       ((dest_end - 1) & ~TARGET_PAGE_MASK) + 1));
+            src = src_end - chunk;
+            dest = dest_end - chunk;
+        } else {
+            src = original_src + already_written;
+            dest = original_dest + already_written;
+            chunk = MIN(remaining, MIN(TARGET_PAGE_SIZE - (src & ~TARGET_PAGE_MASK),
+                                       TARGET_PAGE_SIZE - (dest & ~TARGET_PAGE_MASK)));
+        }
+        void *src_host = magic_probe_host(env, src, chunk, MMU_DATA_LOAD, mmu_idx, ra);
+        void *dest_host = magic_probe_host(env, dest, chunk, MMU_DATA_STORE, mmu_idx, ra);
+        if (likely(src_host && dest_host)) {
+            magic_host_store_begin(env, dest_host, dest, chunk, ra);
+            memmove(dest_host, src_host, chunk);
+            magic_host_store_end(env, dest_host);
+            qemu_log_mask(CPU_LOG_INSTR, "%s: Copied " TARGET_FMT_ld " bytes from 0x"
+                          TARGET_FMT_plx " to 0x" TARGET_FMT_plx "\n", __func__, chunk, src, dest);
+            already_written += chunk;
             env->active_tc.gpr[MIPS_REGNUM_V0] = already_written;
+            continue;
         }
-    } else {
-        // copy forwards
-        target_ulong current_dest_cursor = original_dest + already_written;
-        target_ulong current_src_cursor = original_src + already_written;
-        /* Slow path (probably attempt to do this to an I/O device or
-         * similar, or clearing of a block of code we have translations
-         * cached for). Just do a series of byte writes as the architecture
-         * demands. It's not worth trying to use a cpu_physical_memory_map(),
-         * memset(), unmap() sequence here because:
-         *  + we'd need to account for the blocksize being larger than a page
-         *  + the direct-RAM access case is almost always going to be dealt
-         *    with in the fastpath code above, so there's no speed benefit
-         *  + we would have to deal with the map returning NULL because the
-         *    bounce buffer was in use
+        /*
+         * Slow path: I/O memory, watchpoints, etc. Just do a series of byte
+         * loads and stores as the architecture demands.
          */
-        tcg_debug_assert(original_len - already_written == len);
-        collect_magic_nop_stats(env, &magic_memmove_slowpath, len);
-        while (already_written < original_len) {
-            uint8_t value = helper_ret_ldub_mmu(env, current_src_cursor, oi, ra);
-            store_byte_and_clear_tag(env, current_dest_cursor, value, oi, ra); // might trap
-            current_dest_cursor++;
-            current_src_cursor++;
+        collect_magic_nop_stats(env, MAGIC_NOP_STAT_MEMMOVE_SLOWPATH, chunk);
+        for (target_ulong i = 0; i < chunk; i++) {
+            target_ulong offset = copy_backwards ? chunk - 1 - i : i;
+            uint8_t value = helper_ret_ldub_mmu(env, src + offset, oi, ra);
+            store_byte_and_clear_tag(env, dest + offset, value, oi, ra); // might trap
             already_written++;
             env->active_tc.gpr[MIPS_REGNUM_V0] = already_written;
         }
@@ -2044,6 +2020,130 @@ success:
     return true;
 }
 
+#if defined(TARGET_CHERI) && !defined(CONFIG_USER_ONLY)
+/*
+ * Like do_magic_memmove() for memcpy(), but also copy the tags of all
+ * capabilities in the buffer. Returns false if the guest has to fall back to
+ * its CLC/CSC loop instead: overlapping buffers, a $ddc that does not allow
+ * loading and storing capabilities, or pages that can't use the host fast
+ * path (see cheri_tag_copy_host()). Source and destination are unchanged in
+ * all of these cases so it doesn't matter if we have copied a part already.
+ */
+static bool do_magic_cap_memcpy(CPUMIPSState *env, uint64_t ra)
+{
+    const target_ulong original_dest_ddc_offset = env->active_tc.gpr[MIPS_REGNUM_A0]; // $a0 = dest
+    const target_ulong original_src_ddc_offset = env->active_tc.gpr[MIPS_REGNUM_A1];  // $a1 = src
+    const target_ulong original_len = env->active_tc.gpr[MIPS_REGNUM_A2];  // $a2 = len
+    const uint32_t cap_perms = CAP_PERM_LOAD_CAP | CAP_PERM_STORE_CAP | CAP_PERM_STORE_LOCAL;
+    target_ulong already_written = 0;
+    const bool is_continuation = (env->active_tc.gpr[MIPS_REGNUM_V1] >> 32) == MAGIC_LIBCALL_HELPER_CONTINUATION_FLAG;
+    if (is_continuation) {
+        // The number of bytes already copied was stored in $v0 by the previous call
+        already_written = env->active_tc.gpr[MIPS_REGNUM_V0];
+        tcg_debug_assert(already_written < original_len);
+    } else if (env->active_tc.gpr[MIPS_REGNUM_V0] != 0) {
+        error_report("ERROR: Attempted to call memcpy library function "
+                     "with non-zero value in $v0 (0x" TARGET_FMT_lx
+                     ") and continuation flag not set in $v1 (0x" TARGET_FMT_lx
+                     ")!\n", env->active_tc.gpr[MIPS_REGNUM_V0], env->active_tc.gpr[MIPS_REGNUM_V1]);
+        do_raise_exception(env, EXCP_RI, ra);
+    }
+    if (original_len == 0 || original_src_ddc_offset == original_dest_ddc_offset) {
+        goto success; // nothing to do
+    }
+    // Check capability bounds for the whole copy
+    const target_ulong original_src = CHECK_AND_ADD_DDC(env, CAP_PERM_LOAD, original_src_ddc_offset, original_len, ra);
+    const target_ulong original_dest = CHECK_AND_ADD_DDC(env, CAP_PERM_STORE, original_dest_ddc_offset, original_len, ra);
+    if ((cheri_get_ddc(env)->cr_perms & cap_perms) != cap_perms) {
+        return false;
+    }
+    if (original_src < original_dest + original_len && original_dest < original_src + original_len) {
+        return false;
+    }
+
+    // Mark this as a continuation in $v1 (so that we continue sensibly if we get a tlb miss and longjump out)
+    env->active_tc.gpr[MIPS_REGNUM_V1] = (MAGIC_LIBCALL_HELPER_CONTINUATION_FLAG << 32) | env->active_tc.gpr[MIPS_REGNUM_V1];
+    while (already_written < original_len) {
+        const target_ulong src = original_src + already_written;
+        const target_ulong dest = original_dest + already_written;
+        const target_ulong chunk = MIN(original_len - already_written,
+                                       MIN(TARGET_PAGE_SIZE - (src & ~TARGET_PAGE_MASK),
+                                           TARGET_PAGE_SIZE - (dest & ~TARGET_PAGE_MASK)));
+        /*
+         * cheri_tag_copy_host() accesses the pages without any checks and
+         * check_ddc() only takes a 32-bit length, so check every chunk too.
+         */
+        check_cap(env, cheri_get_ddc(env), CAP_PERM_LOAD, src,
+                  CHERI_EXC_REGNUM_DDC, chunk, /*instavail=*/true, ra);
+        check_cap(env, cheri_get_ddc(env), CAP_PERM_STORE, dest,
+                  CHERI_EXC_REGNUM_DDC, chunk, /*instavail=*/true, ra);
+        if (!cheri_tag_copy_host(env, dest, src, chunk, ra)) {
+            return false;
+        }
+        already_written += chunk;
+        env->active_tc.gpr[MIPS_REGNUM_V0] = already_written;
+    }
+success:
+    env->active_tc.gpr[MIPS_REGNUM_V0] = original_dest_ddc_offset; // return value of memcpy is the dest argument
+    return true;
+}
+
+/*
+ * Find the first tagged capability in [$a0, $a0 + $a1) for revocation
+ * sweeps, scanning the tag memory a host word at a time instead of doing a
+ * CLoadTags per line. Returns its offset from $a0 in $v0, or $a1 if there is
+ * none. The number of bytes scanned so far is kept in $v0 using the same
+ * continuation protocol as memset/memmove, so TLB faults don't restart the
+ * whole scan.
+ *
+ * Returns false (and the guest should fall back to CLoadTags) if the range
+ * is not capability aligned or $ddc doesn't allow loading capabilities.
+ */
+static bool do_magic_find_tagged(CPUMIPSState *env, uint64_t ra)
+{
+    const target_ulong start_ddc_offset = env->active_tc.gpr[MIPS_REGNUM_A0]; // $a0 = start
+    const target_ulong len = env->active_tc.gpr[MIPS_REGNUM_A1];  // $a1 = len
+    target_ulong done = 0;
+    const bool is_continuation = (env->active_tc.gpr[MIPS_REGNUM_V1] >> 32) == MAGIC_LIBCALL_HELPER_CONTINUATION_FLAG;
+    if (is_continuation) {
+        // The number of bytes already scanned was stored in $v0 by the previous call
+        done = env->active_tc.gpr[MIPS_REGNUM_V0];
+        tcg_debug_assert(done < len);
+    } else if (env->active_tc.gpr[MIPS_REGNUM_V0] != 0) {
+        error_report("ERROR: Attempted to call tag scan library function "
+                     "with non-zero value in $v0 (0x" TARGET_FMT_lx
+                     ") and continuation flag not set in $v1 (0x" TARGET_FMT_lx
+                     ")!\n", env->active_tc.gpr[MIPS_REGNUM_V0], env->active_tc.gpr[MIPS_REGNUM_V1]);
+        do_raise_exception(env, EXCP_RI, ra);
+    }
+    if (len == 0) {
+        goto success;
+    }
+    const target_ulong start = CHECK_AND_ADD_DDC(env, CAP_PERM_LOAD, start_ddc_offset, len, ra);
+    if (((start | len) & (CHERI_CAP_SIZE - 1)) != 0 ||
+        !(cheri_get_ddc(env)->cr_perms & CAP_PERM_LOAD_CAP)) {
+        return false;
+    }
+
+    // Mark this as a continuation in $v1 (so that we continue sensibly if we get a tlb miss and longjump out)
+    env->active_tc.gpr[MIPS_REGNUM_V1] = (MAGIC_LIBCALL_HELPER_CONTINUATION_FLAG << 32) | env->active_tc.gpr[MIPS_REGNUM_V1];
+    while (done < len) {
+        const target_ulong addr = start + done;
+        const target_ulong chunk = MIN(len - done, TARGET_PAGE_SIZE - (addr & ~TARGET_PAGE_MASK));
+        const target_ulong found = cheri_tag_find_next(env, addr, chunk, ra);
+        if (found < chunk) {
+            done += found;
+            break;
+        }
+        done += chunk;
+        env->active_tc.gpr[MIPS_REGNUM_V0] = done;
+    }
+success:
+    env->active_tc.gpr[MIPS_REGNUM_V0] = done;
+    return true;
+}
+#endif /* TARGET_CHERI && !CONFIG_USER_ONLY */
+
 static uint8_t ZEROARRAY[TARGET_PAGE_SIZE];
 
 static void do_memset_pattern_hostaddr(void* hostaddr, uint64_t value, uint64_t nitems, unsigned pattern_length, uint64_t ra) {
@@ -2137,42 +2237,17 @@ static bool do_magic_memset(CPUMIPSState *env, uint64_t ra, uint pattern_length)
         }
         tcg_debug_assert(l_adj_nitems != 0);
         tcg_debug_assert(((dest + l_adj_bytes - 1) & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK) && "should not cross a page boundary!");
-        void* hostaddr = NULL;
-#if 0
-        for (int try = 0; try < 2; try++) {
-            hostaddr = tlb_vaddr_to_host(env, dest, 1, mmu_idx);
-            if (hostaddr)
-                break;
-            /* OK, try a store and see if we can populate the tlb. This
-             * might cause an exception if the memory isn't writable,
-             * in which case we will longjmp out of here. We must for
-             * this purpose use the actual register value passed to us
-             * so that we get the fault address right.
-             */
-            store_byte_and_clear_tag(env, dest, 0xff, oi, ra);
-            // This should definitely fill the host TLB. If not we are probably writing to I/O memory
-            // FIXME: tlb_vaddr_to_host() also returns null if the notdirty flag is set (not sure if that's a bug
-            probe_write(env, dest, 1, mmu_idx, ra);
-        }
-#endif
+        // This might trap (and longjump out) but $v0/$v1 are already set up
+        void *hostaddr = magic_probe_host(env, dest, l_adj_bytes, MMU_DATA_STORE, mmu_idx, ra);
         if (hostaddr) {
             /* If it's all in the TLB it's fair game for just writing to;
-             * we know we don't need to update dirty status, etc.
+             * probe_access() has already updated the dirty status, etc.
              */
             tcg_debug_assert(dest + total_len_nbytes == original_dest + original_len_bytes && "continuation broken?");
-            // Do one store byte to update MMU flags (not sure this is necessary)
-            store_byte_and_clear_tag(env, dest, value, oi, ra);
-            do_memset_pattern_hostaddr(hostaddr, value, l_adj_nitems, pattern_length, ra);
-#ifdef TARGET_CHERI
             // We also need to invalidate the tags bits written by the memset
-            // qemu_ram_addr_from_host is faster than using the v2r routines in cheri_tag_invalidate
-            ram_addr_t ram_addr = qemu_ram_addr_from_host(hostaddr);
-            if (ram_addr != RAM_ADDR_INVALID) {
-                cheri_tag_phys_invalidate(env, ram_addr, l_adj_bytes);
-            } else {
-                cheri_tag_invalidate(env, dest, l_adj_bytes, ra);
-            }
-#endif
+            magic_host_store_begin(env, hostaddr, dest, l_adj_bytes, ra);
+            do_memset_pattern_hostaddr(hostaddr, value, l_adj_nitems, pattern_length, ra);
+            magic_host_store_end(env, hostaddr);
             if (unlikely(log_instr)) {
                 // TODO: dump as a single big block?
                 for (target_ulong i = 0; i < l_adj_nitems; i++) {
@@ -2283,9 +2358,135 @@ success:
     // also update a0 and a2 to match what the kernel memset does (a0 -> buf end, a2 -> 0):
     env->active_tc.gpr[MIPS_REGNUM_A0] = dest;
     env->active_tc.gpr[MIPS_REGNUM_A2] = len_nitems;
-#if MAGIC_MEMSET_STATS != 0
-    collect_magic_nop_stats(env, value == 0 ? &magic_memset_zero_bytes : &magic_memset_nonzero_bytes, original_len_bytes);
+    collect_magic_nop_stats(env, value == 0 ? MAGIC_NOP_STAT_MEMSET_ZERO : MAGIC_NOP_STAT_MEMSET_NONZERO, original_len_bytes);
+    return true;
+}
+
+enum magic_scan_op {
+    MAGIC_SCAN_STRLEN,
+    MAGIC_SCAN_STRNLEN,
+    MAGIC_SCAN_STRCMP,
+    MAGIC_SCAN_MEMCMP,
+};
+
+/*
+ * Examine up to @n bytes of @p1 (and @p2) for @op, using the host libc
+ * routines. Returns the number of bytes that were consumed and sets
+ * *@finished if the result is known, in which case *@result holds the
+ * offset of the NUL byte (strlen) or the difference of the first mismatch.
+ */
+static target_ulong magic_scan_chunk(enum magic_scan_op op, const uint8_t *p1,
+                                     const uint8_t *p2, target_ulong n,
+                                     bool *finished, target_long *result)
+{
+    const uint8_t *nul = NULL;
+    target_ulong len = n;
+
+    if (op != MAGIC_SCAN_MEMCMP) {
+        nul = memchr(p1, 0, n);
+        if (nul) {
+            len = nul - p1 + 1;
+        }
+    }
+    if (op == MAGIC_SCAN_STRLEN || op == MAGIC_SCAN_STRNLEN) {
+        *finished = nul != NULL;
+        *result = len - 1;
+        return len;
+    }
+    if (memcmp(p1, p2, len) == 0) {
+        *finished = nul != NULL;
+        *result = 0;
+        return len;
+    }
+    for (target_ulong i = 0; i < len; i++) {
+        if (p1[i] != p2[i]) {
+            *finished = true;
+            *result = (int)p1[i] - (int)p2[i];
+            return i + 1;
+        }
+    }
+    g_assert_not_reached();
+}
+
+/*
+ * strlen($a0), strnlen($a0, $a1), strcmp($a0, $a1) and memcmp($a0, $a1, $a2).
+ * The strings are scanned a page at a time directly in host memory (only I/O
+ * memory is read byte by byte). The number of bytes examined so far is kept
+ * in $v0 using the same continuation protocol as memset/memmove. Only the
+ * bytes that the C function would actually read are checked against $ddc.
+ */
+static bool do_magic_scan(CPUMIPSState *env, uint64_t ra, enum magic_scan_op op)
+{
+    const bool two_strings = op == MAGIC_SCAN_STRCMP || op == MAGIC_SCAN_MEMCMP;
+    const target_ulong s1_ddc_offset = env->active_tc.gpr[MIPS_REGNUM_A0];
+    const target_ulong s2_ddc_offset = env->active_tc.gpr[MIPS_REGNUM_A1];
+    target_ulong limit = (target_ulong)-1;
+    target_ulong done = 0;
+    target_long result = 0;
+    bool finished = false;
+    int mmu_idx = cpu_mmu_index(env, false);
+    TCGMemOpIdx oi = make_memop_idx(MO_UB, mmu_idx);
+
+    if (op == MAGIC_SCAN_STRNLEN) {
+        limit = env->active_tc.gpr[MIPS_REGNUM_A1];
+    } else if (op == MAGIC_SCAN_MEMCMP) {
+        limit = env->active_tc.gpr[MIPS_REGNUM_A2];
+    }
+    const bool is_continuation = (env->active_tc.gpr[MIPS_REGNUM_V1] >> 32) == MAGIC_LIBCALL_HELPER_CONTINUATION_FLAG;
+    if (is_continuation) {
+        // The number of bytes examined so far was stored in $v0 by the previous call
+        done = env->active_tc.gpr[MIPS_REGNUM_V0];
+        tcg_debug_assert(done < limit);
+    } else if (env->active_tc.gpr[MIPS_REGNUM_V0] != 0) {
+        error_report("ERROR: Attempted to call string library function "
+                     "with non-zero value in $v0 (0x" TARGET_FMT_lx
+                     ") and continuation flag not set in $v1 (0x" TARGET_FMT_lx
+                     ")!\n", env->active_tc.gpr[MIPS_REGNUM_V0], env->active_tc.gpr[MIPS_REGNUM_V1]);
+        do_raise_exception(env, EXCP_RI, ra);
+    }
+    // Mark this as a continuation in $v1 (so that we continue sensibly if we get a tlb miss and longjump out)
+    env->active_tc.gpr[MIPS_REGNUM_V1] = (MAGIC_LIBCALL_HELPER_CONTINUATION_FLAG << 32) | env->active_tc.gpr[MIPS_REGNUM_V1];
+
+    while (!finished && done < limit) {
+        // Check the first byte before touching the page so that we report
+        // a bounds violation before a TLB fault, just like the guest would.
+        const target_ulong s1 = CHECK_AND_ADD_DDC(env, CAP_PERM_LOAD, s1_ddc_offset + done, 1, ra);
+        target_ulong s2 = 0;
+        target_ulong chunk = MIN(limit - done, TARGET_PAGE_SIZE - (s1 & ~TARGET_PAGE_MASK));
+        if (two_strings) {
+            s2 = CHECK_AND_ADD_DDC(env, CAP_PERM_LOAD, s2_ddc_offset + done, 1, ra);
+            chunk = MIN(chunk, TARGET_PAGE_SIZE - (s2 & ~TARGET_PAGE_MASK));
+        }
+        const uint8_t *p1 = magic_probe_host(env, s1, chunk, MMU_DATA_LOAD, mmu_idx, ra);
+        const uint8_t *p2 = two_strings ? magic_probe_host(env, s2, chunk, MMU_DATA_LOAD, mmu_idx, ra) : p1;
+        uint8_t b1, b2;
+        if (unlikely(!p1 || !p2)) {
+            // Slow path (I/O memory): one byte at a time
+            chunk = 1;
+            b1 = helper_ret_ldub_mmu(env, s1, oi, ra);
+            b2 = two_strings ? helper_ret_ldub_mmu(env, s2, oi, ra) : b1;
+            p1 = &b1;
+            p2 = &b2;
+        }
+        target_ulong consumed = magic_scan_chunk(op, p1, p2, chunk, &finished, &result);
+#ifdef TARGET_CHERI
+        // Now check the bytes that the C function would have read
+        check_ddc(env, CAP_PERM_LOAD, s1_ddc_offset + done, consumed, ra);
+        if (two_strings) {
+            check_ddc(env, CAP_PERM_LOAD, s2_ddc_offset + done, consumed, ra);
+        }
 #endif
+        if (finished && (op == MAGIC_SCAN_STRLEN || op == MAGIC_SCAN_STRNLEN)) {
+            result += done;
+        }
+        done += consumed;
+        env->active_tc.gpr[MIPS_REGNUM_V0] = done;
+    }
+    if (!finished && op == MAGIC_SCAN_STRNLEN) {
+        result = limit;
+    }
+    collect_magic_nop_stats(env, MAGIC_NOP_STAT_STRING, done);
+    env->active_tc.gpr[MIPS_REGNUM_V0] = result;
     return true;
 }
 
@@ -2300,6 +2501,12 @@ enum {
     MAGIC_NOP_MEMMOVE_C = 6,
     MAGIC_NOP_BCOPY = 7,
     MAGIC_NOP_U32_MEMSET = 8,
+    MAGIC_NOP_CAP_MEMCPY = 9, // memcpy() that also copies the tags
+    MAGIC_NOP_STRLEN = 10,
+    MAGIC_NOP_STRNLEN = 11,
+    MAGIC_NOP_STRCMP = 12,
+    MAGIC_NOP_MEMCMP = 13,
+    MAGIC_NOP_FIND_TAGGED = 14, // offset of the next tagged capability
 };
 
 
@@ -2325,21 +2532,57 @@ void helper_magic_library_function(CPUMIPSState *env, target_ulong which)
     case MAGIC_NOP_MEMCPY:
         if (!do_magic_memmove(env, GETPC(), MIPS_REGNUM_A0, MIPS_REGNUM_A1))
             goto error;
-        collect_magic_nop_stats(env, &magic_memcpy_bytes, env->active_tc.gpr[MIPS_REGNUM_A2]);
+        collect_magic_nop_stats(env, MAGIC_NOP_STAT_MEMCPY, env->active_tc.gpr[MIPS_REGNUM_A2]);
         break;
 
     case MAGIC_NOP_MEMMOVE:
         if (!do_magic_memmove(env, GETPC(), MIPS_REGNUM_A0, MIPS_REGNUM_A1))
             goto error;
-        collect_magic_nop_stats(env, &magic_memmove_bytes, env->active_tc.gpr[MIPS_REGNUM_A2]);
+        collect_magic_nop_stats(env, MAGIC_NOP_STAT_MEMMOVE, env->active_tc.gpr[MIPS_REGNUM_A2]);
         break;
 
     case MAGIC_NOP_BCOPY: // src + dest arguments swapped
         if (!do_magic_memmove(env, GETPC(), MIPS_REGNUM_A1, MIPS_REGNUM_A0))
             goto error;
-        collect_magic_nop_stats(env, &magic_bcopy_bytes, env->active_tc.gpr[MIPS_REGNUM_A2]);
+        collect_magic_nop_stats(env, MAGIC_NOP_STAT_BCOPY, env->active_tc.gpr[MIPS_REGNUM_A2]);
+        break;
+
+    case MAGIC_NOP_STRLEN:
+        do_magic_scan(env, GETPC(), MAGIC_SCAN_STRLEN);
+        break;
+
+    case MAGIC_NOP_STRNLEN:
+        do_magic_scan(env, GETPC(), MAGIC_SCAN_STRNLEN);
         break;
 
+    case MAGIC_NOP_STRCMP:
+        do_magic_scan(env, GETPC(), MAGIC_SCAN_STRCMP);
+        break;
+
+    case MAGIC_NOP_MEMCMP:
+        do_magic_scan(env, GETPC(), MAGIC_SCAN_MEMCMP);
+        break;
+
+#if defined(TARGET_CHERI) && !defined(CONFIG_USER_ONLY)
+    case MAGIC_NOP_CAP_MEMCPY:
+        if (!do_magic_cap_memcpy(env, GETPC()))
+            return; // $v1 not set to done -> guest falls back to a CLC/CSC loop
+        collect_magic_nop_stats(env, MAGIC_NOP_STAT_CAP_MEMCPY, env->active_tc.gpr[MIPS_REGNUM_A2]);
+        break;
+
+    case MAGIC_NOP_FIND_TAGGED:
+    {
+        if (!do_magic_find_tagged(env, GETPC()))
+            return; // $v1 not set to done -> guest falls back to CLoadTags
+        // $v0 is the offset of the first tagged granule, which was scanned too
+        target_ulong found = env->active_tc.gpr[MIPS_REGNUM_V0];
+        target_ulong len = env->active_tc.gpr[MIPS_REGNUM_A1];
+        collect_magic_nop_stats(env, MAGIC_NOP_STAT_TAG_SCAN,
+                                found < len ? found + CHERI_CAP_SIZE : len);
+        break;
+    }
+#endif
+
     case 0xf0:
     case 0xf1:
     {
@@ -83,16 +83,23 @@ target_ulong helper_mfc0_coreid(CPUMIPSState *env)
 }
 
 #if defined(TARGET_CHERI)
+/*
+ * The counters themselves are never cleared (they also feed the instruction
+ * count report on exit), a reset just records the current values.
+ */
+#define STATCOUNTER(env, name) \
+    ((env)->statcounters.name - (env)->statcounters_base.name)
+
 target_ulong helper_rdhwr_statcounters_icount(CPUMIPSState *env, uint32_t sel)
 {
     qemu_log_mask(CPU_LOG_INSTR, "%s\n", __func__);
     check_hwrena(env, 4, GETPC());
     switch (sel) {
-    case 0: return env->statcounters_icount;
-    case 1: return env->statcounters_icount_user;
-    case 2: return env->statcounters_icount_kernel;
-    case 3: return env->statcounters_imprecise_setbounds;
-    case 4: return env->statcounters_unrepresentable_caps;
+    case 0: return STATCOUNTER(env, icount);
+    case 1: return STATCOUNTER(env, icount_user);
+    case 2: return STATCOUNTER(env, icount_kernel);
+    case 3: return STATCOUNTER(env, imprecise_setbounds);
+    case 4: return STATCOUNTER(env, unrepresentable_caps);
     default: return 0xdeadbeef;
     }
 }
@@ -101,14 +108,14 @@ target_ulong helper_rdhwr_statcounters_itlb_miss(CPUMIPSState *env)
 {
     qemu_log_mask(CPU_LOG_INSTR, "%s\n", __func__);
     check_hwrena(env, 5, GETPC());
-    return env->statcounters_itlb_miss;
+    return STATCOUNTER(env, itlb_miss);
 }
 
 target_ulong helper_rdhwr_statcounters_dtlb_miss(CPUMIPSState *env)
 {
     qemu_log_mask(CPU_LOG_INSTR, "%s\n", __func__);
     check_hwrena(env, 6, GETPC());
-    return env->statcounters_dtlb_miss;
+    return STATCOUNTER(env, dtlb_miss);
 }
 
 target_ulong helper_rdhwr_statcounters_memory(CPUMIPSState *env, uint32_t sel)
@@ -116,21 +123,21 @@ target_ulong helper_rdhwr_statcounters_memory(CPUMIPSState *env, uint32_t sel)
     qemu_log_mask(CPU_LOG_INSTR, "%s(%d)\n", __func__, sel);
     check_hwrena(env, 11, GETPC());
     switch (sel) {
-    case 2: return env->statcounters_icount_user;
-    case 4: return env->statcounters_icount_kernel;
-    case 8: return env->statcounters_cap_read;
-    case 9: return env->statcounters_cap_write;
-    case 10: return env->statcounters_cap_read_tagged;
-    case 11: return env->statcounters_cap_write_tagged;
+    case 2: return STATCOUNTER(env, icount_user);
+    case 4: return STATCOUNTER(env, icount_kernel);
+    case 8: return STATCOUNTER(env, cap_read);
+    case 9: return STATCOUNTER(env, cap_write);
+    case 10: return STATCOUNTER(env, cap_read_tagged);
+    case 11: return STATCOUNTER(env, cap_write_tagged);
     default: return 0xdeadbeef;
     }
 }
 
 target_ulong helper_rdhwr_statcounters_reset(CPUMIPSState *env)
 {
-    // TODO: actually implement this
     qemu_log_mask(CPU_LOG_INSTR, "%s\n", __func__);
     check_hwrena(env, 7, GETPC());
+    env->statcounters_base = env->statcounters;
     return 0;
 }
 
@@ -51,6 +51,11 @@
 
 #include "disas/disas.h"
 #include "disas/dis-asm.h"
+#ifndef CONFIG_USER_ONLY
+#include "monitor/hmp-target.h"
+#include "monitor/monitor.h"
+#include "qapi/qapi-commands-misc-target.h"
+#endif
 
 const char *cp2_fault_causestr[] = {
     "None",
@@ -103,7 +108,7 @@ extern bool cheri_debugger_on_unrepresentable;
 static inline void
 _became_unrepresentable(CPUMIPSState *env, uint16_t reg, uintptr_t retpc)
 {
-    env->statcounters_unrepresentable_caps++;
+    env->statcounters.unrepresentable_caps++;
 
     if (cheri_debugger_on_unrepresentable)
         helper_raise_exception_debug(env);
@@ -122,13 +127,15 @@ _became_unrepresentable(CPUMIPSState *env, uint16_t reg, uintptr_t retpc)
 
 #endif /* ! 128-bit capabilities */
 
-#ifdef DO_CHERI_STATISTICS
-
+/*
+ * Out-of-bounds statistics are counted per vCPU in env->oob_stats and only
+ * need a few compares for in-bounds results, so they are always enabled.
+ */
 struct bounds_bucket {
     uint64_t howmuch;
     const char* name;
 };
-struct bounds_bucket bounds_buckets[] = {
+static const struct bounds_bucket bounds_buckets[] = {
     {1, "1  "}, // 1
     {2, "2  "}, // 2
     {4, "4  "}, // 3
@@ -144,36 +151,30 @@ struct bounds_bucket bounds_buckets[] = {
     {64 * 1024 * 1024, "64M"},
 };
 
-struct oob_stats_info {
-    const char* operation;
-    uint64_t num_uses;
-    uint64_t unrepresentable; // Number of OOB caps that were unrepresentable
-    uint64_t after_bounds[ARRAY_SIZE(bounds_buckets) + 1]; // Number of OOB caps created pointing to after end
-    uint64_t before_bounds[ARRAY_SIZE(bounds_buckets) + 1];  // Number of OOB caps created pointing to before start
+QEMU_BUILD_BUG_ON(ARRAY_SIZE(bounds_buckets) != OOB_STAT_NUM_BUCKETS);
+
+#define DEFINE_CHERI_STAT(op) [OOB_STAT_##op] = #op,
+static const char *const oob_stat_names[OOB_STAT_NUM_OPS] = {
+    DEFINE_CHERI_STAT(cincoffset)
+    DEFINE_CHERI_STAT(csetoffset)
+    DEFINE_CHERI_STAT(csetaddr)
+    DEFINE_CHERI_STAT(candaddr)
+    DEFINE_CHERI_STAT(cgetpccsetoffset)
+    DEFINE_CHERI_STAT(cgetpccincoffset)
+    DEFINE_CHERI_STAT(cgetpccsetaddr)
+    DEFINE_CHERI_STAT(cfromptr)
 };
-
-#define DEFINE_CHERI_STAT(op) \
-    static struct oob_stats_info oob_info_##op = { \
-        .operation = #op, \
-    };
-#define OOB_INFO(op) (&oob_info_##op)
-
-DEFINE_CHERI_STAT(cincoffset)
-DEFINE_CHERI_STAT(csetoffset)
-DEFINE_CHERI_STAT(csetaddr)
-DEFINE_CHERI_STAT(candaddr)
-DEFINE_CHERI_STAT(cgetpccsetoffset)
-DEFINE_CHERI_STAT(cgetpccincoffset)
-DEFINE_CHERI_STAT(cgetpccsetaddr)
-DEFINE_CHERI_STAT(cfromptr)
+#define OOB_INFO(op) OOB_STAT_##op
 
 static inline int64_t _howmuch_out_of_bounds(CPUMIPSState *env, const cap_register_t* cr, const char* name)
 {
     if (!cr->cr_tag)
         return 0;  // We don't care about arithmetic on untagged things
 
-    const cap_offset_t offset = cap_get_offset(cr);
     const uint64_t addr = cap_get_cursor(cr);
+    if (likely(addr >= cap_get_base(cr) && addr < cap_get_top65(cr)))
+        return 0;
+    const cap_offset_t offset = cap_get_offset(cr);
     if (addr == cap_get_top65(cr)) {
         // This case is very common so we should not print a message here
         return 1;
@@ -207,9 +208,10 @@ static inline int out_of_bounds_stat_index(uint64_t howmuch) {
 }
 
 static inline void
-check_out_of_bounds_stat(CPUMIPSState *env, struct oob_stats_info *info,
+check_out_of_bounds_stat(CPUMIPSState *env, enum oob_stat_op op,
                          const cap_register_t* capreg) {
-    int64_t howmuch = _howmuch_out_of_bounds(env, capreg, info->operation);
+    struct oob_stats_info *info = &env->oob_stats[op];
+    int64_t howmuch = _howmuch_out_of_bounds(env, capreg, oob_stat_names[op]);
     if (howmuch > 0) {
         info->after_bounds[out_of_bounds_stat_index(howmuch)]++;
     } else if (howmuch < 0) {
@@ -218,24 +220,38 @@ check_out_of_bounds_stat(CPUMIPSState *env, struct oob_stats_info *info,
 }
 
 static inline void became_unrepresentable(CPUMIPSState *env, uint16_t reg,
-                                          struct oob_stats_info *info,
+                                          enum oob_stat_op op,
                                           uintptr_t retpc) {
     const cap_register_t *capreg = get_readonly_capreg(&env->active_tc, reg);
     /* unrepresentable implies more than one out of bounds: */
-    check_out_of_bounds_stat(env, info, capreg);
-    info->unrepresentable++;
+    check_out_of_bounds_stat(env, op, capreg);
+    env->oob_stats[op].unrepresentable++;
     qemu_log_mask(
         CPU_LOG_INSTR | CPU_LOG_CHERI_BOUNDS,
         "BOUNDS: Unrepresentable capability created using %s, pc=%016" PRIx64
-        " ASID=%u\n", info->operation, cap_get_cursor(&env->active_tc.PCC),
+        " ASID=%u\n", oob_stat_names[op], cap_get_cursor(&env->active_tc.PCC),
         (unsigned)(env->CP0_EntryHi & 0xFF));
     _became_unrepresentable(env, reg, retpc);
 }
 
-static void dump_out_of_bounds_stats(FILE* f, const struct oob_stats_info *info)
+static void dump_out_of_bounds_stats(FILE* f, CPUState *cs, enum oob_stat_op op)
 {
+    struct oob_stats_info sum = { 0 };
+    const struct oob_stats_info *info = &sum;
+    CPUState *cpu;
 
-    qemu_fprintf(f, "Number of %ss: %" PRIu64 "\n", info->operation, info->num_uses);
+    CPU_FOREACH(cpu) {
+        if (cs && cpu != cs)
+            continue;
+        const struct oob_stats_info *s = &MIPS_CPU(cpu)->env.oob_stats[op];
+        sum.num_uses += s->num_uses;
+        sum.unrepresentable += s->unrepresentable;
+        for (int i = 0; i < ARRAY_SIZE(sum.after_bounds); i++) {
+            sum.after_bounds[i] += s->after_bounds[i];
+            sum.before_bounds[i] += s->before_bounds[i];
+        }
+    }
+    qemu_fprintf(f, "Number of %ss: %" PRIu64 "\n", oob_stat_names[op], info->num_uses);
     uint64_t total_out_of_bounds = info->after_bounds[0];
     // one past the end is fine according to ISO C
     qemu_fprintf(f, "  One past the end:           %" PRIu64 "\n", info->after_bounds[0]);
@@ -264,42 +280,201 @@ static void dump_out_of_bounds_stats(FILE* f, const struct oob_stats_info *info)
     qemu_fprintf(f, "  Became unrepresentable due to out-of-bounds: %" PRIu64 "\n", info->unrepresentable);
     total_out_of_bounds += info->unrepresentable; // TODO: count how far it was out of bounds for this stat
 
-    qemu_fprintf(f, "Total out of bounds %ss: %" PRIu64 " (%f%%)\n", info->operation, total_out_of_bounds,
+    qemu_fprintf(f, "Total out of bounds %ss: %" PRIu64 " (%f%%)\n", oob_stat_names[op], total_out_of_bounds,
                  info->num_uses == 0 ? 0.0 : ((double)(100 * total_out_of_bounds) / (double)info->num_uses));
     qemu_fprintf(f, "Total out of bounds %ss (excluding one past the end): %" PRIu64 " (%f%%)\n",
-                 info->operation, total_out_of_bounds - info->after_bounds[0],
+                 oob_stat_names[op], total_out_of_bounds - info->after_bounds[0],
                  info->num_uses == 0 ? 0.0 : ((double)(100 * (total_out_of_bounds - info->after_bounds[0])) / (double)info->num_uses));
 }
 
-#else /* !defined(DO_CHERI_STATISTICS) */
 
-// Don't collect any statistics by default (it slows down QEMU)
-#define OOB_INFO(op) NULL
-#define check_out_of_bounds_stat(env, op, capreg) do { } while (0)
-#define became_unrepresentable(env, reg, operation, retpc) _became_unrepresentable(env, reg, retpc)
+#ifdef CHERI_128
+static void dump_decode_cache_stats(FILE* f, CPUState *cs)
+{
+    CPUState *cpu;
 
-#endif /* DO_CHERI_STATISTICS */
+    CPU_FOREACH(cpu) {
+        if (cs && cpu != cs)
+            continue;
+        struct cheri_decode_cache *cache = &MIPS_CPU(cpu)->env.decode_cache;
+        uint64_t total = cache->hits + cache->misses;
+        qemu_fprintf(f, "CPU%d capability decode cache: %" PRIu64 " hits, %"
+                     PRIu64 " misses (%f%% hit rate)\n", cpu->cpu_index,
+                     cache->hits, cache->misses,
+                     total == 0 ? 0.0 : (double)(100 * cache->hits) / (double)total);
+    }
+}
+#endif
 
 void cheri_cpu_dump_statistics_f(CPUState *cs, FILE* f, int flags)
 {
-#ifndef DO_CHERI_STATISTICS
-    qemu_fprintf(f, "CPUSTATS DISABLED, RECOMPILE WITH -DDO_CHERI_STATISTICS\n");
-#else
-    dump_out_of_bounds_stats(f, &oob_info_cincoffset);
-    dump_out_of_bounds_stats(f, &oob_info_csetoffset);
-    dump_out_of_bounds_stats(f, &oob_info_csetaddr);
-    dump_out_of_bounds_stats(f, &oob_info_candaddr);
-    dump_out_of_bounds_stats(f, &oob_info_cfromptr);
-    dump_out_of_bounds_stats(f, &oob_info_cgetpccsetoffset);
-    dump_out_of_bounds_stats(f, &oob_info_cgetpccincoffset);
-    dump_out_of_bounds_stats(f, &oob_info_cgetpccsetaddr);
+#ifdef CHERI_128
+    dump_decode_cache_stats(f, cs);
 #endif
+    for (int op = 0; op < OOB_STAT_NUM_OPS; op++) {
+        dump_out_of_bounds_stats(f, cs, op);
+    }
 }
 
 void cheri_cpu_dump_statistics(CPUState *cs, int flags) {
     cheri_cpu_dump_statistics_f(cs, NULL, flags);
 }
 
+#ifndef CONFIG_USER_ONLY
+/* The values may be counters that another vCPU thread is updating. */
+static uint64List *uint64_list(const uint64_t *values, size_t count)
+{
+    uint64List *head = NULL;
+    uint64List **tail = &head;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64List *entry = g_new0(uint64List, 1);
+        entry->value = atomic_read__nocheck(&values[i]);
+        *tail = entry;
+        tail = &entry->next;
+    }
+    return head;
+}
+
+/*
+ * The counters are read without stopping the vCPUs. They are only ever
+ * incremented by their own vCPU thread, so this gives a slightly stale but
+ * otherwise consistent view of each counter.
+ */
+CheriStats *qmp_query_cheri_stats(Error **errp)
+{
+    CheriStats *stats = g_new0(CheriStats, 1);
+    CheriCpuStatsList **cpu_tail = &stats->cpus;
+    uint64_t limits[OOB_STAT_NUM_BUCKETS];
+    CPUState *cs;
+
+    for (int i = 0; i < OOB_STAT_NUM_BUCKETS; i++) {
+        limits[i] = bounds_buckets[i].howmuch;
+    }
+    stats->oob_bucket_limits = uint64_list(limits, OOB_STAT_NUM_BUCKETS);
+
+    CPU_FOREACH(cs) {
+        CPUMIPSState *env = &MIPS_CPU(cs)->env;
+        const struct mips_statcounters *sc = &env->statcounters;
+        CheriCpuStatsList *cpu_entry = g_new0(CheriCpuStatsList, 1);
+        CheriCpuStats *cpu = g_new0(CheriCpuStats, 1);
+        CheriOobStatsList **oob_tail = &cpu->oob;
+        CheriMagicNopStatsList **nop_tail = &cpu->magic_nops;
+
+        cpu->cpu_index = cs->cpu_index;
+        cpu->instructions = atomic_read__nocheck(&sc->icount);
+        cpu->user_instructions = atomic_read__nocheck(&sc->icount_user);
+        cpu->kernel_instructions = atomic_read__nocheck(&sc->icount_kernel);
+        cpu->itlb_misses = atomic_read__nocheck(&sc->itlb_miss);
+        cpu->dtlb_misses = atomic_read__nocheck(&sc->dtlb_miss);
+        cpu->cap_reads = atomic_read__nocheck(&sc->cap_read);
+        cpu->cap_reads_tagged = atomic_read__nocheck(&sc->cap_read_tagged);
+        cpu->cap_writes = atomic_read__nocheck(&sc->cap_write);
+        cpu->cap_writes_tagged = atomic_read__nocheck(&sc->cap_write_tagged);
+        cpu->imprecise_setbounds =
+            atomic_read__nocheck(&sc->imprecise_setbounds);
+        cpu->unrepresentable_caps =
+            atomic_read__nocheck(&sc->unrepresentable_caps);
+
+        for (int op = 0; op < OOB_STAT_NUM_OPS; op++) {
+            const struct oob_stats_info *info = &env->oob_stats[op];
+            CheriOobStatsList *entry = g_new0(CheriOobStatsList, 1);
+
+            entry->value = g_new0(CheriOobStats, 1);
+            entry->value->operation = g_strdup(oob_stat_names[op]);
+            entry->value->uses = atomic_read__nocheck(&info->num_uses);
+            entry->value->unrepresentable =
+                atomic_read__nocheck(&info->unrepresentable);
+            entry->value->after_bounds =
+                uint64_list(info->after_bounds, ARRAY_SIZE(info->after_bounds));
+            entry->value->before_bounds =
+                uint64_list(info->before_bounds, ARRAY_SIZE(info->before_bounds));
+            *oob_tail = entry;
+            oob_tail = &entry->next;
+        }
+
+        for (int i = 0; i < MAGIC_NOP_STAT_NUM; i++) {
+            const struct magic_nop_stats *nop = &env->magic_nop_stats[i];
+            CheriMagicNopStatsList *entry = g_new0(CheriMagicNopStatsList, 1);
+
+            entry->value = g_new0(CheriMagicNopStats, 1);
+            entry->value->function = g_strdup(magic_nop_stat_names[i]);
+            entry->value->user_bytes = atomic_read__nocheck(&nop->user_mode_bytes);
+            entry->value->user_calls = atomic_read__nocheck(&nop->user_mode_count);
+            entry->value->kernel_bytes =
+                atomic_read__nocheck(&nop->kernel_mode_bytes);
+            entry->value->kernel_calls =
+                atomic_read__nocheck(&nop->kernel_mode_count);
+            *nop_tail = entry;
+            nop_tail = &entry->next;
+        }
+
+        cpu_entry->value = cpu;
+        *cpu_tail = cpu_entry;
+        cpu_tail = &cpu_entry->next;
+    }
+    return stats;
+}
+
+void hmp_info_cheri_stats(Monitor *mon, const QDict *qdict)
+{
+    CheriStats *stats = qmp_query_cheri_stats(NULL);
+    CheriCpuStatsList *cpu_entry;
+
+    for (cpu_entry = stats->cpus; cpu_entry; cpu_entry = cpu_entry->next) {
+        CheriCpuStats *cpu = cpu_entry->value;
+        CheriOobStatsList *oob;
+        CheriMagicNopStatsList *nop;
+
+        monitor_printf(mon, "CPU%" PRId64 ":\n", cpu->cpu_index);
+        monitor_printf(mon, "  instructions: %" PRIu64 " (%" PRIu64 " user, %"
+                       PRIu64 " kernel)\n", cpu->instructions,
+                       cpu->user_instructions, cpu->kernel_instructions);
+        monitor_printf(mon, "  TLB misses: %" PRIu64 " instruction, %" PRIu64
+                       " data\n", cpu->itlb_misses, cpu->dtlb_misses);
+        monitor_printf(mon, "  capability loads: %" PRIu64 " (%" PRIu64
+                       " tagged), stores: %" PRIu64 " (%" PRIu64 " tagged)\n",
+                       cpu->cap_reads, cpu->cap_reads_tagged, cpu->cap_writes,
+                       cpu->cap_writes_tagged);
+        monitor_printf(mon, "  imprecise csetbounds: %" PRIu64
+                       ", unrepresentable capabilities: %" PRIu64 "\n",
+                       cpu->imprecise_setbounds, cpu->unrepresentable_caps);
+        for (oob = cpu->oob; oob; oob = oob->next) {
+            uint64_t after = 0, before = 0;
+            uint64List *l;
+
+            if (oob->value->uses == 0) {
+                continue;
+            }
+            for (l = oob->value->after_bounds; l; l = l->next) {
+                after += l->value;
+            }
+            for (l = oob->value->before_bounds; l; l = l->next) {
+                before += l->value;
+            }
+            monitor_printf(mon, "  %s: %" PRIu64 " uses, %" PRIu64
+                           " after bounds (%" PRIu64 " one past the end), %"
+                           PRIu64 " before bounds, %" PRIu64
+                           " unrepresentable\n", oob->value->operation,
+                           oob->value->uses, after,
+                           oob->value->after_bounds->value, before,
+                           oob->value->unrepresentable);
+        }
+        for (nop = cpu->magic_nops; nop; nop = nop->next) {
+            if (nop->value->user_calls == 0 && nop->value->kernel_calls == 0) {
+                continue;
+            }
+            monitor_printf(mon, "  magic %s: %" PRIu64 " bytes in %" PRIu64
+                           " user calls, %" PRIu64 " bytes in %" PRIu64
+                           " kernel calls\n", nop->value->function,
+                           nop->value->user_bytes, nop->value->user_calls,
+                           nop->value->kernel_bytes, nop->value->kernel_calls);
+        }
+    }
+    qapi_free_CheriStats(stats);
+}
+#endif /* !CONFIG_USER_ONLY */
+
 
 static inline bool
 is_cap_sealed(const cap_register_t *cp)
@@ -509,13 +684,15 @@ void CHERI_HELPER_IMPL(cclearreg(CPUMIPSState *env, uint32_t mask))
 {
     // Register zero means $ddc here since it is useful to clear $ddc on a
     // sandbox switch whereas clearing $NULL is useless
+    cap_register_t null;
+    (void)null_capability(&null);
     if (mask & 0x1) {
-        update_ddc(env,&env->active_tc._CGPR[0]); // nullify $ddc
+        update_ddc(env, &null); // nullify $ddc
     }
 
     for (int creg = 1; creg < 32; creg++) {
         if (mask & (0x1 << creg))
-            (void)null_capability(&env->active_tc._CGPR[creg]);
+            update_capreg(&env->active_tc, creg, &null);
     }
 }
 
@@ -579,9 +756,7 @@ void CHERI_HELPER_IMPL(cfromptr(CPUMIPSState *env, uint32_t cd, uint32_t cb,
         target_ulong rt))
 {
     GET_HOST_RETPC();
-#ifdef DO_CHERI_STATISTICS
-    OOB_INFO(cfromptr)->num_uses++;
-#endif
+    env->oob_stats[OOB_INFO(cfromptr)].num_uses++;
     // CFromPtr traps on cbp == NULL so we use reg0 as $ddc to save encoding
     // space (and for backwards compat with old binaries).
     // Note: This is also still required for new binaries since clang assumes it
@@ -697,16 +872,8 @@ void CHERI_HELPER_IMPL(cgetpcc(CPUMIPSState *env, uint32_t cd))
 
 static void
 derive_from_pcc_impl(CPUMIPSState *env, uint32_t cd, target_ulong new_addr,
-#ifdef DO_CHERI_STATISTICS
-                     uintptr_t retpc, struct oob_stats_info* oob_info) {
-    oob_info->num_uses++;
-#else
-                     uintptr_t retpc, void* dummy_arg) {
-    (void)dummy_arg;
-#endif
-#ifdef DO_CHERI_STATISTICS
-    oob_info->num_uses++;
-#endif
+                     uintptr_t retpc, enum oob_stat_op oob_info) {
+    env->oob_stats[oob_info].num_uses++;
     cap_register_t *pccp = &env->active_tc.PCC;
     /*
      * CGetPCCSetOffset: Get PCC with new offset
@@ -804,13 +971,8 @@ void CHERI_HELPER_IMPL(cincbase(CPUMIPSState *env, uint32_t cd, uint32_t cb, tar
 
 static void
 cincoffset_impl(CPUMIPSState *env, uint32_t cd, uint32_t cb, target_ulong rt,
-#ifdef DO_CHERI_STATISTICS
-                uintptr_t retpc, struct oob_stats_info* oob_info) {
-    oob_info->num_uses++;
-#else
-                uintptr_t retpc, void* dummy_arg) {
-    (void)dummy_arg;
-#endif
+                uintptr_t retpc, enum oob_stat_op oob_info) {
+    env->oob_stats[oob_info].num_uses++;
 
     const cap_register_t *cbp = get_readonly_capreg(&env->active_tc, cb);
     /*
@@ -1235,7 +1397,7 @@ static void do_setbounds(bool must_be_exact, CPUMIPSState *env, uint32_t cd,
          */
         const bool exact = cc128_setbounds(&result, cursor, new_top);
         if (!exact)
-            env->statcounters_imprecise_setbounds++;
+            env->statcounters.imprecise_setbounds++;
         if (must_be_exact && !exact) {
             do_raise_c2_exception(env, CP2Ca_INEXACT, cb);
             return;
@@ -1369,9 +1531,7 @@ void CHERI_HELPER_IMPL(csetoffset(CPUMIPSState *env, uint32_t cd, uint32_t cb,
         target_ulong rt))
 {
     GET_HOST_RETPC();
-#ifdef DO_CHERI_STATISTICS
-    OOB_INFO(csetoffset)->num_uses++;
-#endif
+    env->oob_stats[OOB_INFO(csetoffset)].num_uses++;
     const cap_register_t *cbp = get_readonly_capreg(&env->active_tc, cb);
     /*
      * CSetOffset: Set cursor to an offset from base
@@ -1804,7 +1964,6 @@ static inline target_ulong get_csc_addr(CPUMIPSState *env, uint32_t cs, uint32_t
     // space and increase code density since storing relative to $ddc is common
     // in the hybrid ABI (and also for backwards compat with old binaries).
     const cap_register_t *cbp = get_capreg_0_is_ddc(&env->active_tc, cb);
-    const cap_register_t *csp = get_readonly_capreg(&env->active_tc, cs);
 
     if (!cbp->cr_tag) {
         do_raise_c2_exception(env, CP2Ca_TAG, cb);
@@ -1818,8 +1977,9 @@ static inline target_ulong get_csc_addr(CPUMIPSState *env, uint32_t cs, uint32_t
     } else if (!(cbp->cr_perms & CAP_PERM_STORE_CAP)) {
         do_raise_c2_exception(env, CP2Ca_PERM_ST_CAP, cb);
         return (target_ulong)0;
-    } else if (!(cbp->cr_perms & CAP_PERM_STORE_LOCAL) && csp->cr_tag &&
-            !(csp->cr_perms & CAP_PERM_GLOBAL)) {
+    } else if (!(cbp->cr_perms & CAP_PERM_STORE_LOCAL) &&
+            get_capreg_tag(&env->active_tc, cs) &&
+            !(get_capreg_hwperms(&env->active_tc, cs) & CAP_PERM_GLOBAL)) {
         do_raise_c2_exception(env, CP2Ca_PERM_ST_LC_CAP, cb);
         return (target_ulong)0;
     } else {
@@ -1844,7 +2004,6 @@ static inline target_ulong get_cscc_addr(CPUMIPSState *env, uint32_t cs, uint32_
     // space and increase code density since storing relative to $ddc is common
     // in the hybrid ABI (and also for backwards compat with old binaries).
     const cap_register_t *cbp = get_capreg_0_is_ddc(&env->active_tc, cb);
-    const cap_register_t *csp = get_readonly_capreg(&env->active_tc, cs);
     uint64_t addr = cap_get_cursor(cbp);
 
     if (!cbp->cr_tag) {
@@ -1859,8 +2018,9 @@ static inline target_ulong get_cscc_addr(CPUMIPSState *env, uint32_t cs, uint32_
     } else if (!(cbp->cr_perms & CAP_PERM_STORE_CAP)) {
         do_raise_c2_exception(env, CP2Ca_PERM_ST_CAP, cb);
         return (target_ulong)0;
-    } else if (!(cbp->cr_perms & CAP_PERM_STORE_LOCAL) && csp->cr_tag &&
-            !(csp->cr_perms & CAP_PERM_GLOBAL)) {
+    } else if (!(cbp->cr_perms & CAP_PERM_STORE_LOCAL) &&
+            get_capreg_tag(&env->active_tc, cs) &&
+            !(get_capreg_hwperms(&env->active_tc, cs) & CAP_PERM_GLOBAL)) {
         do_raise_c2_exception(env, CP2Ca_PERM_ST_LC_CAP, cb);
         return (target_ulong)0;
     } else if (!cap_is_in_bounds(cbp, addr, CHERI_CAP_SIZE)) {
@@ -1874,8 +2034,33 @@ static inline target_ulong get_cscc_addr(CPUMIPSState *env, uint32_t cs, uint32_
     return (target_ulong)addr;
 }
 
-static void store_cap_to_memory(CPUMIPSState *env, uint32_t cs, target_ulong vaddr, target_ulong retpc);
-static void load_cap_from_memory(CPUMIPSState *env, uint32_t cd, uint32_t cb, target_ulong vaddr, target_ulong retpc, hwaddr* physaddr);
+static bool store_cap_to_memory(CPUMIPSState *env, uint32_t cs, target_ulong vaddr, target_ulong retpc, bool conditional);
+static void load_cap_from_memory(CPUMIPSState *env, uint32_t cd, uint32_t cb, target_ulong vaddr, target_ulong retpc, bool linked);
+
+#ifndef CHERI_MAGIC128
+/*
+ * CLLC remembers the capability it loaded (in memory format, with the tag
+ * before any TLB load-inhibit was applied) so that CSCC can compare the
+ * memory against it: the linkedflag only notices stores by this vCPU.
+ */
+static inline void record_linked_cap(CPUMIPSState *env, const uint8_t *buf,
+                                     bool tag)
+{
+    memcpy(env->llcap, buf, CHERI_CAP_SIZE);
+    env->llcap_tag = tag;
+}
+
+/*
+ * Slow path of CSCC (the capability is not in RAM): with MTTCG retry the
+ * instruction while the other vCPUs are stopped, otherwise the linkedflag
+ * is accurate enough.
+ */
+static inline void cscc_slow_path(CPUMIPSState *env, target_ulong retpc)
+{
+    if (parallel_cpus)
+        cpu_loop_exit_atomic(env_cpu(env), retpc);
+}
+#endif
 
 target_ulong CHERI_HELPER_IMPL(cscc_without_tcg(CPUMIPSState *env, uint32_t cs, uint32_t cb))
 {
@@ -1888,9 +2073,27 @@ target_ulong CHERI_HELPER_IMPL(cscc_without_tcg(CPUMIPSState *env, uint32_t cs,
     /* If linkedflag is zero then don't store capability. */
     if (!env->linkedflag || env->lladdr != vaddr)
         return 0;
-    store_cap_to_memory(env, cs, vaddr, retpc);
-    return 1;
+    return store_cap_to_memory(env, cs, vaddr, retpc, /*conditional=*/true);
+}
+
+#if defined(CHERI_128) && !defined(CHERI_MAGIC128)
+/*
+ * The inline CLC/CSC (see translate_cheri.c) only find the bounds of @cb in
+ * env->decode_cache, which reads of @cb that hit in _CGPR_decoded don't
+ * refill, so their slow path does it.
+ */
+static inline void remember_cap_bounds(CPUMIPSState *env, uint32_t cb)
+{
+    if (cb != 0)
+        cheri_decode_cache_insert(&env->decode_cache,
+                                  env->active_tc.gpcapregs.pesbt[cb],
+                                  get_readonly_capreg(&env->active_tc, cb));
 }
+#else
+static inline void remember_cap_bounds(CPUMIPSState *env, uint32_t cb)
+{
+}
+#endif
 
 void CHERI_HELPER_IMPL(csc_without_tcg(CPUMIPSState *env, uint32_t cs, uint32_t cb,
         target_ulong rt, uint32_t offset))
@@ -1899,7 +2102,8 @@ void CHERI_HELPER_IMPL(csc_without_tcg(CPUMIPSState *env, uint32_t cs, uint32_t
     target_ulong vaddr = get_csc_addr(env, cs, cb, rt, offset, retpc);
     // helper_csc_addr should check for alignment
     cheri_debug_assert(align_of(CHERI_CAP_SIZE, vaddr) == 0);
-    store_cap_to_memory(env, cs, vaddr, retpc);
+    remember_cap_bounds(env, cb);
+    store_cap_to_memory(env, cs, vaddr, retpc, /*conditional=*/false);
 }
 
 void CHERI_HELPER_IMPL(clc_without_tcg(CPUMIPSState *env, uint32_t cd, uint32_t cb,
@@ -1909,7 +2113,8 @@ void CHERI_HELPER_IMPL(clc_without_tcg(CPUMIPSState *env, uint32_t cd, uint32_t
     target_ulong vaddr = get_clc_addr(env, cd, cb, rt, offset, retpc);
     // helper_clc_addr should check for alignment
     cheri_debug_assert(align_of(CHERI_CAP_SIZE, vaddr) == 0);
-    load_cap_from_memory(env, cd, cb, vaddr, retpc, /*physaddr_out=*/NULL);
+    remember_cap_bounds(env, cb);
+    load_cap_from_memory(env, cd, cb, vaddr, retpc, /*linked=*/false);
 }
 
 void CHERI_HELPER_IMPL(cllc_without_tcg(CPUMIPSState *env, uint32_t cd, uint32_t cb))
@@ -1937,11 +2142,10 @@ void CHERI_HELPER_IMPL(cllc_without_tcg(CPUMIPSState *env, uint32_t cd, uint32_t
         do_raise_c0_exception(env, EXCP_AdEL, addr);
     }
     cheri_debug_assert(align_of(CHERI_CAP_SIZE, addr) == 0);
-    hwaddr physaddr;
-    load_cap_from_memory(env, cd, cb, addr, _host_return_address, &physaddr);
+    env->CP0_LLAddr = do_translate_address(env, addr, 0, _host_return_address);
+    load_cap_from_memory(env, cd, cb, addr, _host_return_address, /*linked=*/true);
     env->lladdr = addr;
-    env->CP0_LLAddr = physaddr;
-    env->linkedflag = 1; // FIXME: remove
+    env->linkedflag = 1;
 }
 
 #ifdef CONFIG_MIPS_LOG_INSTR
@@ -1949,7 +2153,7 @@ void CHERI_HELPER_IMPL(cllc_without_tcg(CPUMIPSState *env, uint32_t cd, uint32_t
  * Dump cap tag, otype, permissions and seal bit to cvtrace entry
  */
 static inline void
-cvtrace_dump_cap_perms(cvtrace_t *cvtrace, cap_register_t *cr)
+cvtrace_dump_cap_perms(cvtrace_t *cvtrace, const cap_register_t *cr)
 {
     if (unlikely(qemu_loglevel_mask(CPU_LOG_CVTRACE))) {
         cvtrace->val2 = tswap64(((uint64_t)cr->cr_tag << 63) |
@@ -1972,7 +2176,7 @@ static inline void cvtrace_dump_cap_cbl(cvtrace_t *cvtrace, const cap_register_t
     }
 }
 
-void dump_changed_capreg(CPUMIPSState *env, cap_register_t *cr,
+void dump_changed_capreg(CPUMIPSState *env, const cap_register_t *cr,
         cap_register_t *old_reg, const char* name)
 {
     if (memcmp(cr, old_reg, sizeof(cap_register_t))) {
@@ -2002,7 +2206,7 @@ void dump_changed_cop2(CPUMIPSState *env, TCState *cur) {
 
     dump_changed_capreg(env, &cur->CapBranchTarget, &env->last_CapBranchTarget, "CapBranchTarget");
     for (int i=0; i<32; i++) {
-        dump_changed_capreg(env, &cur->_CGPR[i], &env->last_C[i], capreg_name[i]);
+        dump_changed_capreg(env, get_readonly_capreg(cur, i), &env->last_C[i], capreg_name[i]);
     }
     dump_changed_capreg(env, &cur->CHWR.DDC, &env->last_CHWR.DDC, "DDC");
     dump_changed_capreg(env, &cur->CHWR.UserTlsCap, &env->last_CHWR.UserTlsCap, "UserTlsCap");
@@ -2079,74 +2283,113 @@ static inline void dump_cap_store(uint64_t addr, uint64_t pesbt,
 #endif // CONFIG_MIPS_LOG_INSTR
 
 static void load_cap_from_memory(CPUMIPSState *env, uint32_t cd, uint32_t cb,
-                                 target_ulong vaddr, target_ulong retpc, hwaddr* physaddr)
+                                 target_ulong vaddr, target_ulong retpc, bool linked)
 {
     int prot;
-    cap_register_t ncd;
 
     // Since this is used by cl* we need to treat cb == 0 as $ddc
     const cap_register_t *cbp = get_capreg_0_is_ddc(&env->active_tc, cb);
 
-    // TODO: do one physical translation and then use that to speed up tag read
-    // and use address_space_read to read the full 16 byte buffer
-    /* Load otype and perms from memory (might trap on load) */
-    uint64_t pesbt = cpu_ldq_data_ra(env, vaddr + 0, retpc);
-    uint64_t cursor = cpu_ldq_data_ra(env, vaddr + 8, retpc);
-
-    target_ulong tag = cheri_tag_get(env, vaddr, cb, physaddr, &prot, retpc);
+    uint8_t buf[CHERI_CAP_SIZE];
+    uint64_t pesbt, cursor;
+    target_ulong tag;
+    int host_tag;
+    /*
+     * Fast path: a single TLB lookup yields both the host address of the
+     * capability and its tag.
+     */
+    if (likely(cheri_tag_load_host(env, vaddr, cb, buf, &host_tag, &prot,
+                                   retpc))) {
+        pesbt = ldq_p(buf);
+        cursor = ldq_p(buf + 8);
+        tag = host_tag;
+    } else {
+        /* Load otype and perms from memory (might trap on load) */
+        pesbt = cpu_ldq_data_ra(env, vaddr + 0, retpc);
+        cursor = cpu_ldq_data_ra(env, vaddr + 8, retpc);
+        tag = cheri_tag_get(env, vaddr, cb, NULL, &prot, retpc);
+        stq_p(buf, pesbt);
+        stq_p(buf + 8, cursor);
+    }
+    if (linked)
+        record_linked_cap(env, buf, tag);
     tag = tag_prot_clear_or_trap(env, cb, cbp, prot, retpc, tag);
-    decompress_128cap(pesbt, cursor, &ncd);
-    ncd.cr_tag = tag;
 
-    env->statcounters_cap_read++;
+    env->statcounters.cap_read++;
     if (tag)
-        env->statcounters_cap_read_tagged++;
+        env->statcounters.cap_read_tagged++;
 #ifdef CONFIG_MIPS_LOG_INSTR
     /* Log memory read, if needed. */
     if (unlikely(qemu_loglevel_mask(CPU_LOG_INSTR))) {
-        dump_cap_load(vaddr, compress_128cap(&ncd), cursor, tag);
+        cap_register_t ncd;
+        decompress_128cap(pesbt, cursor, &ncd);
+        ncd.cr_tag = tag;
+        dump_cap_load(vaddr, pesbt, cursor, tag);
         cvtrace_dump_cap_load(&env->cvtrace, vaddr, &ncd);
         cvtrace_dump_cap_cbl(&env->cvtrace, &ncd);
     }
 #endif
 
-    update_capreg(&env->active_tc, cd, &ncd);
+    /* The register file is compressed, so there is nothing to decode. */
+    update_capreg_raw(&env->active_tc, cd, pesbt, cursor, tag);
 }
 
-static void store_cap_to_memory(CPUMIPSState *env, uint32_t cs,
-    target_ulong vaddr, target_ulong retpc)
+static bool store_cap_to_memory(CPUMIPSState *env, uint32_t cs,
+    target_ulong vaddr, target_ulong retpc, bool conditional)
 {
-    const cap_register_t *csp = get_readonly_capreg(&env->active_tc, cs);
-    uint64_t cursor = cap_get_cursor(csp);
-    uint64_t pesbt = compress_128cap(csp);
+    /* Store the raw register words, there is no need to decompress them. */
+    const struct GPCapRegs *regs = &env->active_tc.gpcapregs;
+    bool tag = get_capreg_tag(&env->active_tc, cs);
+    uint64_t cursor = regs->cursor[cs];
+    uint64_t pesbt = get_capreg_state(regs->capreg_state, cs) == CREG_INTEGER ?
+        0 : regs->pesbt[cs];
+    uint8_t buf[CHERI_CAP_SIZE];
+    bool stored = true;
     /*
      * Touching the tags will take both the data write TLB fault and
      * capability write TLB fault before updating anything.  Thereafter, the
      * data stores will not take additional faults, so there is no risk of
-     * accidentally tagging a shorn data write.  This, like the rest of the
-     * tag logic, is not multi-TCG-thread safe.
+     * accidentally tagging a shorn data write.  The fast path writes data
+     * and tag at once for the other vCPUs; the slow path only runs while
+     * they are stopped (or without MTTCG).
      */
-
-    env->statcounters_cap_write++;
-    if (csp->cr_tag) {
-        env->statcounters_cap_write_tagged++;
-        cheri_tag_set(env, vaddr, cs, retpc);
+    stq_p(buf, pesbt);
+    stq_p(buf + 8, cursor);
+
+    /* Fast path: update the tag and write the data through the host page. */
+    if (likely(conditional ?
+               cheri_tag_cmpxchg_host(env, vaddr, cs, env->llcap,
+                                      env->llcap_tag, buf, tag,
+                                      &stored, retpc) :
+               cheri_tag_store_host(env, vaddr, cs, buf, tag, retpc))) {
+        if (!stored)
+            return false;
     } else {
-        cheri_tag_invalidate(env, vaddr, CHERI_CAP_SIZE, retpc);
+        if (conditional)
+            cscc_slow_path(env, retpc);
+        if (tag)
+            cheri_tag_set(env, vaddr, cs, retpc);
+        else
+            cheri_tag_invalidate(env, vaddr, CHERI_CAP_SIZE, retpc);
+        cpu_stq_data_ra(env, vaddr, pesbt, retpc);
+        cpu_stq_data_ra(env, vaddr + 8, cursor, retpc);
     }
 
-    cpu_stq_data_ra(env, vaddr, pesbt, retpc);
-    cpu_stq_data_ra(env, vaddr + 8, cursor, retpc);
+    env->statcounters.cap_write++;
+    if (tag)
+        env->statcounters.cap_write_tagged++;
 
 #ifdef CONFIG_MIPS_LOG_INSTR
     /* Log memory cap write, if needed. */
     if (unlikely(qemu_loglevel_mask(CPU_LOG_INSTR))) {
+        const cap_register_t *csp = get_readonly_capreg(&env->active_tc, cs);
         /* Log memory cap write, if needed. */
-        dump_cap_store(vaddr, pesbt, cap_get_cursor(csp), csp->cr_tag);
+        dump_cap_store(vaddr, pesbt, cursor, tag);
         cvtrace_dump_cap_store(&env->cvtrace, vaddr, csp);
         cvtrace_dump_cap_cbl(&env->cvtrace, csp);
     }
 #endif
+    return true;
 }
 
 #elif defined(CHERI_MAGIC128)
@@ -2180,7 +2423,7 @@ static inline void dump_cap_store(uint64_t addr, uint64_t cursor,
 
 static void load_cap_from_memory(CPUMIPSState *env, uint32_t cd, uint32_t cb,
                                  target_ulong vaddr, target_ulong retpc,
-                                 hwaddr *physaddr) {
+                                 bool linked) {
     int prot;
     cap_register_t ncd;
 
@@ -2196,12 +2439,12 @@ static void load_cap_from_memory(CPUMIPSState *env, uint32_t cd, uint32_t cb,
     /* Load the two magic values */
     target_ulong tag =
         cheri_tag_get_m128(env, vaddr, cd, &mem_buffer.u64s[0] /* tps */,
-                           &mem_buffer.u64s[3] /* length */, physaddr, &prot, retpc);
+                           &mem_buffer.u64s[3] /* length */, NULL, &prot, retpc);
 
     tag = tag_prot_clear_or_trap(env, cb, cbp, prot, retpc, tag);
-    env->statcounters_cap_read++;
+    env->statcounters.cap_read++;
     if (tag)
-        env->statcounters_cap_read_tagged++;
+        env->statcounters.cap_read_tagged++;
 
     // XOR with -1 so that NULL is zero in memory, etc.
     decompress_256cap(mem_buffer, &ncd, tag);
@@ -2218,8 +2461,14 @@ static void load_cap_from_memory(CPUMIPSState *env, uint32_t cd, uint32_t cb,
     update_capreg(&env->active_tc, cd, &ncd);
 }
 
-static void store_cap_to_memory(CPUMIPSState *env, uint32_t cs,
-                                target_ulong vaddr, target_ulong retpc) {
+/*
+ * The magic values live next to the tags and are not updated atomically with
+ * the data, so this format is not supported with MTTCG and CSCC only relies
+ * on the linkedflag (@conditional is ignored).
+ */
+static bool store_cap_to_memory(CPUMIPSState *env, uint32_t cs,
+                                target_ulong vaddr, target_ulong retpc,
+                                bool conditional) {
     const cap_register_t *csp = get_readonly_capreg(&env->active_tc, cs);
     inmemory_chericap256 mem_buffer;
     compress_256cap(&mem_buffer, csp);
@@ -2233,9 +2482,9 @@ static void store_cap_to_memory(CPUMIPSState *env, uint32_t cs,
     /* Store the "magic" data with the tags */
     cheri_tag_set_m128(env, vaddr, cs, csp->cr_tag, mem_buffer.u64s[0] /* tps */,
                        mem_buffer.u64s[3] /* length */, NULL, retpc);
-    env->statcounters_cap_write++;
+    env->statcounters.cap_write++;
     if (csp->cr_tag) {
-        env->statcounters_cap_write_tagged++;
+        env->statcounters.cap_write_tagged++;
     }
     cpu_stq_data_ra(env, vaddr, mem_buffer.u64s[2], retpc); /* base */
     cpu_stq_data_ra(env, vaddr + 8, mem_buffer.u64s[1], retpc);
@@ -2249,6 +2498,7 @@ static void store_cap_to_memory(CPUMIPSState *env, uint32_t cs,
         dump_cap_store(vaddr, cap_get_cursor(csp), csp->cr_base, csp->cr_tag);
     }
 #endif
+    return true;
 }
 
 #else /* ! CHERI_MAGIC128 */
@@ -2317,7 +2567,7 @@ static inline void dump_cap_store_length(uint64_t length)
 #endif // CONFIG_MIPS_LOG_INSTR
 
 static void load_cap_from_memory(CPUMIPSState *env, uint32_t cd, uint32_t cb,
-                                 target_ulong vaddr, target_ulong retpc, hwaddr* physaddr)
+                                 target_ulong vaddr, target_ulong retpc, bool linked)
 {
     cap_register_t ncd;
     int prot;
@@ -2325,19 +2575,31 @@ static void load_cap_from_memory(CPUMIPSState *env, uint32_t cd, uint32_t cb,
     // Since this is used by cl* we need to treat cb == 0 as $ddc
     const cap_register_t *cbp = get_capreg_0_is_ddc(&env->active_tc, cb);
 
-    // TODO: do one physical translation and then use that to speed up tag read
-    /* Load otype and perms from memory (might trap on load) */
     inmemory_chericap256 mem_buffer;
-    mem_buffer.u64s[0] = cpu_ldq_data_ra(env, vaddr + 0, retpc); /* perms+otype */
-    mem_buffer.u64s[1] = cpu_ldq_data_ra(env, vaddr + 8, retpc); /* cursor */
-    mem_buffer.u64s[2] = cpu_ldq_data_ra(env, vaddr + 16, retpc); /* base */
-    mem_buffer.u64s[3] = cpu_ldq_data_ra(env, vaddr + 24, retpc); /* length */
-
-    target_ulong tag = cheri_tag_get(env, vaddr, cd, physaddr, &prot, retpc);
+    uint8_t buf[CHERI_CAP_SIZE];
+    target_ulong tag;
+    int host_tag;
+    if (likely(cheri_tag_load_host(env, vaddr, cd, buf, &host_tag, &prot,
+                                   retpc))) {
+        for (int i = 0; i < 4; i++)
+            mem_buffer.u64s[i] = ldq_p(buf + 8 * i);
+        tag = host_tag;
+    } else {
+        /* Load otype and perms from memory (might trap on load) */
+        mem_buffer.u64s[0] = cpu_ldq_data_ra(env, vaddr + 0, retpc); /* perms+otype */
+        mem_buffer.u64s[1] = cpu_ldq_data_ra(env, vaddr + 8, retpc); /* cursor */
+        mem_buffer.u64s[2] = cpu_ldq_data_ra(env, vaddr + 16, retpc); /* base */
+        mem_buffer.u64s[3] = cpu_ldq_data_ra(env, vaddr + 24, retpc); /* length */
+        tag = cheri_tag_get(env, vaddr, cd, NULL, &prot, retpc);
+        for (int i = 0; i < 4; i++)
+            stq_p(buf + 8 * i, mem_buffer.u64s[i]);
+    }
+    if (linked)
+        record_linked_cap(env, buf, tag);
     tag = tag_prot_clear_or_trap(env, cb, cbp, prot, retpc, tag);
-    env->statcounters_cap_read++;
+    env->statcounters.cap_read++;
     if (tag)
-        env->statcounters_cap_read_tagged++;
+        env->statcounters.cap_read_tagged++;
 
     // XOR with -1 so that NULL is zero in memory, etc.
     decompress_256cap(mem_buffer, &ncd, tag);
@@ -2378,33 +2640,49 @@ static inline void cvtrace_dump_cap_length(cvtrace_t *cvtrace, uint64_t length)
 }
 #endif // CONFIG_MIPS_LOG_INSTR
 
-static void store_cap_to_memory(CPUMIPSState *env, uint32_t cs,
-    target_ulong vaddr, target_ulong retpc)
+static bool store_cap_to_memory(CPUMIPSState *env, uint32_t cs,
+    target_ulong vaddr, target_ulong retpc, bool conditional)
 {
     const cap_register_t *csp = get_readonly_capreg(&env->active_tc, cs);
     inmemory_chericap256 mem_buffer;
+    uint8_t buf[CHERI_CAP_SIZE];
+    bool stored = true;
     compress_256cap(&mem_buffer, csp);
 
     /*
      * Touching the tags will take both the data write TLB fault and
      * capability write TLB fault before updating anything.  Thereafter, the
      * data stores will not take additional faults, so there is no risk of
-     * accidentally tagging a shorn data write.  This, like the rest of the
-     * tag logic, is not multi-TCG-thread safe.
+     * accidentally tagging a shorn data write.  The fast path writes data
+     * and tag at once for the other vCPUs; the slow path only runs while
+     * they are stopped (or without MTTCG).
      */
-
-    env->statcounters_cap_write++;
-    if (csp->cr_tag) {
-        env->statcounters_cap_write_tagged++;
-        cheri_tag_set(env, vaddr, cs, retpc);
+    for (int i = 0; i < 4; i++)
+        stq_p(buf + 8 * i, mem_buffer.u64s[i]);
+
+    if (likely(conditional ?
+               cheri_tag_cmpxchg_host(env, vaddr, cs, env->llcap,
+                                      env->llcap_tag, buf, csp->cr_tag,
+                                      &stored, retpc) :
+               cheri_tag_store_host(env, vaddr, cs, buf, csp->cr_tag, retpc))) {
+        if (!stored)
+            return false;
     } else {
-        cheri_tag_invalidate(env, vaddr, CHERI_CAP_SIZE, retpc);
+        if (conditional)
+            cscc_slow_path(env, retpc);
+        if (csp->cr_tag)
+            cheri_tag_set(env, vaddr, cs, retpc);
+        else
+            cheri_tag_invalidate(env, vaddr, CHERI_CAP_SIZE, retpc);
+        cpu_stq_data_ra(env, vaddr + 0, mem_buffer.u64s[0], retpc);
+        cpu_stq_data_ra(env, vaddr + 8, mem_buffer.u64s[1], retpc);
+        cpu_stq_data_ra(env, vaddr + 16, mem_buffer.u64s[2], retpc);
+        cpu_stq_data_ra(env, vaddr + 24, mem_buffer.u64s[3], retpc);
     }
 
-    cpu_stq_data_ra(env, vaddr + 0, mem_buffer.u64s[0], retpc);
-    cpu_stq_data_ra(env, vaddr + 8, mem_buffer.u64s[1], retpc);
-    cpu_stq_data_ra(env, vaddr + 16, mem_buffer.u64s[2], retpc);
-    cpu_stq_data_ra(env, vaddr + 24, mem_buffer.u64s[3], retpc);
+    env->statcounters.cap_write++;
+    if (csp->cr_tag)
+        env->statcounters.cap_write_tagged++;
 
 #ifdef CONFIG_MIPS_LOG_INSTR
     /* Log memory cap write, if needed. */
@@ -2420,6 +2698,7 @@ static void store_cap_to_memory(CPUMIPSState *env, uint32_t cs,
         cvtrace_dump_cap_length(&env->cvtrace, cap_get_length64(csp));
     }
 #endif
+    return true;
 }
 
 #endif /* ! CHERI_MAGIC128 */
@@ -2443,38 +2722,15 @@ void CHERI_HELPER_IMPL(ccheck_pc(CPUMIPSState *env, uint64_t next_pc))
 {
     cap_register_t *pcc = &env->active_tc.PCC;
 
-#ifdef CONFIG_MIPS_LOG_INSTR
-    /* Print changed state before advancing to the next instruction: GPR, HI/LO, COP0. */
-    const bool should_log_instr =
-        qemu_loglevel_mask(CPU_LOG_CVTRACE | CPU_LOG_INSTR | CPU_LOG_USER_ONLY) || env->user_only_tracing_enabled;
-    if (unlikely(should_log_instr))
-        helper_dump_changed_state(env);
-#endif
-
-    /* Update statcounters icount */
-    env->statcounters_icount++;
-    if (in_kernel_mode(env)) {
-        assert(((env->hflags & MIPS_HFLAG_CP0) == MIPS_HFLAG_CP0) == can_access_cp0(env));
-        env->statcounters_icount_kernel++;
-    } else {
-        assert((env->hflags & MIPS_HFLAG_CP0) == 0);
-        env->statcounters_icount_user++;
-    }
-
-    // branch instructions have already checked the validity of the target,
-    // but we still need to check if the next instruction is accessible.
-    // In order to ensure that EPC is set correctly we must set the offset
-    // before checking the bounds.
+    /*
+     * This is only called for instructions that translation found to be
+     * outside of $pcc (or when $pcc is not usable for execution), so this
+     * check will raise an exception. Branch instructions have already checked
+     * the validity of the target. In order to ensure that EPC is set correctly
+     * we must set the offset before checking the bounds.
+     */
     pcc->_cr_cursor = next_pc;
     check_cap(env, pcc, CAP_PERM_EXECUTE, next_pc, 0xff, 4, /*instavail=*/false, GETPC());
-    // qemu_log("PC:%016lx\n", pc);
-
-#ifdef CONFIG_MIPS_LOG_INSTR
-    // Finally, log the instruction that will be executed next
-    if (unlikely(should_log_instr)) {
-        helper_log_instruction(env, next_pc);
-    }
-#endif
 }
 
 target_ulong CHERI_HELPER_IMPL(ccheck_load_right(CPUMIPSState *env, target_ulong offset, uint32_t len))
@@ -2591,8 +2847,8 @@ void cheri_dump_state(CPUState *cs, FILE *f, fprintf_function cpu_fprintf, int f
     for (i = 0; i < 32; i++) {
         // snprintf(name, sizeof(name), "C%02d", i);
         snprintf(name, sizeof(name), "REG %02d", i);
-        cheri_dump_creg(&env->active_tc._CGPR[i], name, cheri_cap_reg[i], f,
-                cpu_fprintf);
+        cheri_dump_creg(get_readonly_capreg(&env->active_tc, i), name,
+                cheri_cap_reg[i], f, cpu_fprintf);
     }
     cheri_dump_creg(&env->active_tc.CHWR.DDC,        "HWREG 00 (DDC)", "", f, cpu_fprintf);
     cheri_dump_creg(&env->active_tc.CHWR.UserTlsCap, "HWREG 01 (CTLSU)", "", f, cpu_fprintf);
@@ -38,6 +38,16 @@
 #include "exec/log.h"
 #include "cpu.h"
 #include "internal.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/thread.h"
+#ifndef CONFIG_USER_ONLY
+#include "monitor/hmp.h"
+#include "monitor/hmp-target.h"
+#include "monitor/monitor.h"
+#include "qapi/qapi-commands-misc-target.h"
+#include "qapi/qmp/qdict.h"
+#endif
 
 #ifdef CONFIG_MIPS_LOG_INSTR
 
@@ -51,6 +61,36 @@ extern int cl_default_trace_format;
 #define user_trace_dbg(...)
 #endif
 
+/*
+ * qemu_loglevel is global, but the tracing state that decides which bits to
+ * change is per vCPU. Serialize the read-modify-write of the log level so
+ * that vCPUs switching tracing on and off concurrently don't lose updates.
+ */
+static QemuMutex trace_loglevel_lock;
+
+static void __attribute__((__constructor__)) trace_loglevel_lock_init(void)
+{
+    qemu_mutex_init(&trace_loglevel_lock);
+}
+
+static void update_trace_loglevel(int set, int clear)
+{
+    int mask;
+
+    qemu_mutex_lock(&trace_loglevel_lock);
+    mask = (qemu_loglevel | set) & ~clear;
+    /*
+     * Chained TBs are not looked up again, so switching the TB key bit for
+     * logging needs a flush. User-only tracing keeps CPU_LOG_USER_ONLY set
+     * while it is suspended, so the mode switches don't get here.
+     */
+    if (!qemu_loglevel_mask(CPU_LOG_INSTR_ANY) != !(mask & CPU_LOG_INSTR_ANY)) {
+        tb_flush(current_cpu);
+    }
+    qemu_set_log(mask);
+    qemu_mutex_unlock(&trace_loglevel_lock);
+}
+
 /* Start instruction trace logging. */
 void helper_instr_start(CPUMIPSState *env, target_ulong pc)
 {
@@ -63,7 +103,7 @@ void helper_instr_start(CPUMIPSState *env, target_ulong pc)
             pc, env->CP0_EntryHi & 0xFF);
         env->tracing_suspended = true;
     } else {
-        qemu_set_log(qemu_loglevel | cl_default_trace_format);
+        update_trace_loglevel(cl_default_trace_format, 0);
         user_trace_dbg("Switching on tracing @ 0x%lx ASID %lu\n",
             pc, env->CP0_EntryHi & 0xFF);
         env->tracing_suspended = false;
@@ -75,7 +115,8 @@ void helper_instr_stop(CPUMIPSState *env, target_ulong pc)
 {
     user_trace_dbg("Switching off tracing @ 0x%lx ASID %lu\n",
         pc, env->CP0_EntryHi & 0xFF);
-    qemu_set_log(qemu_loglevel & ~cl_default_trace_format);
+    cvtrace_buffer_finish();
+    update_trace_loglevel(0, cl_default_trace_format);
     /* Make sure a kernel -> user switch does not turn on tracing */
     env->tracing_suspended = false;
     /* don't turn on on next kernel -> userspace change */
@@ -89,13 +130,14 @@ void helper_instr_start_user_mode_only(CPUMIPSState *env, target_ulong pc)
      * Make sure that qemu_loglevel doesn't get set to zero when we
      * suspend tracing because otherwise qemu will close the logfile.
      */
-    qemu_set_log(qemu_loglevel | CPU_LOG_USER_ONLY);
+    update_trace_loglevel(CPU_LOG_USER_ONLY, 0);
     user_trace_dbg("User-mode only tracing enabled at 0x%lx, ASID %lu\n",
         pc, env->CP0_EntryHi & 0xFF);
     env->user_only_tracing_enabled = true;
     /* Disable tracing if we are not currently in user mode */
     if (!IN_USERSPACE(env)) {
-        qemu_set_log(qemu_loglevel & ~cl_default_trace_format);
+        cvtrace_buffer_flush();
+        update_trace_loglevel(0, cl_default_trace_format);
         env->tracing_suspended = true;
     } else {
         env->tracing_suspended = false;
@@ -109,13 +151,19 @@ void helper_instr_stop_user_mode_only(CPUMIPSState *env, target_ulong pc)
     if (env->tracing_suspended && !env->trace_explicitly_disabled) {
         user_trace_dbg("User-only trace turned off -> Restoring old trace level"
             " at 0x%lx, ASID %lu\n", pc, env->CP0_EntryHi & 0xFF);
-        qemu_set_log(qemu_loglevel | cl_default_trace_format);
+        update_trace_loglevel(cl_default_trace_format, 0);
     }
     env->tracing_suspended = false;
     env->user_only_tracing_enabled = false;
     user_trace_dbg("User-mode only tracing disabled at 0x%lx, ASID %lu\n",
         pc, env->CP0_EntryHi & 0xFF);
-    qemu_set_log(qemu_loglevel & ~CPU_LOG_USER_ONLY);
+    /* The log file may be closed if this also ends the normal tracing */
+    if (qemu_loglevel_mask(cl_default_trace_format)) {
+        cvtrace_buffer_flush();
+    } else {
+        cvtrace_buffer_finish();
+    }
+    update_trace_loglevel(0, CPU_LOG_USER_ONLY);
 }
 
 void do_hexdump(FILE* f, uint8_t* buffer, target_ulong length, target_ulong vaddr) {
@@ -271,20 +319,15 @@ void helper_log_instruction(CPUMIPSState *env, target_ulong pc)
         uint32_t opcode;
         CPUState *cs = env_cpu(env);
 
-        FILE* logfile = qemu_log_lock();
-        /* if the logfile is empty we need to emit the cvt magic */
-        if (env->cvtrace.version != 0 && ftell(logfile) != 0) {
-            /* Write previous instruction trace to log. */
-            fwrite(&env->cvtrace, sizeof(env->cvtrace), 1, logfile);
+        /*
+         * Queue the previous instruction's record; the writer thread emits
+         * the cvt magic when the logfile is empty (see cvtrace_buffer.c).
+         */
+        if (env->cvtrace.version != 0) {
+            cvtrace_buffer_push(env, &env->cvtrace);
         } else {
-            char buffer[sizeof(env->cvtrace)];
-
-            buffer[0] = CVT_QEMU_VERSION;
-            g_strlcpy(buffer+1, CVT_QEMU_MAGIC, sizeof(env->cvtrace)-2);
-            fwrite(buffer, sizeof(env->cvtrace), 1, logfile);
             cycles = 0;
         }
-        qemu_log_unlock(logfile);
         bzero(&env->cvtrace, sizeof(env->cvtrace));
         env->cvtrace.version = CVT_NO_REG;
         env->cvtrace.pc = tswap64(pc);
@@ -700,7 +743,8 @@ static void update_tracing_on_mode_change(CPUMIPSState *env, const char* new_mod
         user_trace_dbg("%s -> %s: 0x%lx ASID %lu -- switching off tracing \n",
             env->last_mode, new_mode, env->active_tc.PC, env->CP0_EntryHi & 0xFF);
         env->tracing_suspended = true;
-        qemu_set_log(qemu_loglevel & ~cl_default_trace_format);
+        cvtrace_buffer_flush();
+        update_trace_loglevel(0, cl_default_trace_format);
     } else if (strcmp(new_mode, TRACE_MODE_USER) == 0) {
         /* When changing back to user mode restore instruction tracing */
         assert(!IN_USERSPACE(env));
@@ -709,7 +753,7 @@ static void update_tracing_on_mode_change(CPUMIPSState *env, const char* new_mod
                 "Tracing was explicitly disabled, ASID=%lu\n",
                 env->last_mode, new_mode, env->active_tc.PC, env->CP0_EntryHi & 0xFF);
         } else if (env->tracing_suspended) {
-            qemu_set_log(qemu_loglevel | cl_default_trace_format);
+            update_trace_loglevel(cl_default_trace_format, 0);
             user_trace_dbg("%s -> %s 0x%lx ASID %lu -- switching on tracing\n",
                 env->last_mode, new_mode, env->active_tc.PC, env->CP0_EntryHi & 0xFF);
             env->tracing_suspended = false;
@@ -844,6 +888,143 @@ void helper_dump_load32(CPUMIPSState *env, target_ulong addr, uint32_t value, Me
     helper_dump_load(env, addr, (target_ulong)value, op);
 }
 
+struct cheri_trace_filter cheri_trace_filter;
+
+#ifndef CONFIG_USER_ONLY
+/* Parse "N" or "N-M" into an inclusive range. */
+static bool parse_trace_filter_range(const char *str, uint64_t *start,
+                                     uint64_t *end)
+{
+    const char *rest;
+
+    if (qemu_strtou64(str, &rest, 0, start) != 0) {
+        return false;
+    }
+    if (*rest == '\0') {
+        *end = *start;
+        return true;
+    }
+    if (*rest != '-' || qemu_strtou64(rest + 1, NULL, 0, end) != 0) {
+        return false;
+    }
+    return *start <= *end;
+}
+
+/*
+ * The filter is a comma separated list of asid=N[-M] and range=START-END
+ * items. ASIDs and ranges are each combined with "or"; an instruction is only
+ * logged if both its ASID and its PC match. An empty filter or "none" logs
+ * everything.
+ */
+static bool parse_trace_filter(const char *spec,
+                               struct cheri_trace_filter *filter,
+                               Error **errp)
+{
+    gchar **items = g_strsplit(spec, ",", 0);
+    bool ok = false;
+    int i;
+
+    memset(filter, 0, sizeof(*filter));
+    for (i = 0; items[i]; i++) {
+        const char *item = items[i];
+        uint64_t start, end, asid;
+
+        if (*item == '\0' || strcmp(item, "none") == 0) {
+            continue;
+        } else if (strstart(item, "asid=", &item)) {
+            if (!parse_trace_filter_range(item, &start, &end) || end > 0xff) {
+                error_setg(errp, "invalid ASID range '%s'", item);
+                goto out;
+            }
+            filter->filter_asids = true;
+            for (asid = start; asid <= end; asid++) {
+                filter->asids[asid / 64] |= UINT64_C(1) << (asid % 64);
+            }
+        } else if (strstart(item, "range=", &item)) {
+            if (filter->num_ranges == CHERI_TRACE_FILTER_MAX_RANGES) {
+                error_setg(errp, "at most %d address ranges are supported",
+                           CHERI_TRACE_FILTER_MAX_RANGES);
+                goto out;
+            }
+            if (!parse_trace_filter_range(item, &start, &end)) {
+                error_setg(errp, "invalid address range '%s'", item);
+                goto out;
+            }
+            filter->ranges[filter->num_ranges].start = start;
+            filter->ranges[filter->num_ranges].end = end;
+            filter->num_ranges++;
+        } else {
+            error_setg(errp, "invalid trace filter '%s'", item);
+            goto out;
+        }
+    }
+    ok = true;
+out:
+    g_strfreev(items);
+    return ok;
+}
+
+static void do_set_trace_filter(CPUState *cpu, run_on_cpu_data data)
+{
+    struct cheri_trace_filter *filter = data.host_ptr;
+
+    cheri_trace_filter = *filter;
+    g_free(filter);
+    /* Throw away code that was translated with the old filter. */
+    tb_flush(cpu);
+}
+
+void qmp_cheri_trace_filter(const char *filter, Error **errp)
+{
+    struct cheri_trace_filter *new_filter = g_new(struct cheri_trace_filter, 1);
+
+    if (!parse_trace_filter(filter, new_filter, errp)) {
+        g_free(new_filter);
+        return;
+    }
+    if (!first_cpu) {
+        /* Command line option, nothing has been translated yet. */
+        cheri_trace_filter = *new_filter;
+        g_free(new_filter);
+        return;
+    }
+    async_safe_run_on_cpu(first_cpu, do_set_trace_filter,
+                          RUN_ON_CPU_HOST_PTR(new_filter));
+}
+
+void hmp_cheri_trace_filter(Monitor *mon, const QDict *qdict)
+{
+    const char *filter = qdict_get_try_str(qdict, "filter");
+    Error *err = NULL;
+    unsigned i;
+
+    if (filter) {
+        qmp_cheri_trace_filter(filter, &err);
+        hmp_handle_error(mon, err);
+        return;
+    }
+    if (!cheri_trace_filter.filter_asids &&
+        cheri_trace_filter.num_ranges == 0) {
+        monitor_printf(mon, "No trace filter set\n");
+        return;
+    }
+    if (cheri_trace_filter.filter_asids) {
+        monitor_printf(mon, "ASIDs:");
+        for (i = 0; i < 256; i++) {
+            if (cheri_trace_filter_allows_asid(i)) {
+                monitor_printf(mon, " %u", i);
+            }
+        }
+        monitor_printf(mon, "\n");
+    }
+    for (i = 0; i < cheri_trace_filter.num_ranges; i++) {
+        monitor_printf(mon, "Range: 0x%" PRIx64 "-0x%" PRIx64 "\n",
+                       cheri_trace_filter.ranges[i].start,
+                       cheri_trace_filter.ranges[i].end);
+    }
+}
+#endif /* !CONFIG_USER_ONLY */
+
 #endif // CONFIG_MIPS_LOG_INSTR
 
 static void simple_dump_state(CPUMIPSState *env, FILE *f,
@@ -2796,6 +2796,12 @@ typedef struct DisasContext {
 #endif /* TARGET_CHERI */
     bool mi;
     int gi;
+#ifdef TARGET_CHERI
+    TCGOp *statcounters_icount_op;
+#endif
+#ifdef CONFIG_MIPS_LOG_INSTR
+    bool prev_insn_logged;
+#endif
 } DisasContext;
 
 #define DISAS_STOP       DISAS_TARGET_0
@@ -3736,6 +3742,11 @@ static inline void gen_ddc_interposed_st_i32(TCGv_i32 value,
 #define gen_ddc_interposed_st_tl gen_ddc_interposed_st_i64
 #endif
 
+/* EVA accesses use the user mode MMU index of the current ASID slot. */
+static inline int eva_mem_idx(DisasContext *ctx)
+{
+    return (ctx->mem_idx & ~MIPS_MMU_IDX_MODE_MASK) | MIPS_HFLAG_UM;
+}
 
 /* Load */
 static void gen_ld(DisasContext *ctx, uint32_t opc,
@@ -3850,7 +3861,7 @@ static void gen_ld(DisasContext *ctx, uint32_t opc,
         gen_store_gpr(t0, rt);
         break;
     case OPC_LWE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_LW:
         gen_ddc_interposed_ld_tl(t0, ddc_interposed, t0, mem_idx,
@@ -3858,7 +3869,7 @@ static void gen_ld(DisasContext *ctx, uint32_t opc,
         gen_store_gpr(t0, rt);
         break;
     case OPC_LHE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_LH:
         gen_ddc_interposed_ld_tl(t0, ddc_interposed, t0, mem_idx,
@@ -3866,7 +3877,7 @@ static void gen_ld(DisasContext *ctx, uint32_t opc,
         gen_store_gpr(t0, rt);
         break;
     case OPC_LHUE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_LHU:
         gen_ddc_interposed_ld_tl(t0, ddc_interposed, t0, mem_idx,
@@ -3874,7 +3885,7 @@ static void gen_ld(DisasContext *ctx, uint32_t opc,
         gen_store_gpr(t0, rt);
         break;
     case OPC_LBE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_LB:
         gen_ddc_interposed_ld_tl(t0, ddc_interposed, t0, mem_idx,
@@ -3882,7 +3893,7 @@ static void gen_ld(DisasContext *ctx, uint32_t opc,
         gen_store_gpr(t0, rt);
         break;
     case OPC_LBUE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_LBU:
         gen_ddc_interposed_ld_tl(t0, ddc_interposed, t0, mem_idx,
@@ -3890,7 +3901,7 @@ static void gen_ld(DisasContext *ctx, uint32_t opc,
         gen_store_gpr(t0, rt);
         break;
     case OPC_LWLE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_LWL:
         t1 = tcg_temp_new();
@@ -3919,7 +3930,7 @@ static void gen_ld(DisasContext *ctx, uint32_t opc,
         gen_store_gpr(t0, rt);
         break;
     case OPC_LWRE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_LWR:
         generate_ccheck_load_right(ddc_interposed, t0, 4);
@@ -3949,7 +3960,7 @@ static void gen_ld(DisasContext *ctx, uint32_t opc,
         gen_store_gpr(t0, rt);
         break;
     case OPC_LLE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_LL:
     case R6_OPC_LL:
@@ -4016,33 +4027,33 @@ static void gen_st(DisasContext *ctx, uint32_t opc, int rt,
         break;
 #endif
     case OPC_SWE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_SW:
         gen_ddc_interposed_st_tl(t1, NULL/* add $ddc to t0*/, t0, mem_idx,
                                  MO_TEUL | ctx->default_tcg_memop_mask, opc);
         break;
     case OPC_SHE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_SH:
         gen_ddc_interposed_st_tl(t1, NULL/* add $ddc to t0*/, t0, mem_idx,
                                  MO_TEUW | ctx->default_tcg_memop_mask, opc);
         break;
     case OPC_SBE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_SB:
         gen_ddc_interposed_st_tl(t1, NULL/* add $ddc to t0*/, t0, mem_idx, MO_8, opc);
         break;
     case OPC_SWLE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_SWL:
         gen_helper_0e2i(swl, t1, t0, mem_idx);
         break;
     case OPC_SWRE:
-        mem_idx = MIPS_HFLAG_UM;
+        mem_idx = eva_mem_idx(ctx);
         /* fall through */
     case OPC_SWR:
         gen_helper_0e2i(swr, t1, t0, mem_idx);
@@ -4113,7 +4124,7 @@ static void gen_st_cond(DisasContext *ctx, int rt, int base, int offset,
     //    DEBUG_VALUE(cpu_llval);
     //    DEBUG_VALUE(val);
     tcg_gen_atomic_cmpxchg_tl_with_checked_addr(
-        t0, addr, cpu_llval, val, eva ? MIPS_HFLAG_UM : ctx->mem_idx, tcg_mo);
+        t0, addr, cpu_llval, val, eva ? eva_mem_idx(ctx) : ctx->mem_idx, tcg_mo);
 
     //    DEBUG_VALUE(t0);
     tcg_gen_setcond_tl(TCG_COND_EQ, t0, t0, cpu_llval);
@@ -4156,7 +4167,7 @@ static void gen_scwp(DisasContext *ctx, uint32_t base, int16_t offset,
 
     tcg_gen_ld_i64(llval, cpu_env, offsetof(CPUMIPSState, llval_wp));
     tcg_gen_atomic_cmpxchg_i64(val, taddr, llval, tval,
-                               eva ? MIPS_HFLAG_UM : ctx->mem_idx, MO_64);
+                               eva ? eva_mem_idx(ctx) : ctx->mem_idx, MO_64);
     if (reg1 != 0) {
         tcg_gen_movi_tl(cpu_gpr[reg1], 1);
     }
@@ -4353,20 +4364,28 @@ static void gen_logic_imm(DisasContext *ctx, uint32_t opc,
 #ifdef CONFIG_MIPS_LOG_INSTR
         if (opc == OPC_ORI && rs == 0) {
             /* With 'li $0, 0xbeef' turn on instruction trace logging. */
-            if ((uint16_t)imm == 0xbeef)
+            if ((uint16_t)imm == 0xbeef) {
                 GEN_CHERI_TRACE_HELPER(cpu_env, instr_start);
+                generate_log_state_changed(ctx);
+            }
 
             /* With 'li $0, 0xdead' turn off instruction trace logging. */
-            if ((uint16_t)imm == 0xdead)
+            if ((uint16_t)imm == 0xdead) {
                 GEN_CHERI_TRACE_HELPER(cpu_env, instr_stop);
+                generate_log_state_changed(ctx);
+            }
 
             /* With 'li $0, 0xdeaf' switch to userspace-only instruction trace logging. */
-            if ((uint16_t)imm == 0xdeaf)
+            if ((uint16_t)imm == 0xdeaf) {
                 GEN_CHERI_TRACE_HELPER(cpu_env, instr_start_user_mode_only);
+                generate_log_state_changed(ctx);
+            }
 
             /* With 'li $0, 0xfaed' switch off userspace-only instruction trace logging. */
-            if ((uint16_t)imm == 0xfaed)
+            if ((uint16_t)imm == 0xfaed) {
                 GEN_CHERI_TRACE_HELPER(cpu_env, instr_stop_user_mode_only);
+                generate_log_state_changed(ctx);
+            }
 
             if ((uint16_t)imm == 0xface)
                 GEN_CHERI_TRACE_HELPER(cpu_env, cheri_debug_message);
@@ -7690,7 +7709,7 @@ static void gen_mfc0(DisasContext *ctx, TCGv arg, int reg, int sel)
             break;
         case CP0_REG04__MMID:
             CP0_CHECK(ctx->mi);
-            gen_helper_mtc0_memorymapid(cpu_env, arg);
+            gen_mfc0_load32(arg, offsetof(CPUMIPSState, CP0_MemoryMapID));
             register_name = "MMID";
             break;
         default:
@@ -8463,8 +8482,10 @@ static void gen_mtc0(DisasContext *ctx, TCGv arg, int reg, int sel)
             break;
         case CP0_REG04__MMID:
             CP0_CHECK(ctx->mi);
-            gen_mfc0_load32(arg, offsetof(CPUMIPSState, CP0_MemoryMapID));
+            gen_helper_mtc0_memorymapid(cpu_env, arg);
             register_name = "MMID";
+            /* Stop translation as we may have switched the ASID slot */
+            ctx->base.is_jmp = DISAS_STOP;
             break;
         default:
             goto cp0_unimplemented;
@@ -8617,6 +8638,8 @@ static void gen_mtc0(DisasContext *ctx, TCGv arg, int reg, int sel)
         case CP0_REG10__ENTRYHI:
             gen_helper_mtc0_entryhi(cpu_env, arg);
             register_name = "EntryHi";
+            /* Stop translation as we may have switched the ASID slot */
+            ctx->base.is_jmp = DISAS_STOP;
             break;
         default:
             goto cp0_unimplemented;
@@ -9242,7 +9265,7 @@ static void gen_dmfc0(DisasContext *ctx, TCGv arg, int reg, int sel)
             break;
         case CP0_REG04__MMID:
             CP0_CHECK(ctx->mi);
-            gen_helper_mtc0_memorymapid(cpu_env, arg);
+            gen_mfc0_load32(arg, offsetof(CPUMIPSState, CP0_MemoryMapID));
             register_name = "MMID";
             break;
         default:
@@ -10002,8 +10025,10 @@ static void gen_dmtc0(DisasContext *ctx, TCGv arg, int reg, int sel)
             break;
         case CP0_REG04__MMID:
             CP0_CHECK(ctx->mi);
-            gen_mfc0_load32(arg, offsetof(CPUMIPSState, CP0_MemoryMapID));
+            gen_helper_mtc0_memorymapid(cpu_env, arg);
             register_name = "MMID";
+            /* Stop translation as we may have switched the ASID slot */
+            ctx->base.is_jmp = DISAS_STOP;
             break;
         default:
             goto cp0_unimplemented;
@@ -10163,6 +10188,8 @@ static void gen_dmtc0(DisasContext *ctx, TCGv arg, int reg, int sel)
         case CP0_REG10__ENTRYHI:
             gen_helper_mtc0_entryhi(cpu_env, arg);
             register_name = "EntryHi";
+            /* Stop translation as we may have switched the ASID slot */
+            ctx->base.is_jmp = DISAS_STOP;
             break;
         default:
             goto cp0_unimplemented;
@@ -11172,6 +11199,8 @@ static void gen_cp0(CPUMIPSState *env, DisasContext *ctx, uint32_t opc,
             goto die;
         }
         gen_helper_tlbr(cpu_env);
+        /* Stop translation as we may have switched the ASID slot */
+        ctx->base.is_jmp = DISAS_STOP;
         break;
     case OPC_ERET: /* OPC_ERETNC */
         if ((ctx->insn_flags & ISA_MIPS32R6) &&
@@ -13859,7 +13888,12 @@ static void gen_branch(DisasContext *ctx, int insn_bytes)
                 save_cpu_state(ctx, 0);
                 gen_helper_0e0i(raise_exception, EXCP_DEBUG);
             }
-            tcg_gen_exit_tb(NULL, 0);
+            /*
+             * The bounds of $pcc are part of the TB key (see
+             * cpu_get_tb_cpu_state_cheri()), so the target can be looked up
+             * with the new $pcc without going back to the main loop.
+             */
+            tcg_gen_lookup_and_goto_ptr();
             break;
 #endif /* TARGET_CHERI */
         default:
@@ -31695,6 +31729,15 @@ static void mips_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     ctx->abs2008 = (env->active_fpu.fcr31 >> FCR31_ABS2008) & 1;
     ctx->mi = (env->CP0_Config5 >> CP0C5_MI) & 1;
     ctx->gi = (env->CP0_Config5 >> CP0C5_GI) & 3;
+#ifdef CONFIG_MIPS_LOG_INSTR
+    /*
+     * The previous TB may have ended with a logged instruction. If this TB
+     * starts outside the filter, its changes are printed before the next
+     * logged instruction instead, since the dump compares against the last
+     * printed state.
+     */
+    ctx->prev_insn_logged = cheri_trace_filter_allows_pc(ctx->base.pc_first);
+#endif
     restore_cpu_state(env, ctx);
 #ifdef CONFIG_USER_ONLY
         ctx->mem_idx = MIPS_HFLAG_UM;
@@ -31714,6 +31757,9 @@ static void mips_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
 
 static void mips_tr_tb_start(DisasContextBase *dcbase, CPUState *cs)
 {
+    DisasContext *ctx = container_of(dcbase, DisasContext, base);
+
+    generate_statcounters_icount_start(ctx);
 }
 
 static void mips_tr_insn_start(DisasContextBase *dcbase, CPUState *cs)
@@ -31830,6 +31876,8 @@ static void mips_tr_tb_stop(DisasContextBase *dcbase, CPUState *cs)
 {
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
 
+    generate_statcounters_icount_end(ctx);
+
     if (ctx->base.singlestep_enabled && ctx->base.is_jmp != DISAS_NORETURN) {
         save_cpu_state(ctx, ctx->base.is_jmp != DISAS_EXIT);
         gen_helper_raise_exception_debug(cpu_env);
@@ -32141,9 +32189,16 @@ void cpu_state_reset(CPUMIPSState *env)
      * set to zero. length is set to (2^64 - 1). Offset (or cursor)
      * is set to zero (or boot vector address for PCC).
      */
+#ifdef CHERI_128
+    /* An all-zeroes compressed register file holds only NULL capabilities. */
+    memset(&env->active_tc.gpcapregs, 0, sizeof(env->active_tc.gpcapregs));
+    reset_capreg_decode_cache(&env->active_tc);
+    env->active_tc.decode_cache = &env->decode_cache;
+#else
     for (int i = 0; i < 32; i++) {
         null_capability(&env->active_tc._CGPR[i]);
     }
+#endif
     set_max_perms_capability(&env->active_tc.PCC, env->exception_base);
     // TODO: make DDC and KCC unconditionally only be in the special reg file
     set_max_perms_capability(&env->active_tc.CHWR.DDC, 0);
@@ -32208,6 +32263,8 @@ void cpu_state_reset(CPUMIPSState *env)
     env->active_tc.PC = env->exception_base;
     env->CP0_Random = env->tlb->nb_tlb - 1;
     env->tlb->tlb_in_use = env->tlb->nb_tlb;
+    r4k_tlb_index_rebuild(env);
+    cpu_mips_reset_asid_slots(env);
     env->CP0_Wired = 0;
     env->CP0_GlobalNumber = (cs->cpu_index & 0xFF) << CP0GN_VPId;
     env->CP0_EBase = (cs->cpu_index & 0x3FF);
@@ -32255,6 +32312,10 @@ void cpu_state_reset(CPUMIPSState *env)
         for (i = 0; i < ARRAY_SIZE(env->tcs); i++) {
             env->tcs[i].CP0_TCBind = cs->cpu_index << CP0TCBd_CurVPE;
             env->tcs[i].CP0_TCHalt = 1;
+#ifdef CHERI_128
+            reset_capreg_decode_cache(&env->tcs[i]);
+            env->tcs[i].decode_cache = &env->decode_cache;
+#endif
         }
         env->active_tc.CP0_TCHalt = 1;
         cs->halted = 1;
@@ -296,6 +296,27 @@ static inline void generate_cgetbase(int32_t rd, int32_t cb)
     tcg_temp_free_i32(tcb);
 }
 
+#ifdef CHERI_128
+/*
+ * The capability registers are stored compressed (see TCState), so
+ * instructions that only need the cursor or the tag, or that copy a register
+ * unchanged, can use the raw words instead of calling a helper.
+ */
+#define CAPREG_OFFSET(field, n) \
+    offsetof(CPUMIPSState, active_tc.gpcapregs.field[n])
+#define CAPREG_STATE_OFFSET \
+    offsetof(CPUMIPSState, active_tc.gpcapregs.capreg_state)
+
+static inline void generate_cgetaddr(int32_t rd, int32_t cb)
+{
+    TCGv t0 = tcg_temp_new();
+
+    tcg_gen_ld_tl(t0, cpu_env, CAPREG_OFFSET(cursor, cb));
+    gen_store_gpr (t0, rd);
+
+    tcg_temp_free(t0);
+}
+#else
 static inline void generate_cgetaddr(int32_t rd, int32_t cb)
 {
     TCGv_i32 tcb = tcg_const_i32(cb);
@@ -307,6 +328,7 @@ static inline void generate_cgetaddr(int32_t rd, int32_t cb)
     tcg_temp_free(t0);
     tcg_temp_free_i32(tcb);
 }
+#endif
 
 static inline void generate_cloadtags(int32_t rd, int32_t cb)
 {
@@ -413,6 +435,19 @@ static inline void generate_cgetsealed(int32_t rd, int32_t cb)
     tcg_temp_free_i32(tcb);
 }
 
+#ifdef CHERI_128
+static inline void generate_cgettag(int32_t rd, int32_t cb)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(t0, cpu_env, CAPREG_STATE_OFFSET);
+    tcg_gen_extract_i64(t0, t0, cb * 2, 2);
+    tcg_gen_setcondi_i64(TCG_COND_EQ, t0, t0, CREG_TAGGED_CAP);
+    gen_store_gpr (t0, rd);
+
+    tcg_temp_free_i64(t0);
+}
+#else
 static inline void generate_cgettag(int32_t rd, int32_t cb)
 {
     TCGv_i32 tcb = tcg_const_i32(cb);
@@ -424,6 +459,7 @@ static inline void generate_cgettag(int32_t rd, int32_t cb)
     tcg_temp_free(t0);
     tcg_temp_free_i32(tcb);
 }
+#endif
 
 static inline void generate_cgettype(int32_t rd, int32_t cb)
 {
@@ -479,6 +515,30 @@ static inline void generate_cincoffset_imm(int32_t cd, int32_t cs, int32_t incre
     tcg_temp_free_i32(tcs);
 }
 
+#ifdef CHERI_128
+static inline void generate_cmove(int32_t cd, int32_t cs)
+{
+    TCGv_i64 t0, t1;
+
+    // writing to $c0/$cnull is a no-op
+    if (cd == 0 || cd == cs)
+        return;
+
+    t0 = tcg_temp_new_i64();
+    t1 = tcg_temp_new_i64();
+    tcg_gen_ld_i64(t0, cpu_env, CAPREG_OFFSET(cursor, cs));
+    tcg_gen_st_i64(t0, cpu_env, CAPREG_OFFSET(cursor, cd));
+    tcg_gen_ld_i64(t0, cpu_env, CAPREG_OFFSET(pesbt, cs));
+    tcg_gen_st_i64(t0, cpu_env, CAPREG_OFFSET(pesbt, cd));
+    /* Copy the two state bits of cs to cd. */
+    tcg_gen_ld_i64(t0, cpu_env, CAPREG_STATE_OFFSET);
+    tcg_gen_extract_i64(t1, t0, cs * 2, 2);
+    tcg_gen_deposit_i64(t0, t0, t1, cd * 2, 2);
+    tcg_gen_st_i64(t0, cpu_env, CAPREG_STATE_OFFSET);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t0);
+}
+#else
 static inline void generate_cmove(int32_t cd, int32_t cs)
 {
     TCGv_i32 tcd = tcg_const_i32(cd);
@@ -491,6 +551,7 @@ static inline void generate_cmove(int32_t cd, int32_t cs)
     tcg_temp_free_i32(tcd);
     tcg_temp_free_i32(tcs);
 }
+#endif
 
 static inline void generate_cmovz(int32_t cd, int32_t cs, int32_t rs)
 {
@@ -962,6 +1023,8 @@ static inline void generate_cloadlinked_int(DisasContext *ctx, int32_t rd, int32
 
     gen_helper_cloadlinked(taddr, cpu_env, tcb, tlen);
     tcg_gen_qemu_ld_tl_with_checked_addr(t0, taddr, ctx->mem_idx, op);
+    /* Remember the value for the store-conditional compare-and-exchange */
+    tcg_gen_mov_tl(cpu_llval, t0);
     gen_store_gpr(t0, rd);
 
     tcg_temp_free_i32(tlen);
@@ -998,9 +1061,19 @@ static inline void generate_cstorecond_int(DisasContext *ctx, int32_t rs,
     /* If linkedFlag is zero then don't store rs, invalidate tag */
     tcg_gen_brcondi_tl(TCG_COND_EQ, tlf, 0, l1);
 
-    /* Write rs to memory. */
+    /*
+     * Write rs to memory if it still holds the value loaded by CLL (the
+     * linkedflag only notices stores by this vCPU). CLL may have sign
+     * extended it, so only compare the bytes that were accessed.
+     */
     gen_load_gpr(t0, rs);
-    tcg_gen_qemu_st_tl_with_checked_addr(t0, taddr, ctx->mem_idx, op);
+    tcg_gen_atomic_cmpxchg_tl_with_checked_addr(t0, taddr, cpu_llval, t0,
+                                                ctx->mem_idx, op);
+    tcg_gen_xor_tl(t0, t0, cpu_llval);
+    if (size < 8) {
+        tcg_gen_andi_tl(t0, t0, MAKE_64BIT_MASK(0, size * 8));
+    }
+    tcg_gen_setcondi_tl(TCG_COND_EQ, tlf, t0, 0);
 
     tcg_temp_free_cap_checked(taddr);
     tcg_temp_free(t0);
@@ -1045,19 +1118,444 @@ static inline int32_t clc_sign_extend(int32_t x, bool big_imm)
     return (x ^ mask) - mask;
 }
 
+#if defined(CHERI_128) && !defined(CHERI_MAGIC128) && !defined(CONFIG_USER_ONLY)
+/*
+ * CLC and CSC relative to a capability register other than $ddc are emitted
+ * inline for the common case: the bounds of the register are memoized in
+ * env->decode_cache, the address hits in the soft TLB and the page has tag
+ * memory. Everything else (including all exceptions) branches to the
+ * helpers, which redo the whole instruction. Since the helpers also log the
+ * access, TBs that log instructions always call them.
+ */
+#define TCG_INLINE_CAP_LDST
+
+static inline bool cap_ldst_inline_ok(DisasContext *ctx, int32_t cb)
+{
+#ifdef CONFIG_MIPS_LOG_INSTR
+    if (ctx->base.tb->cheri_flags & TB_FLAG_CHERI_LOG_INSTR)
+        return false;
+#endif
+    return cb != 0;
+}
+
+static inline void gen_env_add_i64(intptr_t ofs, TCGv_i64 n)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(t0, cpu_env, ofs);
+    tcg_gen_add_i64(t0, t0, n);
+    tcg_gen_st_i64(t0, cpu_env, ofs);
+    tcg_temp_free_i64(t0);
+}
+
+static inline void gen_env_inc_i64(intptr_t ofs)
+{
+    TCGv_i64 one = tcg_const_i64(1);
+
+    gen_env_add_i64(ofs, one);
+    tcg_temp_free_i64(one);
+}
+
+/* fail |= cond(a, b) */
+static inline void gen_fail_if(TCGv_i64 fail, TCGCond cond, TCGv_i64 a,
+                               TCGv_i64 b)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+
+    tcg_gen_setcond_i64(cond, t0, a, b);
+    tcg_gen_or_i64(fail, fail, t0);
+    tcg_temp_free_i64(t0);
+}
+
+static inline void gen_fail_ifi(TCGv_i64 fail, TCGCond cond, TCGv_i64 a,
+                                int64_t b)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+
+    tcg_gen_setcondi_i64(cond, t0, a, b);
+    tcg_gen_or_i64(fail, fail, t0);
+    tcg_temp_free_i64(t0);
+}
+
+/*
+ * Emit the checks that get_clc_addr()/get_csc_addr() do on @cb as TCG ops
+ * (the permissions in @need, bounds and alignment), using the bounds in
+ * env->decode_cache, and look up the address in the soft TLB. Sets @fail
+ * to nonzero if any of this fails. Returns the address, the hardware
+ * permissions of @cb, the host address of the capability and its
+ * CPUIOTLBEntry, which must be local temps since the caller branches
+ * on @fail before using them.
+ */
+static void gen_cap_ldst_lookup(DisasContext *ctx, int32_t cb, int32_t rt,
+                                int32_t offset, bool store, uint32_t need,
+                                TCGv_i64 fail, TCGv_i64 addr, TCGv_i64 perms,
+                                TCGv_ptr host, TCGv_ptr iotlb)
+{
+    typedef struct cheri_decode_cache_entry Entry;
+#ifdef HOST_WORDS_BIGENDIAN
+    const int top_lo = offsetof(Entry, top) + 8;
+    const int top_hi = offsetof(Entry, top);
+#else
+    const int top_lo = offsetof(Entry, top);
+    const int top_hi = offsetof(Entry, top) + 8;
+#endif
+    const intptr_t entries = offsetof(CPUMIPSState, decode_cache.entries);
+    const int fast_ofs = TLB_MASK_TABLE_OFS(ctx->mem_idx);
+    const int iotlb_ofs =
+        (int)offsetof(ArchCPU, neg.tlb.d[ctx->mem_idx].iotlb) -
+        (int)offsetof(ArchCPU, env);
+    TCGv_i64 pesbt = tcg_temp_new_i64();
+    TCGv_i64 cursor = tcg_temp_new_i64();
+    TCGv_i64 xored = tcg_temp_new_i64();
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_ptr p0 = tcg_temp_new_ptr();
+    TCGv_ptr p1 = tcg_temp_new_ptr();
+
+    /* cb must be tagged, unsealed and have the permissions in @need. */
+    tcg_gen_ld_i64(t0, cpu_env, CAPREG_STATE_OFFSET);
+    tcg_gen_extract_i64(t0, t0, cb * 2, 2);
+    tcg_gen_setcondi_i64(TCG_COND_NE, fail, t0, CREG_TAGGED_CAP);
+    tcg_gen_ld_i64(pesbt, cpu_env, CAPREG_OFFSET(pesbt, cb));
+    tcg_gen_xori_i64(xored, pesbt, CC128_NULL_XOR_MASK);
+    tcg_gen_extract_i64(t0, xored, CC128_FIELD_OTYPE_START,
+                        CC128_FIELD_OTYPE_SIZE);
+    gen_fail_ifi(fail, TCG_COND_LTU, t0, CAP_OTYPE_UNSEALED);
+    tcg_gen_extract_i64(perms, xored, CC128_FIELD_HWPERMS_START,
+                        CC128_FIELD_HWPERMS_SIZE);
+    tcg_gen_andi_i64(t0, perms, need);
+    gen_fail_ifi(fail, TCG_COND_NE, t0, need);
+
+    tcg_gen_ld_i64(cursor, cpu_env, CAPREG_OFFSET(cursor, cb));
+    gen_load_gpr(addr, rt);
+    tcg_gen_add_i64(addr, addr, cursor);
+    tcg_gen_addi_i64(addr, addr, offset);
+
+    /* Find the bounds of cb like decompress_128cap_cached(). */
+    tcg_gen_extract_i64(t0, xored, CC128_FIELD_EXPONENT_HIGH_PART_START,
+                        CC128_FIELD_EXPONENT_HIGH_PART_SIZE);
+    tcg_gen_shli_i64(t0, t0, CC128_FIELD_EXPONENT_LOW_PART_SIZE);
+    tcg_gen_extract_i64(t1, xored, CC128_FIELD_EXPONENT_LOW_PART_START,
+                        CC128_FIELD_EXPONENT_LOW_PART_SIZE);
+    tcg_gen_or_i64(t0, t0, t1);
+    tcg_gen_extract_i64(t1, xored, CC128_FIELD_INTERNAL_EXPONENT_START, 1);
+    tcg_gen_neg_i64(t1, t1);
+    tcg_gen_and_i64(t0, t0, t1);
+    tcg_gen_movi_i64(t1, CC128_MAX_EXPONENT);
+    tcg_gen_umin_i64(t0, t0, t1);
+    tcg_gen_addi_i64(t0, t0, CC128_MANTISSA_WIDTH - 3);
+    tcg_gen_shr_i64(cursor, cursor, t0);
+    tcg_gen_xor_i64(t0, pesbt, cursor);
+    tcg_gen_muli_i64(t0, t0, UINT64_C(0x9e3779b97f4a7c15));
+    tcg_gen_shri_i64(t0, t0, 64 - CHERI_DECODE_CACHE_BITS);
+    tcg_gen_muli_i64(t0, t0, sizeof(Entry));
+    tcg_gen_trunc_i64_ptr(p0, t0);
+    tcg_gen_add_ptr(p0, p0, cpu_env);
+    tcg_gen_ld8u_i64(t0, p0, entries + offsetof(Entry, valid));
+    gen_fail_ifi(fail, TCG_COND_EQ, t0, 0);
+    tcg_gen_ld_i64(t0, p0, entries + offsetof(Entry, pesbt));
+    gen_fail_if(fail, TCG_COND_NE, t0, pesbt);
+    tcg_gen_ld_i64(t0, p0, entries + offsetof(Entry, cursor_hi));
+    gen_fail_if(fail, TCG_COND_NE, t0, cursor);
+
+    /* Like cap_is_in_bounds(), reject accesses that wrap around. */
+    tcg_gen_ld_i64(t0, p0, entries + offsetof(Entry, base));
+    gen_fail_if(fail, TCG_COND_LTU, addr, t0);
+    tcg_gen_addi_i64(t1, addr, CHERI_CAP_SIZE);
+    gen_fail_if(fail, TCG_COND_LTU, t1, addr);
+    /* If bit 64 of top is set, any non-wrapping access is in bounds. */
+    tcg_gen_ld_i64(t0, p0, entries + top_lo);
+    tcg_gen_setcond_i64(TCG_COND_GTU, t1, t1, t0);
+    tcg_gen_ld_i64(t0, p0, entries + top_hi);
+    tcg_gen_setcondi_i64(TCG_COND_EQ, t0, t0, 0);
+    tcg_gen_and_i64(t0, t0, t1);
+    tcg_gen_or_i64(fail, fail, t0);
+    tcg_gen_andi_i64(t0, addr, CHERI_CAP_SIZE - 1);
+    gen_fail_ifi(fail, TCG_COND_NE, t0, 0);
+
+    /*
+     * Soft TLB lookup as done by the backends. The capability is aligned,
+     * so it is in a single page and only the flags can make it miss.
+     */
+    tcg_gen_ld_ptr(p0, cpu_env, fast_ofs + offsetof(CPUTLBDescFast, mask));
+    tcg_gen_extu_ptr_i64(t0, p0);
+    tcg_gen_shri_i64(t1, addr, TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS);
+    tcg_gen_and_i64(t1, t1, t0);
+    tcg_gen_trunc_i64_ptr(p0, t1);
+    tcg_gen_ld_ptr(p1, cpu_env, fast_ofs + offsetof(CPUTLBDescFast, table));
+    tcg_gen_add_ptr(p0, p0, p1);
+    if (store) {
+        tcg_gen_ld_i64(t0, p0, offsetof(CPUTLBEntry, addr_write));
+        /* Only MTTCG integer stores need to look at the tags. */
+        tcg_gen_andi_i64(t0, t0, ~(uint64_t)TLB_CHERI_TAGGED);
+    } else {
+        tcg_gen_ld_i64(t0, p0, offsetof(CPUTLBEntry, addr_read));
+    }
+    tcg_gen_andi_i64(cursor, addr, TARGET_PAGE_MASK);
+    gen_fail_if(fail, TCG_COND_NE, t0, cursor);
+    tcg_gen_ld_ptr(host, p0, offsetof(CPUTLBEntry, addend));
+    tcg_gen_trunc_i64_ptr(p1, addr);
+    tcg_gen_add_ptr(host, host, p1);
+
+    tcg_gen_shri_i64(t1, t1, CPU_TLB_ENTRY_BITS);
+    tcg_gen_muli_i64(t1, t1, sizeof(CPUIOTLBEntry));
+    tcg_gen_trunc_i64_ptr(p0, t1);
+    tcg_gen_ld_ptr(iotlb, cpu_env, iotlb_ofs);
+    tcg_gen_add_ptr(iotlb, iotlb, p0);
+    /* Pages without tag memory are rare enough to leave to the helper. */
+    tcg_gen_ld_ptr(p0, iotlb, offsetof(CPUIOTLBEntry, tagmem));
+    tcg_gen_extu_ptr_i64(t0, p0);
+    gen_fail_ifi(fail, TCG_COND_EQ, t0, 0);
+
+    tcg_temp_free_ptr(p1);
+    tcg_temp_free_ptr(p0);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t0);
+    tcg_temp_free_i64(xored);
+    tcg_temp_free_i64(cursor);
+    tcg_temp_free_i64(pesbt);
+}
+
+/* Load the tag of the capability at @addr from the tag memory of @iotlb. */
+static void gen_cap_tag_load(TCGv_i64 tag, TCGv_ptr iotlb, TCGv_i64 addr)
+{
+    const int tag_shift = ctz32(CHERI_CAP_SIZE);
+    const int word_shift = tag_shift + ctz32(BITS_PER_LONG);
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_ptr p0 = tcg_temp_new_ptr();
+    TCGv_ptr p1 = tcg_temp_new_ptr();
+
+    tcg_gen_ld_ptr(p0, iotlb, offsetof(CPUIOTLBEntry, tagmem));
+    tcg_gen_extract_i64(t0, addr, word_shift, TARGET_PAGE_BITS - word_shift);
+    tcg_gen_shli_i64(t0, t0, ctz32(sizeof(unsigned long)));
+    tcg_gen_trunc_i64_ptr(p1, t0);
+    tcg_gen_add_ptr(p0, p0, p1);
+#if HOST_LONG_BITS == 64
+    tcg_gen_ld_i64(tag, p0, 0);
+#else
+    tcg_gen_ld32u_i64(tag, p0, 0);
+#endif
+    tcg_gen_extract_i64(t0, addr, tag_shift, ctz32(BITS_PER_LONG));
+    tcg_gen_shr_i64(tag, tag, t0);
+    tcg_gen_andi_i64(tag, tag, 1);
+
+    tcg_temp_free_ptr(p1);
+    tcg_temp_free_ptr(p0);
+    tcg_temp_free_i64(t0);
+}
+
+/* The capability in memory is in guest byte order. */
+static inline void gen_cap_word_swap(TCGv_i64 val)
+{
+#if defined(HOST_WORDS_BIGENDIAN) != defined(TARGET_WORDS_BIGENDIAN)
+    tcg_gen_bswap64_i64(val, val);
+#endif
+}
+
+/*
+ * Inline part of CLC, see load_cap_from_memory(). With MTTCG, the data and
+ * the tag are read like in cheri_tag_load_host(), except that a concurrent
+ * capability store to the page sends us to the slow path.
+ */
+static void gen_clc_inline(DisasContext *ctx, int32_t cd, int32_t cb,
+                           int32_t rt, int32_t offset, TCGLabel *slow_path)
+{
+    const bool parallel = tb_cflags(ctx->base.tb) & CF_PARALLEL;
+    TCGv_i64 addr = tcg_temp_local_new_i64();
+    TCGv_i64 perms = tcg_temp_local_new_i64();
+    TCGv_ptr host = tcg_temp_local_new_ptr();
+    TCGv_ptr iotlb = tcg_temp_local_new_ptr();
+    TCGv_i64 pesbt = tcg_temp_local_new_i64();
+    TCGv_i64 cursor = tcg_temp_local_new_i64();
+    TCGv_i64 tag = tcg_temp_local_new_i64();
+    TCGv_ptr tagseq = NULL;
+    TCGv_i64 seq = NULL;
+    TCGv_i64 fail = tcg_temp_new_i64();
+    TCGv_i64 t0 = tcg_temp_new_i64();
+
+    gen_cap_ldst_lookup(ctx, cb, rt, offset, false, CAP_PERM_LOAD, fail,
+                        addr, perms, host, iotlb);
+    /* The helper clears the tag or traps for PAGE_LC_* pages. */
+    tcg_gen_ld32u_i64(t0, iotlb, offsetof(CPUIOTLBEntry, cheri_prot));
+    tcg_gen_andi_i64(t0, t0, PAGE_LC_CLEAR | PAGE_LC_TRAP);
+    tcg_gen_or_i64(fail, fail, t0);
+    tcg_gen_brcondi_i64(TCG_COND_NE, fail, 0, slow_path);
+    tcg_temp_free_i64(fail);
+
+    if (parallel) {
+        tagseq = tcg_temp_local_new_ptr();
+        seq = tcg_temp_local_new_i64();
+        tcg_gen_ld_ptr(tagseq, iotlb, offsetof(CPUIOTLBEntry, tagseq));
+        tcg_gen_extu_ptr_i64(t0, tagseq);
+        tcg_gen_brcondi_i64(TCG_COND_EQ, t0, 0, slow_path);
+        tcg_gen_ld32u_i64(seq, tagseq, 0);
+        tcg_gen_andi_i64(t0, seq, 1);
+        tcg_gen_brcondi_i64(TCG_COND_NE, t0, 0, slow_path);
+        tcg_gen_mb(TCG_MO_LD_LD | TCG_BAR_SC);
+    }
+    tcg_gen_ld_i64(pesbt, host, 0);
+    tcg_gen_ld_i64(cursor, host, 8);
+    if (parallel) {
+        /* Integer stores clear the tag before writing the data. */
+        tcg_gen_mb(TCG_MO_LD_LD | TCG_BAR_SC);
+    }
+    gen_cap_tag_load(tag, iotlb, addr);
+    if (parallel) {
+        tcg_gen_mb(TCG_MO_LD_LD | TCG_BAR_SC);
+        tcg_gen_ld32u_i64(t0, tagseq, 0);
+        tcg_gen_brcond_i64(TCG_COND_NE, t0, seq, slow_path);
+        tcg_temp_free_i64(seq);
+        tcg_temp_free_ptr(tagseq);
+    }
+    gen_cap_word_swap(pesbt);
+    gen_cap_word_swap(cursor);
+
+    /* Like tag_prot_clear_or_trap(), without CAP_PERM_LOAD_CAP. */
+    tcg_gen_extract_i64(t0, perms, ctz32(CAP_PERM_LOAD_CAP), 1);
+    tcg_gen_and_i64(tag, tag, t0);
+
+    gen_env_inc_i64(offsetof(CPUMIPSState, decode_cache.hits));
+    gen_env_inc_i64(offsetof(CPUMIPSState, statcounters.cap_read));
+    gen_env_add_i64(offsetof(CPUMIPSState, statcounters.cap_read_tagged), tag);
+
+    /* Like update_capreg_raw(), writing to $c0/$cnull is a no-op. */
+    if (cd != 0) {
+        TCGv_i64 t1 = tcg_temp_new_i64();
+
+        QEMU_BUILD_BUG_ON(CREG_INTEGER != 0 || CREG_UNTAGGED_CAP != 1 ||
+                          CREG_TAGGED_CAP != 2);
+        tcg_gen_st_i64(cursor, cpu_env, CAPREG_OFFSET(cursor, cd));
+        tcg_gen_st_i64(pesbt, cpu_env, CAPREG_OFFSET(pesbt, cd));
+        tcg_gen_setcondi_i64(TCG_COND_NE, t0, pesbt, 0);
+        tcg_gen_andc_i64(t0, t0, tag);
+        tcg_gen_shli_i64(t1, tag, 1);
+        tcg_gen_or_i64(t0, t0, t1);
+        tcg_gen_ld_i64(t1, cpu_env, CAPREG_STATE_OFFSET);
+        tcg_gen_deposit_i64(t1, t1, t0, cd * 2, 2);
+        tcg_gen_st_i64(t1, cpu_env, CAPREG_STATE_OFFSET);
+        tcg_temp_free_i64(t1);
+    }
+
+    tcg_temp_free_i64(t0);
+    tcg_temp_free_i64(tag);
+    tcg_temp_free_i64(cursor);
+    tcg_temp_free_i64(pesbt);
+    tcg_temp_free_ptr(iotlb);
+    tcg_temp_free_ptr(host);
+    tcg_temp_free_i64(perms);
+    tcg_temp_free_i64(addr);
+}
+
+/*
+ * Inline part of CSC, see store_cap_to_memory(). Only used without MTTCG
+ * (or while the other vCPUs are stopped) since the other vCPUs would need
+ * the stripe lock. The tag is updated with atomics because DMA may clear
+ * tags concurrently, and TCG can't emit those for host addresses, so this
+ * also leaves stores that change the tag to the helper.
+ */
+static void gen_csc_inline(DisasContext *ctx, int32_t cs, int32_t cb,
+                           int32_t rt, int32_t offset, TCGLabel *slow_path)
+{
+    TCGv_i64 addr = tcg_temp_local_new_i64();
+    TCGv_i64 perms = tcg_temp_local_new_i64();
+    TCGv_ptr host = tcg_temp_local_new_ptr();
+    TCGv_ptr iotlb = tcg_temp_local_new_ptr();
+    TCGv_i64 cs_tag = tcg_temp_local_new_i64();
+    TCGv_i64 fail = tcg_temp_new_i64();
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_i64 t1 = tcg_temp_new_i64();
+
+    gen_cap_ldst_lookup(ctx, cb, rt, offset, true,
+                        CAP_PERM_STORE | CAP_PERM_STORE_CAP, fail,
+                        addr, perms, host, iotlb);
+    tcg_gen_ld_i64(t0, cpu_env, CAPREG_STATE_OFFSET);
+    tcg_gen_extract_i64(t0, t0, cs * 2, 2);
+    tcg_gen_setcondi_i64(TCG_COND_EQ, cs_tag, t0, CREG_TAGGED_CAP);
+
+    /* Storing a local capability needs CAP_PERM_STORE_LOCAL. */
+    tcg_gen_ld_i64(t0, cpu_env, CAPREG_OFFSET(pesbt, cs));
+    tcg_gen_xori_i64(t0, t0, CC128_NULL_XOR_MASK);
+    tcg_gen_extract_i64(t0, t0,
+                        CC128_FIELD_HWPERMS_START + ctz32(CAP_PERM_GLOBAL), 1);
+    tcg_gen_extract_i64(t1, perms, ctz32(CAP_PERM_STORE_LOCAL), 1);
+    tcg_gen_or_i64(t0, t0, t1);
+    tcg_gen_andc_i64(t0, cs_tag, t0);
+    tcg_gen_or_i64(fail, fail, t0);
+    /* The helper traps on PAGE_SC_TRAP pages and for read-only tags. */
+    tcg_gen_ld32u_i64(t0, iotlb, offsetof(CPUIOTLBEntry, cheri_prot));
+    tcg_gen_andi_i64(t0, t0, PAGE_SC_TRAP);
+    tcg_gen_setcondi_i64(TCG_COND_NE, t0, t0, 0);
+    tcg_gen_and_i64(t0, t0, cs_tag);
+    tcg_gen_or_i64(fail, fail, t0);
+    tcg_gen_ld8u_i64(t0, iotlb, offsetof(CPUIOTLBEntry, tagmem_readonly));
+    tcg_gen_or_i64(fail, fail, t0);
+    /* The helper resets the linkedflag if we store to the linked address. */
+    tcg_gen_ld_i64(t0, cpu_env, offsetof(CPUMIPSState, linkedflag));
+    gen_fail_ifi(fail, TCG_COND_NE, t0, 0);
+    tcg_gen_brcondi_i64(TCG_COND_NE, fail, 0, slow_path);
+    tcg_temp_free_i64(fail);
+
+    gen_cap_tag_load(t0, iotlb, addr);
+    tcg_gen_brcond_i64(TCG_COND_NE, t0, cs_tag, slow_path);
+
+    /* Integer values are stored with the pesbt of a NULL capability. */
+    tcg_gen_ld_i64(t1, cpu_env, CAPREG_STATE_OFFSET);
+    tcg_gen_extract_i64(t1, t1, cs * 2, 2);
+    tcg_gen_setcondi_i64(TCG_COND_NE, t1, t1, CREG_INTEGER);
+    tcg_gen_neg_i64(t1, t1);
+    tcg_gen_ld_i64(t0, cpu_env, CAPREG_OFFSET(pesbt, cs));
+    tcg_gen_and_i64(t0, t0, t1);
+    gen_cap_word_swap(t0);
+    tcg_gen_st_i64(t0, host, 0);
+    tcg_gen_ld_i64(t0, cpu_env, CAPREG_OFFSET(cursor, cs));
+    gen_cap_word_swap(t0);
+    tcg_gen_st_i64(t0, host, 8);
+
+    gen_env_inc_i64(offsetof(CPUMIPSState, decode_cache.hits));
+    gen_env_inc_i64(offsetof(CPUMIPSState, statcounters.cap_write));
+    gen_env_add_i64(offsetof(CPUMIPSState, statcounters.cap_write_tagged),
+                    cs_tag);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t0);
+    tcg_temp_free_i64(cs_tag);
+    tcg_temp_free_ptr(iotlb);
+    tcg_temp_free_ptr(host);
+    tcg_temp_free_i64(perms);
+    tcg_temp_free_i64(addr);
+}
+#endif
+
 static inline void generate_clc(DisasContext *ctx, int32_t cd, int32_t cb,
         int32_t rt, int32_t offset, bool big_imm)
 {
-    TCGv_i32 tcd = tcg_const_i32(cd);
-    TCGv_i32 tcb = tcg_const_i32(cb);
-    TCGv_i32 toffset = tcg_const_i32(clc_sign_extend(offset, big_imm) * 16);
-    TCGv t0 = tcg_temp_new();
+    TCGLabel *done = NULL;
+    TCGv_i32 tcd, tcb, toffset;
+    TCGv t0;
+
+#ifdef TCG_INLINE_CAP_LDST
+    if (cap_ldst_inline_ok(ctx, cb)) {
+        TCGLabel *slow_path = gen_new_label();
+
+        done = gen_new_label();
+        gen_clc_inline(ctx, cd, cb, rt, clc_sign_extend(offset, big_imm) * 16,
+                       slow_path);
+        tcg_gen_br(done);
+        gen_set_label(slow_path);
+    }
+#endif
+    tcd = tcg_const_i32(cd);
+    tcb = tcg_const_i32(cb);
+    toffset = tcg_const_i32(clc_sign_extend(offset, big_imm) * 16);
+    t0 = tcg_temp_new();
     gen_load_gpr(t0, rt);
     gen_helper_clc_without_tcg(cpu_env, tcd, tcb, t0, toffset);
     tcg_temp_free(t0);
     tcg_temp_free_i32(toffset);
     tcg_temp_free_i32(tcb);
     tcg_temp_free_i32(tcd);
+    if (done)
+        gen_set_label(done);
 }
 
 static inline void generate_cllc(DisasContext *ctx, int32_t cd, int32_t cb)
@@ -1072,11 +1570,27 @@ static inline void generate_cllc(DisasContext *ctx, int32_t cd, int32_t cb)
 static inline void generate_csc(DisasContext *ctx, int32_t cs, int32_t cb,
         int32_t rt, int32_t offset, bool big_imm)
 {
-    TCGv_i32 tcs = tcg_const_i32(cs);
-    TCGv_i32 tcb = tcg_const_i32(cb);
-    TCGv_i32 toffset = tcg_const_i32(clc_sign_extend(offset, big_imm) * 16);
+    TCGLabel *done = NULL;
+    TCGv_i32 tcs, tcb, toffset;
+    TCGv t0;
+
+#ifdef TCG_INLINE_CAP_LDST
+    if (cap_ldst_inline_ok(ctx, cb) &&
+        !(tb_cflags(ctx->base.tb) & CF_PARALLEL)) {
+        TCGLabel *slow_path = gen_new_label();
+
+        done = gen_new_label();
+        gen_csc_inline(ctx, cs, cb, rt, clc_sign_extend(offset, big_imm) * 16,
+                       slow_path);
+        tcg_gen_br(done);
+        gen_set_label(slow_path);
+    }
+#endif
+    tcs = tcg_const_i32(cs);
+    tcb = tcg_const_i32(cb);
+    toffset = tcg_const_i32(clc_sign_extend(offset, big_imm) * 16);
     /* Check the cap registers and compute the address. */
-    TCGv t0 = tcg_temp_new();
+    t0 = tcg_temp_new();
     gen_load_gpr(t0, rt);
     gen_helper_csc_without_tcg(cpu_env, tcs, tcb, t0, toffset);
 
@@ -1084,6 +1598,8 @@ static inline void generate_csc(DisasContext *ctx, int32_t cs, int32_t cb,
     tcg_temp_free_i32(toffset);
     tcg_temp_free_i32(tcb);
     tcg_temp_free_i32(tcs);
+    if (done)
+        gen_set_label(done);
 }
 
 static inline void generate_cscc(DisasContext *ctx, int32_t cs, int32_t cb,
@@ -1102,13 +1618,110 @@ static inline void generate_cscc(DisasContext *ctx, int32_t cs, int32_t cb,
     tcg_temp_free(t0);
 }
 
+/*
+ * PCC is part of the TB key (see cpu_get_tb_cpu_state_cheri()), so we know
+ * at translation time whether an instruction can be fetched.
+ */
+static inline bool pcc_allows_insn_at(DisasContext *ctx, target_ulong pc)
+{
+    const TranslationBlock *tb = ctx->base.tb;
+
+    if (!(tb->cheri_flags & TB_FLAG_CHERI_PCC_VALID) || pc < tb->cs_base) {
+        return false;
+    }
+    /* Like cap_is_in_bounds(), reject fetches that wrap around. */
+    if (pc + 4 < pc) {
+        return false;
+    }
+    return (tb->cheri_flags & TB_FLAG_CHERI_PCC_FULL_TOP) ||
+        pc + 4 <= tb->cs_top;
+}
+
 static inline void generate_ccheck_pc(DisasContext *ctx)
 {
     TCGv_i64 tpc = tcg_const_i64(ctx->base.pc_next);
-    gen_helper_ccheck_pc(cpu_env, tpc);
+#ifdef CONFIG_MIPS_LOG_INSTR
+    const bool log_tb = ctx->base.tb->cheri_flags & TB_FLAG_CHERI_LOG_INSTR;
+    const bool log_instr =
+        log_tb && cheri_trace_filter_allows_pc(ctx->base.pc_next);
+
+    /*
+     * Print changed state before advancing to the next instruction. This is
+     * also needed after the last logged instruction of a filtered range.
+     */
+    if (unlikely(log_instr || (log_tb && ctx->prev_insn_logged))) {
+        gen_helper_dump_changed_state(cpu_env);
+    }
+    ctx->prev_insn_logged = log_instr;
+#endif
+    tcg_gen_st_i64(tpc, cpu_env,
+                   offsetof(CPUMIPSState, active_tc.PCC._cr_cursor));
+    /* Only fetches outside of PCC need a helper call (which will trap). */
+    if (unlikely(!pcc_allows_insn_at(ctx, ctx->base.pc_next))) {
+        gen_helper_ccheck_pc(cpu_env, tpc);
+    }
+#ifdef CONFIG_MIPS_LOG_INSTR
+    if (unlikely(log_instr)) {
+        gen_helper_log_instruction(cpu_env, tpc);
+    }
+#endif
     tcg_temp_free_i64(tpc);
 }
 
+/*
+ * The statcounters instruction counts are incremented once per TB. Since
+ * the number of instructions is only known at the end of translation we emit
+ * a dummy immediate here and patch it in generate_statcounters_icount_end().
+ */
+static inline void generate_statcounters_icount_start(DisasContext *ctx)
+{
+    const bool user = (ctx->hflags & MIPS_HFLAG_KSU) == MIPS_HFLAG_UM &&
+        !(ctx->hflags & MIPS_HFLAG_ERL);
+    TCGv_i32 imm = tcg_temp_new_i32();
+    TCGv_i64 count = tcg_temp_new_i64();
+    TCGv_i64 t0 = tcg_temp_new_i64();
+
+    tcg_gen_movi_i32(imm, 0xdeadbeef);
+    ctx->statcounters_icount_op = tcg_last_op();
+    tcg_gen_extu_i32_i64(count, imm);
+
+    tcg_gen_ld_i64(t0, cpu_env, offsetof(CPUMIPSState, statcounters.icount));
+    tcg_gen_add_i64(t0, t0, count);
+    tcg_gen_st_i64(t0, cpu_env, offsetof(CPUMIPSState, statcounters.icount));
+    if (user) {
+        tcg_gen_ld_i64(t0, cpu_env,
+                       offsetof(CPUMIPSState, statcounters.icount_user));
+        tcg_gen_add_i64(t0, t0, count);
+        tcg_gen_st_i64(t0, cpu_env,
+                       offsetof(CPUMIPSState, statcounters.icount_user));
+    } else {
+        tcg_gen_ld_i64(t0, cpu_env,
+                       offsetof(CPUMIPSState, statcounters.icount_kernel));
+        tcg_gen_add_i64(t0, t0, count);
+        tcg_gen_st_i64(t0, cpu_env,
+                       offsetof(CPUMIPSState, statcounters.icount_kernel));
+    }
+    tcg_temp_free_i64(t0);
+    tcg_temp_free_i64(count);
+    tcg_temp_free_i32(imm);
+}
+
+static inline void generate_statcounters_icount_end(DisasContext *ctx)
+{
+    tcg_set_insn_param(ctx->statcounters_icount_op, 1, ctx->base.num_insns);
+}
+
+/*
+ * Starting or stopping instruction logging changes the TB key, so end the TB
+ * to make sure the next instruction is looked up again.
+ */
+static inline void generate_log_state_changed(DisasContext *ctx)
+{
+    if (!(ctx->hflags & MIPS_HFLAG_BMASK)) {
+        ctx->base.is_jmp = DISAS_STOP;
+    }
+}
+
 #define GEN_CAP_CHECK_PC_AND_LOG_INSTR(ctx)    generate_ccheck_pc(ctx)
 
 #define GEN_CAP_CHECK_STORE(addr, offset, len) \
@@ -1163,15 +1776,25 @@ cp2_unimplemented:
 #else /* ! TARGET_CHERI */
 #define generate_ccheck_load_right(addr, offset, len) tcg_gen_mov_tl(addr, offset);
 
+#define generate_statcounters_icount_start(ctx)
+#define generate_statcounters_icount_end(ctx)
+#define generate_log_state_changed(ctx)
+
 #ifdef CONFIG_MIPS_LOG_INSTR
 #define GEN_CAP_CHECK_PC_AND_LOG_INSTR(ctx) generate_dump_state_and_log_instr(ctx)
 static inline void generate_dump_state_and_log_instr(DisasContext *ctx)
 {
-    gen_helper_dump_changed_state(cpu_env);
-    TCGv_i64 tpc = tcg_const_i64(ctx->base.pc_next);
-    gen_helper_log_instruction(cpu_env, tpc);
-    tcg_temp_free_i64(tpc);
+    const bool log_instr = cheri_trace_filter_allows_pc(ctx->base.pc_next);
 
+    if (log_instr || ctx->prev_insn_logged) {
+        gen_helper_dump_changed_state(cpu_env);
+    }
+    ctx->prev_insn_logged = log_instr;
+    if (log_instr) {
+        TCGv_i64 tpc = tcg_const_i64(ctx->base.pc_next);
+        gen_helper_log_instruction(cpu_env, tpc);
+        tcg_temp_free_i64(tpc);
+    }
 }
 #else
 /* Do nothing */
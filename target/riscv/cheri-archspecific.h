@@ -33,18 +33,70 @@
 #pragma once
 
 #include "cheri_defs.h"
+#include "cheri_utils.h"
 
 #define CHERI_EXC_REGNUM_DDC 32
 #define CHERI_EXC_REGNUM_PCC 0xff
 
+/* Capability exception causes (the same codes as CP2Ca_* on CHERI-MIPS) */
+typedef enum CheriCapExcCause {
+    CapEx_LengthViolation           = 0x01,
+    CapEx_TagViolation              = 0x02,
+    CapEx_SealViolation             = 0x03,
+    CapEx_PermitExecuteViolation    = 0x11,
+    CapEx_PermitLoadViolation       = 0x12,
+    CapEx_PermitStoreViolation      = 0x13,
+    CapEx_PermitStoreCapViolation   = 0x15,
+} CheriCapExcCause;
+
+/*
+ * Raise a CHERI exception. xtval holds the cause in bits [4:0] and the
+ * number of the offending capability register above that.
+ */
+static inline void QEMU_NORETURN
+raise_cheri_exception_impl(CPURISCVState *env, CheriCapExcCause cause,
+                           uint16_t regnum, uintptr_t pc) {
+    env->badaddr = ((target_ulong)regnum << 5) | cause;
+    riscv_raise_exception(env, RISCV_EXCP_CHERI, pc);
+}
+
+/*
+ * Check an access of @len bytes at @addr through @cr, which must have all
+ * permissions in @perm, in the same order as CHERI-MIPS (tag, seal,
+ * permissions, bounds). @instavail only matters on MIPS.
+ */
 static inline void check_cap(CPURISCVState *env, const cap_register_t *cr,
                              uint32_t perm, uint64_t addr, uint16_t regnum,
                              uint32_t len, bool instavail, uintptr_t pc) {
-    return; // No checks yet
+    CheriCapExcCause cause;
+
+    if (!cr->cr_tag) {
+        cause = CapEx_TagViolation;
+    } else if (!cap_is_unsealed(cr)) {
+        cause = CapEx_SealViolation;
+    } else if ((perm & CAP_PERM_EXECUTE) &&
+               !(cr->cr_perms & CAP_PERM_EXECUTE)) {
+        cause = CapEx_PermitExecuteViolation;
+    } else if ((perm & CAP_PERM_LOAD) && !(cr->cr_perms & CAP_PERM_LOAD)) {
+        cause = CapEx_PermitLoadViolation;
+    } else if ((perm & CAP_PERM_STORE) && !(cr->cr_perms & CAP_PERM_STORE)) {
+        cause = CapEx_PermitStoreViolation;
+    } else if ((perm & CAP_PERM_STORE_CAP) &&
+               !(cr->cr_perms & CAP_PERM_STORE_CAP)) {
+        cause = CapEx_PermitStoreCapViolation;
+    } else if ((cr->cr_perms & perm) != perm) {
+        error_report("Bad permissions check %d", perm);
+        tcg_abort();
+    } else if (!cap_is_in_bounds(cr, addr, len)) {
+        cause = CapEx_LengthViolation;
+    } else {
+        return;
+    }
+    raise_cheri_exception_impl(env, cause, regnum, pc);
 }
 
 static inline const cap_register_t *cheri_get_ddc(CPURISCVState *env) {
-    return NULL; // &env->DDC;
+    return &env->DDC;
 }
 
 static inline const cap_register_t *cheri_get_pcc(CPURISCVState *env) {
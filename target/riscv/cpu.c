@@ -28,6 +28,9 @@
 #include "hw/qdev-properties.h"
 #include "migration/vmstate.h"
 #include "fpu/softfloat-helpers.h"
+#ifdef TARGET_CHERI
+#include "cheri_utils.h"
+#endif
 
 /* RISC-V CPU definitions */
 
@@ -302,6 +305,9 @@ static void riscv_cpu_reset(CPUState *cs)
     cs->exception_index = EXCP_NONE;
     env->load_res = -1;
     set_default_nan_mode(1, &env->fp_status);
+#ifdef TARGET_CHERI
+    set_max_perms_capability(&env->DDC, 0);
+#endif
 }
 
 static void riscv_cpu_disas_set_info(CPUState *s, disassemble_info *info)
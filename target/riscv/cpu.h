@@ -92,11 +92,16 @@ enum {
 typedef struct CPURISCVState CPURISCVState;
 
 #include "pmp.h"
+#ifdef TARGET_CHERI
+#include "cheri_defs.h"
+#endif
 #include "cheri_capregs.h"
 
 struct CPURISCVState {
 #ifdef TARGET_CHERI
     struct GPCapRegs gpcapregs;
+    /* Default data capability for integer-addressed loads and stores. */
+    cap_register_t DDC;
 #else
     target_ulong gpr[32];
 #endif
@@ -320,6 +325,27 @@ static inline void cpu_get_tb_cpu_state(CPURISCVState *env, target_ulong *pc,
 #endif
 }
 
+#ifdef TARGET_CHERI
+static inline void cpu_get_tb_cpu_state_cheri(CPURISCVState *env,
+                                              target_ulong *pc,
+                                              target_ulong *cs_base,
+                                              target_ulong *cs_top,
+                                              uint32_t *cheri_flags,
+                                              uint32_t *flags)
+{
+    /* PCC is not modelled yet, so translation does not depend on it. */
+    cpu_get_tb_cpu_state(env, pc, cs_base, flags);
+    *cs_top = 0;
+    *cheri_flags = 0;
+}
+
+static inline void cpu_statcounters_uncount(CPURISCVState *env,
+                                            uint32_t tb_flags, int num_insns)
+{
+    /* There are no statcounters yet. */
+}
+#endif
+
 int riscv_csrrw(CPURISCVState *env, int csrno, target_ulong *ret_value,
                 target_ulong new_value, target_ulong write_mask);
 int riscv_csrrw_debug(CPURISCVState *env, int csrno, target_ulong *ret_value,
@@ -361,6 +387,15 @@ void riscv_cpu_register_gdb_regs_for_features(CPUState *cs);
 typedef CPURISCVState CPUArchState;
 typedef RISCVCPU ArchCPU;
 
+#ifdef TARGET_CHERI
+#ifndef CHERI_128
+#error "CHERI-RISC-V only supports 128-bit compressed capabilities"
+#endif
+#define CHERI_CAP_SIZE  16
+/* Allows tcg-op.c to inline the DDC checks for legacy loads and stores. */
+#define CHERI_DDC_ENV_OFFSET offsetof(CPURISCVState, DDC)
+#endif
+
 #include "exec/cpu-all.h"
 
 #endif /* RISCV_CPU_H */
@@ -544,6 +544,9 @@ void riscv_cpu_do_interrupt(CPUState *cs)
         case RISCV_EXCP_INST_PAGE_FAULT:
         case RISCV_EXCP_LOAD_PAGE_FAULT:
         case RISCV_EXCP_STORE_PAGE_FAULT:
+#ifdef TARGET_CHERI
+        case RISCV_EXCP_CHERI:
+#endif
             tval = env->badaddr;
             break;
         default:
@@ -75,4 +75,9 @@ DEF_HELPER_2(sret, tl, env, tl)
 DEF_HELPER_2(mret, tl, env, tl)
 DEF_HELPER_1(wfi, void, env)
 DEF_HELPER_1(tlb_flush, void, env)
+#ifdef TARGET_CHERI
+DEF_HELPER_4(cmemcpy_tags, void, env, i32, i32, i32)
+DEF_HELPER_3(clc, void, env, i32, tl)
+DEF_HELPER_3(csc, void, env, i32, tl)
+#endif
 #endif
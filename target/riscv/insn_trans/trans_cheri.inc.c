@@ -0,0 +1,130 @@
+/*
+ * RISC-V translation routines for the CHERI extension.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2 or later, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+static bool trans_cmemcpy_tags(DisasContext *ctx, arg_cmemcpy_tags *a)
+{
+#ifdef CONFIG_USER_ONLY
+    return false;
+#else
+    TCGv_i32 rd, rs1, rs2;
+
+    /* All three registers are updated, so they must be distinct. */
+    if (a->rd == 0 || a->rs1 == 0 || a->rs2 == 0 || a->rd == a->rs1 ||
+        a->rd == a->rs2 || a->rs1 == a->rs2) {
+        return false;
+    }
+    rd = tcg_const_i32(a->rd);
+    rs1 = tcg_const_i32(a->rs1);
+    rs2 = tcg_const_i32(a->rs2);
+    gen_helper_cmemcpy_tags(cpu_env, rd, rs1, rs2);
+    tcg_temp_free_i32(rd);
+    tcg_temp_free_i32(rs1);
+    tcg_temp_free_i32(rs2);
+    return true;
+#endif
+}
+
+static inline void gen_get_capreg_state(TCGv_i64 ret, int reg_num)
+{
+    tcg_gen_extract_i64(ret, cpu_capreg_state, reg_num * 2, 2);
+}
+
+/*
+ * Copy capability register cs to cd. Since the registers are kept
+ * compressed this only moves the cursor, the PESBT bits and the state.
+ */
+static void gen_move_capreg(int cd, int cs, bool clear_tag)
+{
+    TCGv t0;
+    TCGv_i64 state;
+
+    if (cd == 0) {
+        return;
+    }
+    t0 = tcg_temp_new();
+    gen_get_gpr(t0, cs);
+    tcg_gen_mov_tl(_cpu_cursors_do_not_access_directly[cd], t0);
+    tcg_gen_ld_tl(t0, cpu_env, offsetof(CPURISCVState, gpcapregs.pesbt[cs]));
+    tcg_gen_st_tl(t0, cpu_env, offsetof(CPURISCVState, gpcapregs.pesbt[cd]));
+    tcg_temp_free(t0);
+
+    state = tcg_temp_new_i64();
+    gen_get_capreg_state(state, cs);
+    if (clear_tag) {
+        /* CREG_TAGGED_CAP becomes CREG_UNTAGGED_CAP, integers stay as is. */
+        tcg_gen_setcondi_i64(TCG_COND_NE, state, state, CREG_INTEGER);
+    }
+    tcg_gen_deposit_i64(cpu_capreg_state, cpu_capreg_state, state, cd * 2, 2);
+    tcg_temp_free_i64(state);
+}
+
+static bool trans_cgettag(DisasContext *ctx, arg_cgettag *a)
+{
+    TCGv_i64 state = tcg_temp_new_i64();
+
+    gen_get_capreg_state(state, a->rs1);
+    tcg_gen_setcondi_i64(TCG_COND_EQ, state, state, CREG_TAGGED_CAP);
+    gen_set_gpr(a->rd, state);
+    tcg_temp_free_i64(state);
+    return true;
+}
+
+static bool trans_cmove(DisasContext *ctx, arg_cmove *a)
+{
+    gen_move_capreg(a->rd, a->rs1, false);
+    return true;
+}
+
+static bool trans_ccleartag(DisasContext *ctx, arg_ccleartag *a)
+{
+    gen_move_capreg(a->rd, a->rs1, true);
+    return true;
+}
+
+/* DDC-relative capability loads and stores (see helper_clc()). */
+static bool trans_clc(DisasContext *ctx, arg_clc *a)
+{
+#ifdef CONFIG_USER_ONLY
+    return false;
+#else
+    TCGv offset = tcg_temp_new();
+    TCGv_i32 cd = tcg_const_i32(a->rd);
+
+    gen_get_gpr(offset, a->rs1);
+    tcg_gen_addi_tl(offset, offset, a->imm);
+    gen_helper_clc(cpu_env, cd, offset);
+    tcg_temp_free_i32(cd);
+    tcg_temp_free(offset);
+    return true;
+#endif
+}
+
+static bool trans_csc(DisasContext *ctx, arg_csc *a)
+{
+#ifdef CONFIG_USER_ONLY
+    return false;
+#else
+    TCGv offset = tcg_temp_new();
+    TCGv_i32 cs = tcg_const_i32(a->rs2);
+
+    gen_get_gpr(offset, a->rs1);
+    tcg_gen_addi_tl(offset, offset, a->imm);
+    gen_helper_csc(cpu_env, cs, offset);
+    tcg_temp_free_i32(cs);
+    tcg_temp_free(offset);
+    return true;
+#endif
+}
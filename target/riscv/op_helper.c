@@ -23,6 +23,11 @@
 #include "qemu/main-loop.h"
 #include "exec/exec-all.h"
 #include "exec/helper-proto.h"
+#ifdef TARGET_CHERI
+#include "cheri_tagmem.h"
+#include "cheri_utils.h"
+#include "cheri-archspecific.h"
+#endif
 
 /* Exceptions processing helpers */
 void QEMU_NORETURN riscv_raise_exception(CPURISCVState *env,
@@ -154,4 +159,149 @@ void helper_tlb_flush(CPURISCVState *env)
     }
 }
 
+#ifdef TARGET_CHERI
+static void cmemcpy_set_gpr(CPURISCVState *env, uint32_t reg,
+                            target_ulong value)
+{
+    gpr_set_int_value(env, reg, value);
+    env->gpcapregs.capreg_state &= capreg_state_set_to_integer_mask(reg);
+}
+
+/*
+ * cmemcpy.tags rd, rs1, rs2: copy x[rd] bytes from x[rs2] to x[rs1] together
+ * with the tags of all capabilities in the buffer. Like other loads and
+ * stores, x[rs1] and x[rs2] are offsets into DDC.
+ *
+ * The registers are advanced after every page, so the instruction can simply
+ * be restarted after a page fault or a DDC violation. It stops early (with
+ * x[rd] != 0) if the buffers overlap, if DDC doesn't allow loading and
+ * storing capabilities, or if a page can't be copied directly (I/O memory or
+ * a capability load/store inhibit). Software has to copy the remaining bytes
+ * with a CLC/CSC loop in that case, which will then take the right traps.
+ */
+void helper_cmemcpy_tags(CPURISCVState *env, uint32_t rd, uint32_t rs1,
+                         uint32_t rs2)
+{
+    const cap_register_t *ddc = cheri_get_ddc(env);
+    const uint32_t cap_perms =
+        CAP_PERM_LOAD_CAP | CAP_PERM_STORE_CAP | CAP_PERM_STORE_LOCAL;
+    uintptr_t retpc = GETPC();
+    target_ulong dest = gpr_int_value(env, rs1);
+    target_ulong src = gpr_int_value(env, rs2);
+    target_ulong len = gpr_int_value(env, rd);
+
+    if (src < dest + len && dest < src + len) {
+        return;
+    }
+    if ((ddc->cr_perms & cap_perms) != cap_perms) {
+        return;
+    }
+    while (len > 0) {
+        target_ulong src_addr = cap_get_cursor(ddc) + src;
+        target_ulong dest_addr = cap_get_cursor(ddc) + dest;
+        target_ulong chunk = MIN(len,
+            MIN(TARGET_PAGE_SIZE - (src_addr & ~TARGET_PAGE_MASK),
+                TARGET_PAGE_SIZE - (dest_addr & ~TARGET_PAGE_MASK)));
+        /* cheri_tag_copy_host() accesses the pages without any checks. */
+        check_cap(env, ddc, CAP_PERM_LOAD, src_addr, CHERI_EXC_REGNUM_DDC,
+                  chunk, /*instavail=*/true, retpc);
+        check_cap(env, ddc, CAP_PERM_STORE, dest_addr, CHERI_EXC_REGNUM_DDC,
+                  chunk, /*instavail=*/true, retpc);
+        if (!cheri_tag_copy_host(env, dest_addr, src_addr, chunk, retpc)) {
+            return;
+        }
+        dest += chunk;
+        src += chunk;
+        len -= chunk;
+        cmemcpy_set_gpr(env, rs1, dest);
+        cmemcpy_set_gpr(env, rs2, src);
+        cmemcpy_set_gpr(env, rd, len);
+    }
+}
+
+/*
+ * Capabilities are kept compressed in GPCapRegs, so CLC and CSC move the
+ * cursor and PESBT words between memory and the register file unchanged:
+ * the cursor is stored at the lower address, followed by the PESBT bits in
+ * their in-memory (NULL-xored) format. The data and the tag are both
+ * accessed through the soft TLB entry for the capability.
+ */
+static target_ulong cap_check_ddc_access(CPURISCVState *env, uint32_t perm,
+                                         target_ulong offset, bool store,
+                                         uintptr_t retpc)
+{
+    const cap_register_t *ddc = cheri_get_ddc(env);
+    target_ulong addr = cap_get_cursor(ddc) + offset;
+
+    check_cap(env, ddc, perm, addr, CHERI_EXC_REGNUM_DDC, CHERI_CAP_SIZE,
+              /*instavail=*/true, retpc);
+    if (addr & (CHERI_CAP_SIZE - 1)) {
+        env->badaddr = addr;
+        riscv_raise_exception(env, store ? RISCV_EXCP_STORE_AMO_ADDR_MIS :
+                              RISCV_EXCP_LOAD_ADDR_MIS, retpc);
+    }
+    return addr;
+}
+
+/* clc cd, offset(rs1): load the capability at DDC + offset into cd. */
+void helper_clc(CPURISCVState *env, uint32_t cd, target_ulong offset)
+{
+    uintptr_t retpc = GETPC();
+    const cap_register_t *ddc = cheri_get_ddc(env);
+    target_ulong addr = cap_check_ddc_access(env, CAP_PERM_LOAD, offset,
+                                             false, retpc);
+    target_ulong cursor, pesbt;
+    uint8_t buf[CHERI_CAP_SIZE];
+    int tag, prot;
+
+    if (likely(cheri_tag_load_host(env, addr, cd, buf, &tag, &prot, retpc))) {
+        cursor = ldq_p(buf);
+        pesbt = ldq_p(buf + 8);
+    } else {
+        cursor = cpu_ldq_data_ra(env, addr, retpc);
+        pesbt = cpu_ldq_data_ra(env, addr + 8, retpc);
+        tag = cheri_tag_get(env, addr, cd, NULL, &prot, retpc);
+    }
+    /* Loading through a DDC without Permit_Load_Capability strips the tag. */
+    if (!(ddc->cr_perms & CAP_PERM_LOAD_CAP) || (prot & PAGE_LC_CLEAR)) {
+        tag = 0;
+    }
+    if (cd == 0) {
+        return;
+    }
+    env->gpcapregs.cursor[cd] = cursor;
+    env->gpcapregs.pesbt[cd] = pesbt;
+    env->gpcapregs.capreg_state =
+        deposit64(env->gpcapregs.capreg_state, cd * 2, 2,
+                  tag ? CREG_TAGGED_CAP : CREG_UNTAGGED_CAP);
+}
+
+/* csc cs2, offset(rs1): store cs2 to DDC + offset. */
+void helper_csc(CPURISCVState *env, uint32_t cs, target_ulong offset)
+{
+    uintptr_t retpc = GETPC();
+    uint64_t state = get_capreg_state(env->gpcapregs.capreg_state, cs);
+    bool tag = state == CREG_TAGGED_CAP;
+    target_ulong addr = cap_check_ddc_access(
+        env, tag ? CAP_PERM_STORE | CAP_PERM_STORE_CAP : CAP_PERM_STORE,
+        offset, true, retpc);
+    target_ulong cursor = cs == 0 ? 0 : gpr_int_value(env, cs);
+    /* Integers are stored as NULL-derived capabilities. */
+    target_ulong pesbt = state == CREG_INTEGER ? 0 : env->gpcapregs.pesbt[cs];
+    uint8_t buf[CHERI_CAP_SIZE];
+
+    stq_p(buf, cursor);
+    stq_p(buf + 8, pesbt);
+    if (unlikely(!cheri_tag_store_host(env, addr, cs, buf, tag, retpc))) {
+        if (tag) {
+            cheri_tag_set(env, addr, cs, retpc);
+        } else {
+            cheri_tag_invalidate(env, addr, CHERI_CAP_SIZE, retpc);
+        }
+        cpu_stq_data_ra(env, addr, cursor, retpc);
+        cpu_stq_data_ra(env, addr + 8, pesbt, retpc);
+    }
+}
+#endif /* TARGET_CHERI */
+
 #endif /* !CONFIG_USER_ONLY */
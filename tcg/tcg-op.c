@@ -2808,6 +2808,21 @@ static inline void plugin_gen_mem_callbacks(TCGv_cap_checked_ptr vaddr, uint16_t
 static inline void gen_cheri_invalidate_tags(TCGv_cap_checked_ptr out_addr, TCGv_i32 memop) {
     gen_helper_cheri_invalidate_tags(cpu_env, out_addr, memop);
 }
+
+/*
+ * With MTTCG, integer stores must clear the tags before the data changes and
+ * keep other vCPUs from setting them again until it has. Stores to pages
+ * that may hold tags take the slow path for this (TLB_CHERI_TAGGED, see
+ * store_helper()) and all other pages have no tags to clear.
+ */
+static inline bool cheri_store_clears_tags(void)
+{
+#ifdef CONFIG_SOFTMMU
+    return tcg_ctx->tb_cflags & CF_PARALLEL;
+#else
+    return false;
+#endif
+}
 #endif
 
 void tcg_gen_qemu_ld_i32_with_checked_addr(TCGv_i32 val, TCGv_cap_checked_ptr addr, TCGArg idx, MemOp memop)
@@ -2901,7 +2916,9 @@ void tcg_gen_qemu_st_i32_with_checked_addr(TCGv_i32 val, TCGv_cap_checked_ptr ad
 #if defined(TARGET_MIPS) && defined(CONFIG_MIPS_LOG_INSTR)
     gen_helper_dump_store32(cpu_env, addr, val, tcop);
 #endif
-    gen_cheri_invalidate_tags(addr, tcop);
+    if (!cheri_store_clears_tags()) {
+        gen_cheri_invalidate_tags(addr, tcop);
+    }
     tcg_temp_free_i32(tcop);
 #endif
 
@@ -3028,7 +3045,9 @@ void tcg_gen_qemu_st_i64_with_checked_addr(TCGv_i64 val, TCGv_cap_checked_ptr ad
 #if defined(TARGET_MIPS) && defined(CONFIG_MIPS_LOG_INSTR)
     gen_helper_dump_store(cpu_env, addr, val, tcop);
 #endif
-    gen_cheri_invalidate_tags(addr, tcop);
+    if (!cheri_store_clears_tags()) {
+        gen_cheri_invalidate_tags(addr, tcop);
+    }
     tcg_temp_free_i32(tcop);
 #endif
 
@@ -3039,36 +3058,160 @@ void tcg_gen_qemu_st_i64_with_checked_addr(TCGv_i64 val, TCGv_cap_checked_ptr ad
 
 
 #ifdef TARGET_CHERI
-void tcg_gen_qemu_ld_ddc_i32(TCGv_i32 val, TCGv_cap_checked_ptr out_addr, TCGv in_addr, TCGArg idx, MemOp memop) {
+/*
+ * Targets that define CHERI_DDC_ENV_OFFSET (the offset of the DDC
+ * cap_register_t in CPUArchState) get the DDC checks for legacy loads and
+ * stores inlined, and only call the helper if one of the checks fails.
+ */
+#if defined(CHERI_DDC_ENV_OFFSET) && TARGET_LONG_BITS == 64
+#define TCG_INLINE_DDC_CHECKS
+#endif
+
+static inline void gen_helper_ddc_check(TCGv_cap_checked_ptr out_addr,
+                                        TCGv in_addr, MemOp memop,
+                                        bool store)
+{
     TCGv_i32 op = tcg_const_i32(memop);
+    if (store) {
+        gen_helper_ddc_check_store(out_addr, cpu_env, in_addr, op);
+    } else {
+        gen_helper_ddc_check_load(out_addr, cpu_env, in_addr, op);
+    }
+    tcg_temp_free_i32(op);
+}
+
+#ifdef TCG_INLINE_DDC_CHECKS
+/*
+ * Emit the tag, seal, permission and bounds checks that check_ddc() performs
+ * as TCG ops. If any of them fails we fall back to the helper, which either
+ * raises the exception or (for the corner cases not handled inline, such as
+ * accesses that wrap around the address space) returns the address.
+ *
+ * Normal temps do not survive the branches, so @in_addr is saved in a local
+ * temp and written back afterwards since callers may still use it (e.g. the
+ * microMIPS LWP/SWP pairs). Other temps live across a load or store must be
+ * saved by the caller (see tcg_gen_qemu_st_ddc_*()).
+ */
+static void gen_ddc_check(TCGv_cap_checked_ptr out_addr, TCGv in_addr,
+                          MemOp memop, bool store)
+{
+#ifdef HOST_WORDS_BIGENDIAN
+    const int top_lo = offsetof(cap_register_t, _cr_top) + 8;
+    const int top_hi = offsetof(cap_register_t, _cr_top);
+#else
+    const int top_lo = offsetof(cap_register_t, _cr_top);
+    const int top_hi = offsetof(cap_register_t, _cr_top) + 8;
+#endif
+    const int ddc = CHERI_DDC_ENV_OFFSET;
+    const uint32_t perm = store ? CAP_PERM_STORE : CAP_PERM_LOAD;
+    const target_ulong len = memop_size(memop);
+    TCGLabel *slow_path = gen_new_label();
+    TCGLabel *done = gen_new_label();
+    TCGv offset = tcg_temp_local_new();
+    TCGv addr = tcg_temp_local_new();
+    TCGv t0, t1;
+
+    tcg_gen_mov_tl(offset, in_addr);
+    tcg_gen_ld_tl(addr, cpu_env, ddc + offsetof(cap_register_t, _cr_cursor));
+    tcg_gen_add_tl(addr, addr, offset);
+
+    t0 = tcg_temp_new();
+    tcg_gen_ld8u_tl(t0, cpu_env, ddc + offsetof(cap_register_t, cr_tag));
+    tcg_gen_brcondi_tl(TCG_COND_EQ, t0, 0, slow_path);
+    tcg_temp_free(t0);
+
+    t0 = tcg_temp_new();
+    tcg_gen_ld32u_tl(t0, cpu_env, ddc + offsetof(cap_register_t, cr_otype));
+    tcg_gen_brcondi_tl(TCG_COND_LTU, t0, CAP_OTYPE_UNSEALED, slow_path);
+    tcg_temp_free(t0);
+
+    t0 = tcg_temp_new();
+    tcg_gen_ld32u_tl(t0, cpu_env, ddc + offsetof(cap_register_t, cr_perms));
+    tcg_gen_andi_tl(t0, t0, perm);
+    tcg_gen_brcondi_tl(TCG_COND_EQ, t0, 0, slow_path);
+    tcg_temp_free(t0);
+
+    t0 = tcg_temp_new();
+    tcg_gen_ld_tl(t0, cpu_env, ddc + offsetof(cap_register_t, cr_base));
+    tcg_gen_brcond_tl(TCG_COND_LTU, addr, t0, slow_path);
+    tcg_temp_free(t0);
+
+    t0 = tcg_temp_new();
+    tcg_gen_addi_tl(t0, addr, len);
+    tcg_gen_brcond_tl(TCG_COND_LTU, t0, addr, slow_path);
+    tcg_temp_free(t0);
+
+    /* If bit 64 of top is set, any non-wrapping access is in bounds. */
+    t0 = tcg_temp_new();
+    tcg_gen_ld_tl(t0, cpu_env, ddc + top_hi);
+    tcg_gen_brcondi_tl(TCG_COND_NE, t0, 0, done);
+    tcg_temp_free(t0);
+
+    t0 = tcg_temp_new();
+    t1 = tcg_temp_new();
+    tcg_gen_addi_tl(t0, addr, len);
+    tcg_gen_ld_tl(t1, cpu_env, ddc + top_lo);
+    tcg_gen_brcond_tl(TCG_COND_LEU, t0, t1, done);
+    tcg_temp_free(t1);
+    tcg_temp_free(t0);
+
+    gen_set_label(slow_path);
+    gen_helper_ddc_check((TCGv_cap_checked_ptr)addr, offset, memop, store);
+
+    gen_set_label(done);
+    if ((TCGv)out_addr != in_addr) {
+        tcg_gen_mov_tl(in_addr, offset);
+    }
+    tcg_gen_mov_tl((TCGv)out_addr, addr);
+    tcg_temp_free(addr);
+    tcg_temp_free(offset);
+}
+#else
+static inline void gen_ddc_check(TCGv_cap_checked_ptr out_addr, TCGv in_addr,
+                                 MemOp memop, bool store)
+{
+    gen_helper_ddc_check(out_addr, in_addr, memop, store);
+}
+#endif
+
+void tcg_gen_qemu_ld_ddc_i32(TCGv_i32 val, TCGv_cap_checked_ptr out_addr, TCGv in_addr, TCGArg idx, MemOp memop) {
     if (out_addr == NULL)
         out_addr = (TCGv_cap_checked_ptr)in_addr;
-    gen_helper_ddc_check_load(out_addr, cpu_env, in_addr, op);
-    tcg_temp_free_i32(op);
+    gen_ddc_check(out_addr, in_addr, memop, false);
     tcg_gen_qemu_ld_i32_with_checked_addr(val, out_addr, idx, memop);
 }
 void tcg_gen_qemu_ld_ddc_i64(TCGv_i64 val, TCGv_cap_checked_ptr out_addr, TCGv in_addr, TCGArg idx, MemOp memop) {
-    TCGv_i32 op = tcg_const_i32(memop);
     if (out_addr == NULL)
         out_addr = (TCGv_cap_checked_ptr)in_addr;
-    gen_helper_ddc_check_load(out_addr, cpu_env, in_addr, op);
-    tcg_temp_free_i32(op);
+    gen_ddc_check(out_addr, in_addr, memop, false);
     tcg_gen_qemu_ld_i64_with_checked_addr(val, out_addr, idx, memop);
 }
 void tcg_gen_qemu_st_ddc_i32(TCGv_i32 val, TCGv_cap_checked_ptr out_addr, TCGv in_addr, TCGArg idx, MemOp memop) {
-    TCGv_i32 op = tcg_const_i32(memop);
     if (out_addr == NULL)
         out_addr = (TCGv_cap_checked_ptr)in_addr;
-    gen_helper_ddc_check_store(out_addr, cpu_env, in_addr, op);
-    tcg_temp_free_i32(op);
+#ifdef TCG_INLINE_DDC_CHECKS
+    TCGv_i32 saved_val = tcg_temp_local_new_i32();
+    tcg_gen_mov_i32(saved_val, val);
+    gen_ddc_check(out_addr, in_addr, memop, true);
+    tcg_gen_mov_i32(val, saved_val);
+    tcg_temp_free_i32(saved_val);
+#else
+    gen_ddc_check(out_addr, in_addr, memop, true);
+#endif
     tcg_gen_qemu_st_i32_with_checked_addr(val, out_addr, idx, memop);
 }
 void tcg_gen_qemu_st_ddc_i64(TCGv_i64 val, TCGv_cap_checked_ptr out_addr, TCGv in_addr, TCGArg idx, MemOp memop) {
-    TCGv_i32 op = tcg_const_i32(memop);
     if (out_addr == NULL)
         out_addr = (TCGv_cap_checked_ptr)in_addr;
-    gen_helper_ddc_check_store(out_addr, cpu_env, in_addr, op);
-    tcg_temp_free_i32(op);
+#ifdef TCG_INLINE_DDC_CHECKS
+    TCGv_i64 saved_val = tcg_temp_local_new_i64();
+    tcg_gen_mov_i64(saved_val, val);
+    gen_ddc_check(out_addr, in_addr, memop, true);
+    tcg_gen_mov_i64(val, saved_val);
+    tcg_temp_free_i64(saved_val);
+#else
+    gen_ddc_check(out_addr, in_addr, memop, true);
+#endif
     tcg_gen_qemu_st_i64_with_checked_addr(val, out_addr, idx, memop);
 }
 void tcg_gen_atomic_cmpxchg_ddc_i64(TCGv_i64 retv, TCGv int_addr, TCGv_i64 cmpv,
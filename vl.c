@@ -126,6 +126,7 @@ int main(int argc, char **argv)
 #include "qapi/qapi-commands-block-core.h"
 #include "qapi/qapi-commands-run-state.h"
 #include "qapi/qapi-commands-ui.h"
+#include "qapi/qapi-commands-misc-target.h"
 #include "qapi/qmp/qerror.h"
 #include "sysemu/iothread.h"
 #include "qemu/guest-random.h"
@@ -193,6 +194,7 @@ int icount_align_option;
 #else
     int cl_default_trace_format = CPU_LOG_INSTR;
 #endif
+bool cvtrace_compress = false;
 #endif /* CONFIG_MIPS_LOG_INSTR */
 #ifdef CONFIG_CHERI
 bool cheri_c2e_on_unrepresentable = false;
@@ -3679,11 +3681,19 @@ int main(int argc, char **argv, char **envp)
                     cl_default_trace_format = CPU_LOG_INSTR;
                 else if (strcmp(optarg, "cvtrace") == 0)
                     cl_default_trace_format = CPU_LOG_CVTRACE;
-                else {
+                else if (strcmp(optarg, "cvtrace-compressed") == 0) {
+                    cl_default_trace_format = CPU_LOG_CVTRACE;
+                    cvtrace_compress = true;
+                } else {
                     printf("Invalid choice for cheri-trace-format: '%s'\n", optarg);
                     exit(1);
                 }
                 break;
+#if defined(TARGET_MIPS)
+            case QEMU_OPTION_cheri_trace_filter:
+                qmp_cheri_trace_filter(optarg, &error_fatal);
+                break;
+#endif
 #endif /* CONFIG_MIPS_LOG_INSTR */
 #endif /* CONFIG_CHERI */
 